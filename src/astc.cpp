@@ -0,0 +1,729 @@
+#include <astc.h>
+
+#include <image.h>
+#include <cubemap.h>
+#include <parallel.h>
+#include <util.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <optional>
+
+using namespace ibl;
+using namespace ibl::util;
+
+namespace {
+
+/* ------------------------------------------------------------------
+    Blocks are encoded with a single partition and the HDR RGB direct
+    endpoint mode (CEM 11 with both major component bits set), which
+    keeps the six endpoint integers at the full 8 bit range. Weights
+    only use power of two ranges, so no trit/quint packing is needed.
+ -------------------------------------------------------------------*/
+constexpr int HdrRgbEndpointMode = 11;
+constexpr int ConfigBits = 17; // Block mode + partition count + endpoint mode
+constexpr int EndpointBits = 6 * 8;
+constexpr int MinWeightBits = 24;
+constexpr int MaxWeightBits = 128 - ConfigBits - EndpointBits;
+constexpr int MaxBlockTexels = 12 * 12;
+
+constexpr std::array QuantLevels{2, 3, 4, 5, 6, 8, 10, 12, 16, 20, 24, 32};
+
+constexpr std::array<std::pair<int, int>, 14> Footprints{
+    {{4, 4},
+     {5, 4},
+     {5, 5},
+     {6, 5},
+     {6, 6},
+     {8, 5},
+     {8, 6},
+     {8, 8},
+     {10, 5},
+     {10, 6},
+     {10, 8},
+     {10, 10},
+     {12, 10},
+     {12, 12}}
+};
+
+constexpr std::uint8_t AstcMagic[4] = {0x13, 0xAB, 0xA1, 0x5C};
+
+struct AstcHeader {
+    std::uint8_t magic[4];
+    std::uint8_t blockX, blockY, blockZ;
+    std::uint8_t dimX[3], dimY[3], dimZ[3];
+};
+
+using Vec3 = std::array<float, 3>;
+
+// ------------------------------------------------------------------
+//    Block mode and weight grid helpers
+// ------------------------------------------------------------------
+struct BlockMode {
+    int gridX = 0, gridY = 0;
+    int quantMode = 0;
+    bool dualPlane = false;
+};
+
+// Decodes the 11 bit block mode field of a 2D block
+std::optional<BlockMode> DecodeBlockMode(int mode) {
+    int baseQuant = (mode >> 4) & 1;
+    int H = (mode >> 9) & 1;
+    int D = (mode >> 10) & 1;
+    int A = (mode >> 5) & 0x3;
+
+    int x = 0, y = 0;
+    if ((mode & 3) != 0) {
+        baseQuant |= (mode & 3) << 1;
+        int B = (mode >> 7) & 3;
+        switch ((mode >> 2) & 3) {
+        case 0:
+            x = B + 4, y = A + 2;
+            break;
+        case 1:
+            x = B + 8, y = A + 2;
+            break;
+        case 2:
+            x = A + 2, y = B + 8;
+            break;
+        case 3:
+            B &= 1;
+            if (mode & 0x100)
+                x = B + 2, y = A + 2;
+            else
+                x = A + 2, y = B + 6;
+            break;
+        }
+    } else {
+        baseQuant |= ((mode >> 2) & 3) << 1;
+        if (((mode >> 2) & 3) == 0)
+            return std::nullopt;
+
+        int B = (mode >> 9) & 3;
+        switch ((mode >> 7) & 3) {
+        case 0:
+            x = 12, y = A + 2;
+            break;
+        case 1:
+            x = A + 2, y = 12;
+            break;
+        case 2:
+            x = A + 6, y = B + 6;
+            D = 0, H = 0;
+            break;
+        case 3:
+            if (((mode >> 5) & 3) == 0)
+                x = 6, y = 10;
+            else if (((mode >> 5) & 3) == 1)
+                x = 10, y = 6;
+            else
+                return std::nullopt;
+            break;
+        }
+    }
+
+    int quantMode = (baseQuant - 2) + 6 * H;
+    if (quantMode < 0 || quantMode >= static_cast<int>(QuantLevels.size()))
+        return std::nullopt;
+
+    return BlockMode{x, y, quantMode, D != 0};
+}
+
+int WeightBits(int quantLevels) {
+    switch (quantLevels) {
+    case 2:
+        return 1;
+    case 4:
+        return 2;
+    case 8:
+        return 3;
+    case 16:
+        return 4;
+    case 32:
+        return 5;
+    default:
+        return 0; // Needs trits or quints
+    }
+}
+
+// Bit replication into [0, 64]
+int UnquantizeWeight(int code, int bits) {
+    int val = 0, filled = 0;
+    while (filled < 6) {
+        val = (val << bits) | code;
+        filled += bits;
+    }
+    val >>= filled - 6;
+
+    return val > 32 ? val + 1 : val;
+}
+
+// Bilinear weight infill of a texel from the weight grid, as specified by the format
+struct Infill {
+    std::array<int, 4> idx;
+    std::array<int, 4> w;
+};
+
+struct WeightGrid {
+    int blockMode = 0;
+    int x = 0, y = 0;
+    int bits = 0;
+
+    std::vector<Infill> infill;
+    std::vector<int> unquant; // Unquantized value of each code
+};
+
+std::vector<Infill> BuildInfill(int blockX, int blockY, int gridX, int gridY) {
+    const int ds = (1024 + blockX / 2) / (blockX - 1);
+    const int dt = (1024 + blockY / 2) / (blockY - 1);
+    const int lastIdx = gridX * gridY - 1;
+
+    std::vector<Infill> infill(blockX * blockY);
+    for (int t = 0; t < blockY; ++t) {
+        for (int s = 0; s < blockX; ++s) {
+            int gs = (ds * s * (gridX - 1) + 32) >> 6;
+            int gt = (dt * t * (gridY - 1) + 32) >> 6;
+            int js = gs >> 4, fs = gs & 0xF;
+            int jt = gt >> 4, ft = gt & 0xF;
+
+            int w11 = (fs * ft + 8) >> 4;
+            int w10 = ft - w11;
+            int w01 = fs - w11;
+            int w00 = 16 - fs - ft + w11;
+
+            int v0 = js + jt * gridX;
+
+            auto& texel = infill[t * blockX + s];
+            texel.idx = {v0, std::min(v0 + 1, lastIdx), std::min(v0 + gridX, lastIdx),
+                         std::min(v0 + gridX + 1, lastIdx)};
+            texel.w = {w00, w01, w10, w11};
+        }
+    }
+
+    return infill;
+}
+
+std::vector<WeightGrid> BuildWeightGrids(int blockX, int blockY) {
+    std::vector<WeightGrid> grids;
+
+    for (int mode = 0; mode < 2048; ++mode) {
+        auto bm = DecodeBlockMode(mode);
+        if (!bm || bm->dualPlane)
+            continue;
+
+        int bits = WeightBits(QuantLevels[bm->quantMode]);
+        int totalBits = bm->gridX * bm->gridY * bits;
+        if (bits == 0 || bm->gridX > blockX || bm->gridY > blockY ||
+            totalBits < MinWeightBits || totalBits > MaxWeightBits)
+            continue;
+
+        auto it = std::find_if(grids.begin(), grids.end(), [&](const auto& g) {
+            return g.x == bm->gridX && g.y == bm->gridY && g.bits == bits;
+        });
+        if (it != grids.end())
+            continue;
+
+        WeightGrid grid;
+        grid.blockMode = mode;
+        grid.x = bm->gridX;
+        grid.y = bm->gridY;
+        grid.bits = bits;
+        grid.infill = BuildInfill(blockX, blockY, grid.x, grid.y);
+        for (int c = 0; c < (1 << bits); ++c)
+            grid.unquant.push_back(UnquantizeWeight(c, bits));
+
+        grids.push_back(std::move(grid));
+    }
+
+    // Most weight information first, then finer grids. Single bit weights can't
+    // represent gradients so they are only tried last.
+    std::sort(grids.begin(), grids.end(), [](const auto& a, const auto& b) {
+        auto Key = [](const auto& g) {
+            return std::tuple{g.bits > 1, g.x * g.y * g.bits, g.x * g.y};
+        };
+        return Key(a) > Key(b);
+    });
+
+    return grids;
+}
+
+// ------------------------------------------------------------------
+//    HDR value conversions
+// ------------------------------------------------------------------
+std::uint16_t ToHalfBits(float val) {
+    if (!(val > 0.0f)) // Also catches NaNs
+        val = 0.0f;
+    val = std::min(val, 65504.0f);
+
+    Half half{val};
+    std::uint16_t bits;
+    std::memcpy(&bits, &half, sizeof(bits));
+    return bits;
+}
+
+// Maps a FP16 value into the logarithmic space the decoder interpolates in
+int HalfToLns(std::uint16_t half) {
+    int exp = half >> 10;
+    int mt = (half & 0x3FF) << 3;
+
+    int mc;
+    if (mt < 1536)
+        mc = (mt + 1) / 3;
+    else if (mt < 5632)
+        mc = (mt + 512 + 2) / 4;
+    else
+        mc = (mt + 2048 + 2) / 5;
+
+    return (exp << 11) | std::min(mc, 0x7FF);
+}
+
+// ------------------------------------------------------------------
+//    Block encoding
+// ------------------------------------------------------------------
+struct BlockTexels {
+    int count = 0;
+    std::array<std::uint16_t, MaxBlockTexels * 3> half;
+    std::array<Vec3, MaxBlockTexels> lns;
+};
+
+// Endpoint integers v0..v5 of the direct mode. R and G keep 8 bits of the 16 bit
+// LNS value, B keeps 7 bits.
+struct Endpoints {
+    std::array<int, 3> lo, hi;
+
+    static int Shift(int ch) { return ch < 2 ? 8 : 9; }
+    static int MaxCode(int ch) { return ch < 2 ? 255 : 127; }
+
+    int low(int ch) const { return lo[ch] << Shift(ch); }
+    int high(int ch) const { return hi[ch] << Shift(ch); }
+};
+
+struct Candidate {
+    Endpoints ep;
+    std::vector<int> codes; // Quantized grid weights
+    double error = std::numeric_limits<double>::max();
+};
+
+class BlockEncoder {
+public:
+    BlockEncoder(const AstcOptions& opts)
+        : opts(opts), grids(BuildWeightGrids(opts.blockX, opts.blockY)) {
+        if (grids.empty())
+            FATAL("No usable ASTC weight grid for {}x{} blocks", opts.blockX,
+                  opts.blockY);
+    }
+
+    AstcBlock encode(const BlockTexels& texels) const;
+
+private:
+    Endpoints initialEndpoints(const BlockTexels& texels) const;
+    void fitWeights(const BlockTexels& texels, const WeightGrid& grid,
+                    Candidate& cand) const;
+    int numGridCandidates() const;
+    int refinePasses() const;
+
+    AstcBlock voidExtent(const BlockTexels& texels) const;
+    AstcBlock pack(const WeightGrid& grid, const Candidate& cand) const;
+
+    AstcOptions opts;
+    std::vector<WeightGrid> grids;
+};
+
+int BlockEncoder::numGridCandidates() const {
+    using enum AstcQuality;
+    switch (opts.quality) {
+    case Fast:
+        return 1;
+    case Medium:
+        return std::min<int>(2, grids.size());
+    default:
+        return grids.size();
+    }
+}
+
+int BlockEncoder::refinePasses() const {
+    using enum AstcQuality;
+    switch (opts.quality) {
+    case Fast:
+        return 0;
+    case Medium:
+        return 1;
+    default:
+        return 3;
+    }
+}
+
+Endpoints BlockEncoder::initialEndpoints(const BlockTexels& texels) const {
+    Vec3 mean{0, 0, 0};
+    for (int t = 0; t < texels.count; ++t)
+        for (int c = 0; c < 3; ++c)
+            mean[c] += texels.lns[t][c];
+    for (auto& m : mean)
+        m /= texels.count;
+
+    float cov[3][3] = {};
+    for (int t = 0; t < texels.count; ++t) {
+        Vec3 d;
+        for (int c = 0; c < 3; ++c)
+            d[c] = texels.lns[t][c] - mean[c];
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 3; ++j)
+                cov[i][j] += d[i] * d[j];
+    }
+
+    // Principal axis by power iteration, starting from the widest channel
+    int widest = 0;
+    for (int c = 1; c < 3; ++c)
+        if (cov[c][c] > cov[widest][widest])
+            widest = c;
+
+    Vec3 axis{0, 0, 0};
+    axis[widest] = 1.0f;
+    for (int it = 0; it < 8; ++it) {
+        Vec3 next{0, 0, 0};
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 3; ++j)
+                next[i] += cov[i][j] * axis[j];
+
+        float len = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (len < 1e-6f)
+            break;
+        for (int c = 0; c < 3; ++c)
+            axis[c] = next[c] / len;
+    }
+
+    float tMin = std::numeric_limits<float>::max();
+    float tMax = std::numeric_limits<float>::lowest();
+    for (int t = 0; t < texels.count; ++t) {
+        float proj = 0.0f;
+        for (int c = 0; c < 3; ++c)
+            proj += (texels.lns[t][c] - mean[c]) * axis[c];
+        tMin = std::min(tMin, proj);
+        tMax = std::max(tMax, proj);
+    }
+
+    Endpoints ep;
+    for (int c = 0; c < 3; ++c) {
+        float scale = 1.0f / (1 << Endpoints::Shift(c));
+        auto Quantize = [&](float val) {
+            return std::clamp<int>(std::lround(val * scale), 0, Endpoints::MaxCode(c));
+        };
+
+        ep.lo[c] = Quantize(mean[c] + axis[c] * tMin);
+        ep.hi[c] = Quantize(mean[c] + axis[c] * tMax);
+    }
+
+    return ep;
+}
+
+void BlockEncoder::fitWeights(const BlockTexels& texels, const WeightGrid& grid,
+                              Candidate& cand) const {
+    const auto& ep = cand.ep;
+
+    // Ideal texel weights, projecting onto the quantized endpoint segment
+    std::array<float, MaxBlockTexels> ideal;
+
+    Vec3 dir;
+    float len2 = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+        dir[c] = static_cast<float>(ep.high(c) - ep.low(c));
+        len2 += dir[c] * dir[c];
+    }
+
+    for (int t = 0; t < texels.count; ++t) {
+        float proj = 0.0f;
+        for (int c = 0; c < 3; ++c)
+            proj += (texels.lns[t][c] - ep.low(c)) * dir[c];
+        ideal[t] = len2 > 0.0f ? std::clamp(64.0f * proj / len2, 0.0f, 64.0f) : 0.0f;
+    }
+
+    // Least squares fit of the grid weights through the infill operator
+    const int numWeights = grid.x * grid.y;
+    std::array<float, MaxBlockTexels> gridW{};
+    std::array<float, MaxBlockTexels> norm{};
+
+    for (int t = 0; t < texels.count; ++t) {
+        for (int k = 0; k < 4; ++k) {
+            gridW[grid.infill[t].idx[k]] += grid.infill[t].w[k] * ideal[t];
+            norm[grid.infill[t].idx[k]] += grid.infill[t].w[k];
+        }
+    }
+
+    for (int g = 0; g < numWeights; ++g)
+        gridW[g] = norm[g] > 0.0f ? gridW[g] / norm[g] : 0.0f;
+
+    const int iterations = opts.quality == AstcQuality::Fast ? 1 : 4;
+    if (grid.x * grid.y < texels.count) {
+        for (int it = 0; it < iterations; ++it) {
+            std::array<float, MaxBlockTexels> delta{};
+            for (int t = 0; t < texels.count; ++t) {
+                const auto& inf = grid.infill[t];
+
+                float val = 0.0f;
+                for (int k = 0; k < 4; ++k)
+                    val += inf.w[k] * gridW[inf.idx[k]];
+
+                float res = ideal[t] - val / 16.0f;
+                for (int k = 0; k < 4; ++k)
+                    delta[inf.idx[k]] += inf.w[k] * res;
+            }
+
+            for (int g = 0; g < numWeights; ++g)
+                if (norm[g] > 0.0f)
+                    gridW[g] = std::clamp(gridW[g] + delta[g] / norm[g], 0.0f, 64.0f);
+        }
+    }
+
+    // Quantize to the nearest representable weight
+    cand.codes.resize(numWeights);
+    for (int g = 0; g < numWeights; ++g) {
+        int best = 0;
+        for (int c = 1; c < static_cast<int>(grid.unquant.size()); ++c)
+            if (std::abs(grid.unquant[c] - gridW[g]) <
+                std::abs(grid.unquant[best] - gridW[g]))
+                best = c;
+        cand.codes[g] = best;
+    }
+
+    // Error of the decoded block, measured in LNS space
+    double error = 0.0;
+    for (int t = 0; t < texels.count; ++t) {
+        const auto& inf = grid.infill[t];
+
+        int sum = 8;
+        for (int k = 0; k < 4; ++k)
+            sum += inf.w[k] * grid.unquant[cand.codes[inf.idx[k]]];
+        int w = sum >> 4;
+
+        for (int c = 0; c < 3; ++c) {
+            int decoded = (ep.low(c) * (64 - w) + ep.high(c) * w + 32) >> 6;
+            double diff = decoded - texels.lns[t][c];
+            error += diff * diff;
+        }
+    }
+
+    cand.error = error;
+}
+
+AstcBlock BlockEncoder::voidExtent(const BlockTexels& texels) const {
+    AstcBlock block;
+
+    // Constant color block without extents, HDR flag set
+    std::uint64_t header = 0xFFFFFFFFFFFFFFFCull;
+    std::uint16_t rgba[4] = {texels.half[0], texels.half[1], texels.half[2], 0x3C00};
+
+    std::memcpy(block.data(), &header, sizeof(header));
+    std::memcpy(block.data() + 8, rgba, sizeof(rgba));
+
+    return block;
+}
+
+AstcBlock BlockEncoder::pack(const WeightGrid& grid, const Candidate& cand) const {
+    AstcBlock block{};
+
+    auto SetBit = [&](int pos) { block[pos >> 3] |= 1 << (pos & 7); };
+    auto Write = [&](int pos, int numBits, std::uint32_t val) {
+        for (int b = 0; b < numBits; ++b)
+            if ((val >> b) & 1)
+                SetBit(pos + b);
+    };
+
+    Write(0, 11, grid.blockMode);
+    Write(11, 2, 0); // Single partition
+    Write(13, 4, HdrRgbEndpointMode);
+
+    const auto& ep = cand.ep;
+    std::array<int, 6> vals{ep.lo[0], ep.hi[0], ep.lo[1], ep.hi[1],
+                            0x80 | ep.lo[2], 0x80 | ep.hi[2]};
+    for (int v = 0; v < 6; ++v)
+        Write(ConfigBits + 8 * v, 8, vals[v]);
+
+    // Weights are stored bit reversed from the top of the block
+    for (std::size_t w = 0; w < cand.codes.size(); ++w)
+        for (int b = 0; b < grid.bits; ++b)
+            if ((cand.codes[w] >> b) & 1)
+                SetBit(127 - (static_cast<int>(w) * grid.bits + b));
+
+    return block;
+}
+
+AstcBlock BlockEncoder::encode(const BlockTexels& texels) const {
+    bool uniform = true;
+    for (int t = 1; t < texels.count && uniform; ++t)
+        for (int c = 0; c < 3; ++c)
+            uniform = uniform && texels.half[t * 3 + c] == texels.half[c];
+
+    if (uniform)
+        return voidExtent(texels);
+
+    const auto initial = initialEndpoints(texels);
+
+    const WeightGrid* bestGrid = nullptr;
+    Candidate best;
+
+    for (int g = 0; g < numGridCandidates(); ++g) {
+        const auto& grid = grids[g];
+
+        Candidate cand;
+        cand.ep = initial;
+        fitWeights(texels, grid, cand);
+
+        // Greedy single step refinement of the endpoint integers
+        for (int pass = 0; pass < refinePasses(); ++pass) {
+            bool improved = false;
+            for (int c = 0; c < 3; ++c) {
+                for (int end = 0; end < 2; ++end) {
+                    for (int step : {-1, 1}) {
+                        Candidate trial = cand;
+
+                        auto& code = end == 0 ? trial.ep.lo[c] : trial.ep.hi[c];
+                        code += step;
+                        if (code < 0 || code > Endpoints::MaxCode(c))
+                            continue;
+
+                        fitWeights(texels, grid, trial);
+                        if (trial.error < cand.error) {
+                            cand = std::move(trial);
+                            improved = true;
+                        }
+                    }
+                }
+            }
+
+            if (!improved)
+                break;
+        }
+
+        if (cand.error < best.error) {
+            best = std::move(cand);
+            bestGrid = &grid;
+        }
+    }
+
+    return pack(*bestGrid, best);
+}
+
+void GatherBlock(const float* rgb, int width, int height, int bx, int by, int blockX,
+                 int blockY, BlockTexels& texels) {
+    texels.count = blockX * blockY;
+
+    for (int t = 0; t < blockY; ++t) {
+        // Replicate edge texels on partial blocks
+        int y = std::min(by * blockY + t, height - 1);
+        for (int s = 0; s < blockX; ++s) {
+            int x = std::min(bx * blockX + s, width - 1);
+            const float* px = rgb + 3 * (static_cast<std::size_t>(y) * width + x);
+
+            int idx = t * blockX + s;
+            for (int c = 0; c < 3; ++c) {
+                auto half = ToHalfBits(px[c]);
+                texels.half[idx * 3 + c] = half;
+                texels.lns[idx][c] = static_cast<float>(HalfToLns(half));
+            }
+        }
+    }
+}
+
+void Write24(std::uint8_t* dst, int val) {
+    dst[0] = val & 0xFF;
+    dst[1] = (val >> 8) & 0xFF;
+    dst[2] = (val >> 16) & 0xFF;
+}
+
+} // namespace
+
+bool ibl::IsValidAstcFootprint(int blockX, int blockY) {
+    return std::find(Footprints.begin(), Footprints.end(), std::pair{blockX, blockY}) !=
+           Footprints.end();
+}
+
+int ibl::NumAstcBlocks(int width, int height, int blockX, int blockY) {
+    return ((width + blockX - 1) / blockX) * ((height + blockY - 1) / blockY);
+}
+
+AstcImage ibl::EncodeAstcHdr(const ImageView& image, const AstcOptions& opts) {
+    if (!IsValidAstcFootprint(opts.blockX, opts.blockY))
+        FATAL("Unsupported ASTC block footprint {}x{}", opts.blockX, opts.blockY);
+
+    auto imgFmt = image.format();
+    auto rgb = image.convertTo({PixelFormat::F32, imgFmt.width, imgFmt.height, 3});
+    auto* rgbPtr = reinterpret_cast<const float*>(rgb.data());
+
+    AstcImage astc;
+    astc.width = imgFmt.width;
+    astc.height = imgFmt.height;
+    astc.blockX = opts.blockX;
+    astc.blockY = opts.blockY;
+
+    const int blocksX = (imgFmt.width + opts.blockX - 1) / opts.blockX;
+    const int blocksY = (imgFmt.height + opts.blockY - 1) / opts.blockY;
+    astc.blocks.resize(blocksX * blocksY);
+
+    BlockEncoder encoder{opts};
+
+    ParallelFor(blocksY, [&](std::size_t by) {
+        BlockTexels texels;
+        for (int bx = 0; bx < blocksX; ++bx) {
+            GatherBlock(rgbPtr, imgFmt.width, imgFmt.height, bx, by, opts.blockX,
+                        opts.blockY, texels);
+            astc.blocks[by * blocksX + bx] = encoder.encode(texels);
+        }
+    });
+
+    return astc;
+}
+
+void ibl::SaveAstcImage(const fs::path& filePath, const AstcImage& image) {
+    AstcHeader header;
+    std::memcpy(header.magic, AstcMagic, sizeof(AstcMagic));
+    header.blockX = image.blockX;
+    header.blockY = image.blockY;
+    header.blockZ = 1;
+    Write24(header.dimX, image.width);
+    Write24(header.dimY, image.height);
+    Write24(header.dimZ, 1);
+
+    std::ofstream file(filePath, std::ios_base::out | std::ios_base::binary);
+    if (file.fail())
+        FATAL("Failed to open file {}", filePath.string());
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(AstcHeader));
+    file.write(reinterpret_cast<const char*>(image.blocks.data()),
+               image.blocks.size() * sizeof(AstcBlock));
+}
+
+void ibl::ExportAstcCubemap(const std::string& filePath, const CubeImage& cube,
+                            const AstcOptions& opts) {
+    using Clock = std::chrono::steady_clock;
+
+    const auto& [parent, fname, ext] = SplitFilePath(filePath);
+    const auto numLevels = cube.numLevels();
+
+    auto NameOutput = [&](int face, int lvl) -> auto {
+        if (numLevels > 1)
+            return std::format("{}_{}_{}.astc", fname, FaceNames.at(face), lvl);
+        return std::format("{}_{}.astc", fname, FaceNames.at(face));
+    };
+
+    Print("Encoding ASTC HDR {}x{} blocks ({} levels)...", opts.blockX, opts.blockY,
+          numLevels);
+
+    std::size_t numBlocks = 0;
+    Clock::duration encodeTime{};
+
+    for (int face = 0; face < 6; ++face) {
+        for (int lvl = 0; lvl < numLevels; ++lvl) {
+            auto start = Clock::now();
+            auto astc = EncodeAstcHdr(ImageView{cube[face], lvl}, opts);
+            encodeTime += Clock::now() - start;
+            numBlocks += astc.blocks.size();
+
+            SaveAstcImage(parent / NameOutput(face, lvl), astc);
+        }
+    }
+
+    auto secs = std::chrono::duration<double>(encodeTime).count();
+    Print("Encoded {} blocks in {:.3f} s ({:.0f} blocks/s)", numBlocks, secs,
+          numBlocks / std::max(secs, 1e-9));
+}
@@ -0,0 +1,48 @@
+#ifndef IBL_ASTC_H
+#define IBL_ASTC_H
+
+#include <iblenv.h>
+
+namespace fs = std::filesystem;
+
+namespace ibl {
+
+class ImageView;
+class CubeImage;
+
+enum class AstcQuality { Fast, Medium, Thorough };
+
+struct AstcOptions {
+    int blockX = 6, blockY = 6;
+    AstcQuality quality = AstcQuality::Medium;
+};
+
+using AstcBlock = std::array<std::uint8_t, 16>;
+
+// ASTC HDR compressed image level
+struct AstcImage {
+    int width = 0, height = 0;
+    int blockX = 0, blockY = 0;
+    std::vector<AstcBlock> blocks;
+};
+
+const std::map<std::string, AstcQuality> AstcQualityNames{
+    {"fast",     AstcQuality::Fast    },
+    {"medium",   AstcQuality::Medium  },
+    {"thorough", AstcQuality::Thorough}
+};
+
+bool IsValidAstcFootprint(int blockX, int blockY);
+int NumAstcBlocks(int width, int height, int blockX, int blockY);
+
+AstcImage EncodeAstcHdr(const ImageView& image, const AstcOptions& opts);
+
+void SaveAstcImage(const fs::path& filePath, const AstcImage& image);
+
+// Encodes every face and mip level of the cube, outputs one .astc file per face and level
+void ExportAstcCubemap(const std::string& filePath, const CubeImage& cube,
+                       const AstcOptions& opts);
+
+} // namespace ibl
+
+#endif
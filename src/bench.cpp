@@ -0,0 +1,1067 @@
+#include <iblapp.h>
+
+#include <glad/glad.h>
+
+#include <parser.h>
+#include <util.h>
+#include <image.h>
+#include <cubemap.h>
+#include <texture.h>
+#include <astc.h>
+#include <parallel.h>
+#include <sampling.h>
+#include <sun.h>
+#include <quadrature.h>
+#include <kernelcache.h>
+#include <projection.h>
+#include <mappedfile.h>
+
+#include <argparse/argparse.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <numbers>
+#include <tuple>
+
+using namespace ibl;
+using namespace ibl::util;
+using namespace std::literals;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchOptions {
+    int size;
+    unsigned int numSamples;
+    int repeat;
+    std::string filter;
+    bool cpuOnly;
+    bool pareto;
+    float maxError;
+    fs::path workDir;
+    fs::path outFile;
+};
+
+// Times func repeat times after an untimed warm up run. setup runs before every run,
+// outside the timing. sync waits for the GL commands of the current context.
+std::vector<double> TimeRuns(int repeat, const std::function<void()>& func,
+                             const std::function<void()>& setup = {}, bool sync = false) {
+    std::vector<double> seconds;
+    for (int i = 0; i <= repeat; ++i) {
+        if (setup)
+            setup();
+
+        if (sync)
+            glFinish();
+
+        auto start = Clock::now();
+        func();
+        if (sync)
+            glFinish();
+
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        if (i > 0)
+            seconds.push_back(elapsed.count());
+    }
+    return seconds;
+}
+
+double Median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+// Timings of one stage. Bytes and texels are the amount processed by a single run.
+struct StageResult {
+    std::string stage;
+    std::string path; // "cpu" or "gl"
+    std::size_t bytes;
+    std::size_t texels;
+    std::vector<double> seconds;
+
+    double median() const { return Median(seconds); }
+
+    double min() const { return *std::min_element(seconds.begin(), seconds.end()); }
+};
+
+class Bench {
+public:
+    explicit Bench(const BenchOptions& opts) : opts(opts) {}
+
+    // Times opts.repeat runs of func, unless the stage is filtered out
+    void run(const std::string& stage, const std::string& path, std::size_t bytes,
+             std::size_t texels, const std::function<void()>& func,
+             const std::function<void()>& setup = {}) {
+        if (!opts.filter.empty() && stage.find(opts.filter) == std::string::npos)
+            return;
+
+        // Jobs own their context, only stages run in the bench context are synchronized
+        const bool sync = path == "gl" && window;
+
+        StageResult result{stage, path, bytes, texels,
+                           TimeRuns(opts.repeat, func, setup, sync)};
+
+        Print("{:<28} {:>10.3f} ms {:>10.1f} MB/s {:>10.2f} MTexels/s", stage,
+              result.median() * 1e3, bytes / result.median() * 1e-6,
+              texels / result.median() * 1e-6);
+
+        results.push_back(std::move(result));
+    }
+
+    void save(const fs::path& filePath, const std::string& renderer) const {
+        std::ofstream file(filePath);
+        if (!file)
+            FATAL("Couldn't open file {}", filePath.string());
+
+        file << "{\n"
+             << std::format("    \"size\": {},\n", opts.size)
+             << std::format("    \"samples\": {},\n", opts.numSamples)
+             << std::format("    \"repeat\": {},\n", opts.repeat)
+             << std::format("    \"threads\": {},\n", MaxThreads())
+             << std::format("    \"renderer\": \"{}\",\n", renderer)
+             << "    \"stages\": [\n";
+
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            const auto& r = results[i];
+            const double median = r.median();
+
+            file << "        {"
+                 << std::format("\"stage\": \"{}\", \"path\": \"{}\", ", r.stage, r.path)
+                 << std::format("\"medianSeconds\": {}, \"minSeconds\": {}, ", median,
+                                r.min())
+                 << std::format("\"bytes\": {}, \"texels\": {}, ", r.bytes, r.texels)
+                 << std::format("\"bytesPerSecond\": {}, \"texelsPerSecond\": {}",
+                                r.bytes / median, r.texels / median)
+                 << (i + 1 < results.size() ? "},\n" : "}\n");
+        }
+
+        file << "    ]\n}\n";
+    }
+
+    bool window = false; // A GL context is current
+
+private:
+    BenchOptions opts;
+    std::vector<StageResult> results;
+};
+
+using Radiance = std::array<float, 3> (*)(const std::array<float, 3>&);
+
+// Smooth gradient from a bluish horizon to a brighter zenith
+std::array<float, 3> SkyRadiance(const std::array<float, 3>& dir) {
+    const float sky = 0.5f + 0.5f * dir[1];
+    return {0.2f + 0.4f * sky, 0.3f + 0.5f * sky, 0.4f + 0.8f * sky};
+}
+
+// Smooth sky with a small, very bright sun, the hardest case for the samplers
+std::array<float, 3> SyntheticRadiance(const std::array<float, 3>& dir) {
+    constexpr std::array<float, 3> sunDir{0.32f, 0.83f, 0.46f};
+    constexpr float sunCos = 0.99966f; // ~1.5 degrees
+
+    const float cosSun = dir[0] * sunDir[0] + dir[1] * sunDir[1] + dir[2] * sunDir[2];
+    if (cosSun > sunCos)
+        return {5.0e4f, 4.6e4f, 4.0e4f};
+
+    return SkyRadiance(dir);
+}
+
+// Dark room lit by a few large area lights with sharp edges
+std::array<float, 3> StudioRadiance(const std::array<float, 3>& dir) {
+    static const std::array<std::array<float, 3>, 4> lights{{
+        {0.58f, 0.58f, 0.58f},
+        {-0.71f, 0.50f, 0.50f},
+        {0.0f, 0.71f, -0.71f},
+        {-0.30f, -0.30f, -0.91f},
+    }};
+    constexpr float lightCos = 0.985f; // ~10 degrees
+
+    for (const auto& l : lights) {
+        if (dir[0] * l[0] + dir[1] * l[1] + dir[2] * l[2] > lightCos)
+            return {20.0f, 19.0f, 17.0f};
+    }
+
+    return {0.05f, 0.05f, 0.05f};
+}
+
+CubeImage SyntheticCube(int size, Radiance radiance = SyntheticRadiance) {
+    CubeImage cube{{PixelFormat::F32, size, size, 3}, 1};
+
+    ParallelFor(6, [&](std::size_t face) {
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                auto dir = CubeFaceDir(face, (x + 0.5f) / size, (y + 0.5f) / size);
+                auto rgb = radiance(dir);
+                cube[face].setPixel({rgb[0], rgb[1], rgb[2], 1.0f}, x, y);
+            }
+        }
+    });
+
+    return cube;
+}
+
+Image SyntheticEquirect(int height) {
+    constexpr float pi = std::numbers::pi_v<float>;
+
+    Image image{{PixelFormat::F32, 2 * height, height, 3}, 1};
+    for (int y = 0; y < height; ++y) {
+        const float theta = pi * (y + 0.5f) / height;
+        for (int x = 0; x < 2 * height; ++x) {
+            const float phi = 2.0f * pi * (x + 0.5f) / (2 * height);
+            std::array dir{std::sin(theta) * std::cos(phi), std::cos(theta),
+                           std::sin(theta) * std::sin(phi)};
+            auto rgb = SyntheticRadiance(dir);
+            image.setPixel({rgb[0], rgb[1], rgb[2], 1.0f}, x, y);
+        }
+    }
+
+    return image;
+}
+
+// Runs a job through the regular command line path
+void RunJob(const std::vector<std::string>& args) {
+    std::vector<std::string> argStrings{"iblenv"};
+    argStrings.insert(argStrings.end(), args.begin(), args.end());
+
+    std::vector<char*> argv;
+    for (auto& arg : argStrings)
+        argv.push_back(arg.data());
+
+    ExecuteJob(ParseArgs(static_cast<int>(argv.size()), argv.data()));
+}
+
+std::size_t CubeTexels(int size, int levels = 1) {
+    return 6 * TotalPixels({PixelFormat::F32, size, size, 3}, levels);
+}
+
+void BenchImages(Bench& bench, const BenchOptions& opts) {
+    const auto face = SyntheticCube(opts.size)[0];
+    const auto fmt = face.format();
+    const std::size_t texels = TotalPixels(fmt);
+
+    static const std::array Conversions{
+        std::pair{"f32-f16"s, PixelFormat::F16},
+        std::pair{"f32-u8"s,  PixelFormat::U8 },
+    };
+
+    for (const auto& [name, pFmt] : Conversions) {
+        ImageFormat newFmt{pFmt, fmt.width, fmt.height, fmt.nChannels};
+        bench.run("image.convert." + name, "cpu", face.size(), texels,
+                  [&] { face.convertTo(newFmt); });
+    }
+
+    const auto half = face.convertTo({PixelFormat::F16, fmt.width, fmt.height, 3});
+    bench.run("image.convert.f16-f32", "cpu", half.size(), texels,
+              [&] { half.convertTo(fmt); });
+
+    auto rawFmt = fmt;
+    for (const auto& ext : {".exr"s, ".hdr"s, ".png"s, ".bin"s, ".img"s}) {
+        const auto path = opts.workDir / ("face" + ext);
+        const auto name = ext.substr(1);
+
+        bench.run("image.encode." + name, "cpu", face.size(), texels,
+                  [&] { SaveImage(path, face); });
+        bench.run("image.decode." + name, "cpu", fs::file_size(path), texels,
+                  [&] { LoadImage(path, &rawFmt); });
+    }
+}
+
+void BenchCubemaps(Bench& bench, const BenchOptions& opts) {
+    auto cube = SyntheticCube(opts.size);
+    const std::size_t bytes = 6 * cube[0].size();
+    const std::size_t texels = CubeTexels(opts.size);
+
+    for (const auto& [type, layoutName] : LayoutNames) {
+        const auto ext = type == CubeLayoutType::Custom ? ".cube"s : ".hdr"s;
+        const auto path = (opts.workDir / ("layout" + ext)).string();
+
+        auto name = std::format("layout{}", static_cast<int>(type));
+        bench.run("cubemap.export." + name, "cpu", bytes, texels,
+                  [&] { ExportCubemap(path, type, cube); });
+
+        // Projections are export only
+        if (type == CubeLayoutType::Octahedral || type == CubeLayoutType::Equirect)
+            continue;
+
+        bench.run("cubemap.import." + name, "cpu", bytes, texels,
+                  [&] { ImportCubeMap(path, type, nullptr); });
+    }
+
+    ExportOptions compressed{.compress = true};
+    const auto path = (opts.workDir / "compressed.cube").string();
+    bench.run("cubemap.export.compressed", "cpu", bytes, texels, [&] {
+        ExportCubemap(path, CubeLayoutType::Custom, cube, compressed);
+    });
+    bench.run("cubemap.import.compressed", "cpu", bytes, texels,
+              [&] { ImportCubeMap(path, CubeLayoutType::Custom, nullptr); });
+
+    // Smallest block footprint is the slowest
+    const AstcOptions astc{4, 4, AstcQuality::Fast};
+    const auto astcPath = (opts.workDir / "astc").string();
+    bench.run("cubemap.export.astc4x4", "cpu", bytes, texels,
+              [&] { ExportAstcCubemap(astcPath, cube, astc); });
+}
+
+void BenchCpuPasses(Bench& bench, const BenchOptions& opts) {
+    const auto cube = SyntheticCube(opts.size);
+    const std::size_t bytes = 6 * cube[0].size();
+    const int irradianceSize = 32;
+    const int levels = MaxMipLevel(opts.size);
+
+    const auto equirect = SyntheticEquirect(opts.size);
+    bench.run("cpu.equirect-to-cube", "cpu", equirect.size(), CubeTexels(opts.size),
+              [&] { EquirectToCube(equirect, opts.size); });
+    bench.run("cpu.cube-to-octahedral", "cpu", bytes, 4 * opts.size * opts.size,
+              [&] { CubeToProjection(cube, Projection::Octahedral, 1); });
+
+    bench.run("cpu.env-distribution", "cpu", bytes, CubeTexels(opts.size),
+              [&] { EnvDistribution{cube}; });
+
+    CubeImage residual;
+    bench.run("cpu.sun-extraction", "cpu", bytes, CubeTexels(opts.size),
+              [&] { ExtractSun(residual, 100.0f); }, [&] { residual = cube; });
+
+    bench.run("cpu.irradiance-quadrature", "cpu", CubeTexels(irradianceSize) * 12,
+              CubeTexels(irradianceSize),
+              [&] { IrradianceQuadrature(cube, 64, irradianceSize, false); });
+
+    const KernelSettings settings{opts.size, levels, opts.size, opts.numSamples,
+                                  Sequence::Hammersley, true};
+    const std::size_t outTexels = CubeTexels(opts.size, levels);
+
+    std::unique_ptr<SpecularKernels> kernels;
+    bench.run("cpu.specular-kernels.build", "cpu", outTexels * 12, outTexels,
+              [&] { kernels = std::make_unique<SpecularKernels>(settings); });
+    bench.run("cpu.specular-kernels.apply", "cpu", outTexels * 12, outTexels,
+              [&] { kernels->apply(cube); });
+}
+
+void BenchGlPasses(Bench& bench, const BenchOptions& opts) {
+    const auto cube = SyntheticCube(opts.size);
+    const std::size_t bytes = 6 * cube[0].size();
+    const std::size_t texels = CubeTexels(opts.size);
+    const int levels = MaxMipLevel(opts.size);
+
+    // Upload and readback of level 0, with the context alive
+    InitOpenGL();
+    bench.window = true;
+    {
+        std::unique_ptr<Texture> tex;
+        bench.run("gl.upload", "gl", bytes, texels,
+                  [&] { tex = std::make_unique<Texture>(cube); });
+        bench.run("gl.readback", "gl", bytes, texels, [&] { tex->cubemap(0); });
+    }
+    Cleanup();
+    bench.window = false;
+
+    // Complete jobs, including context creation, shader compilation and '.cube' I/O
+    bench.run("gl.context", "gl", 0, 0, [] {
+        InitOpenGL();
+        Cleanup();
+    });
+
+    const auto dir = opts.workDir;
+    const auto in = (dir / "env.cube").string();
+    const auto out = (dir / "out.cube").string();
+    const auto size = std::to_string(opts.size);
+    const auto spp = std::to_string(opts.numSamples);
+
+    auto env = SyntheticCube(opts.size);
+    ExportCubemap(in, CubeLayoutType::Custom, env);
+
+    const auto irrTexels = CubeTexels(32);
+    bench.run("job.irradiance", "gl", irrTexels * 12, irrTexels, [&] {
+        RunJob({"irradiance", in, out, "--it", "6", "--ot", "6", "-s", "32", "--spp",
+                spp});
+    });
+
+    const std::size_t specTexels = CubeTexels(opts.size, levels);
+    bench.run("job.specular", "gl", specTexels * 12, specTexels, [&] {
+        RunJob({"specular", in, out, "--it", "6", "--ot", "6", "-s", size, "--spp", spp});
+    });
+
+    // The same environment as 8 probes, convolved as one cube map array
+    constexpr int NumProbes = 8;
+    const auto probes = (dir / "probes.txt").string();
+    {
+        std::ofstream list(probes);
+        for (int i = 0; i < NumProbes; ++i)
+            list << in << "\n";
+    }
+
+    bench.run("job.specular-array", "gl", NumProbes * specTexels * 12,
+              NumProbes * specTexels, [&] {
+                  RunJob({"specular", probes, out, "--it", "6", "--ot", "6", "-s", size,
+                          "--spp", spp, "--array"});
+              });
+
+    const std::size_t brdfTexels = opts.size * opts.size;
+    bench.run("job.brdf", "gl", brdfTexels * 8, brdfTexels, [&] {
+        RunJob({"brdf", (dir / "brdf.bin").string(), "-s", size, "--spp", spp});
+    });
+}
+
+void BenchCpuJobs(Bench& bench, const BenchOptions& opts) {
+    const auto dir = opts.workDir;
+    const auto in = (dir / "env.cube").string();
+    const auto out = (dir / "out.cube").string();
+    const auto equirect = (dir / "env.hdr").string();
+    const auto cache = (dir / "specular.kernels").string();
+    const auto size = std::to_string(opts.size);
+    const auto spp = std::to_string(opts.numSamples);
+    const int levels = MaxMipLevel(opts.size);
+
+    auto env = SyntheticCube(opts.size);
+    ExportCubemap(in, CubeLayoutType::Custom, env);
+    SaveImage(equirect, SyntheticEquirect(opts.size));
+
+    const std::size_t texels = CubeTexels(opts.size);
+    bench.run("job.equirect", "cpu", 6 * env[0].size(), texels,
+              [&] { RunJob({"convert", equirect, out, "-s", size, "--ot", "6"}); });
+
+    bench.run("job.irradiance-exact", "cpu", CubeTexels(32) * 12, CubeTexels(32), [&] {
+        RunJob({"irradiance", in, out, "--it", "6", "--ot", "6", "-s", "32", "--exact",
+                "64"});
+    });
+
+    // The warm up run builds the cache, timed runs only map and apply it
+    const std::size_t specTexels = CubeTexels(opts.size, levels);
+    bench.run("job.specular-kernels", "cpu", specTexels * 12, specTexels, [&] {
+        RunJob({"specular", in, out, "--it", "6", "--ot", "6", "-s", size, "--spp", spp,
+                "--kernel-cache", cache});
+    });
+}
+
+// Squared differences of an output against its reference, over every level, texel and
+// channel of the reference
+struct ErrorSum {
+    double squared = 0.0;
+    double refSquared = 0.0;
+    std::size_t count = 0;
+
+    void add(const ImageView& out, const Image& ref) {
+        const int channels = ref.format().nChannels;
+        for (int lvl = 0; lvl < ref.numLevels(); ++lvl) {
+            const auto fmt = ref.format(lvl);
+            if (lvl >= out.numLevels() || out.format(lvl).width != fmt.width ||
+                out.format(lvl).height != fmt.height || out.format().nChannels < channels)
+                FATAL("Output doesn't match the reference at level {}", lvl);
+
+            for (int y = 0; y < fmt.height; ++y) {
+                for (int x = 0; x < fmt.width; ++x) {
+                    for (int c = 0; c < channels; ++c) {
+                        double r = ref.channel(x, y, c, lvl);
+                        double d = out.channel(x, y, c, lvl) - r;
+                        squared += d * d;
+                        refSquared += r * r;
+                    }
+                }
+            }
+            count += TotalPixels(fmt) * channels;
+        }
+    }
+
+    double rmse() const { return std::sqrt(squared / count); }
+
+    // Error relative to the magnitude of the reference, comparable across inputs
+    double relative() const { return std::sqrt(squared / refSquared); }
+};
+
+// Exact specular convolution with V = N, every output texel sums the GGX lobe over
+// every environment texel. Level 0 has roughness 0, a delta lobe of weight G = 1 / 4.
+std::unique_ptr<CubeImage> SpecularReference(const CubeImage& env, int levels) {
+    constexpr double pi = std::numbers::pi;
+
+    struct Texel {
+        std::array<float, 3> dir;
+        float omega;
+        std::array<float, 3> rgb;
+    };
+
+    const int size = env.imgFormat().width;
+    std::vector<Texel> texels;
+    texels.reserve(6 * static_cast<std::size_t>(size) * size);
+    for (int face = 0; face < 6; ++face) {
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                auto px = env[face].pixel(x, y);
+                texels.push_back({CubeFaceDir(face, (x + 0.5f) / size, (y + 0.5f) / size),
+                                  CubeTexelSolidAngle(x, y, size),
+                                  {px[0], px[1], px[2]}});
+            }
+        }
+    }
+
+    auto ref = std::make_unique<CubeImage>(ImageFormat{PixelFormat::F32, size, size, 3},
+                                           levels);
+    for (int face = 0; face < 6; ++face) {
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                auto px = env[face].pixel(x, y);
+                (*ref)[face].setPixel({px[0] / 4, px[1] / 4, px[2] / 4, 1.0f}, x, y);
+            }
+        }
+    }
+
+    for (int lvl = 1; lvl < levels; ++lvl) {
+        const double rough = lvl / (levels - 1.0);
+        const double a2 = rough * rough * rough * rough;
+        const int outSize = ResizeLvl(size, lvl);
+        const auto faceTexels = static_cast<std::size_t>(outSize) * outSize;
+
+        ParallelFor(6 * faceTexels, [&](std::size_t i) {
+            const int face = static_cast<int>(i / faceTexels);
+            const int x = static_cast<int>(i % faceTexels % outSize);
+            const int y = static_cast<int>(i % faceTexels / outSize);
+            const auto N = CubeFaceDir(face, (x + 0.5f) / outSize, (y + 0.5f) / outSize);
+
+            // Directions have pdf D / 4 and weight G * NdotL, normalized by the pdf
+            // weighted NdotL like the sample tables
+            std::array<double, 3> sum{};
+            double norm = 0.0;
+            for (const auto& t : texels) {
+                double NdotL = N[0] * t.dir[0] + N[1] * t.dir[1] + N[2] * t.dir[2];
+                if (NdotL <= 0.0)
+                    continue;
+
+                double NdotH2 = 0.5 * (1.0 + NdotL);
+                double denom = NdotH2 * (a2 - 1.0) + 1.0;
+                double pdf = a2 / (pi * denom * denom) / 4.0 * t.omega;
+                double G = 0.5 / (std::sqrt(NdotL * NdotL * (1.0 - a2) + a2) + NdotL);
+
+                for (int c = 0; c < 3; ++c)
+                    sum[c] += pdf * G * NdotL * t.rgb[c];
+                norm += pdf * NdotL;
+            }
+
+            (*ref)[face].setPixel({static_cast<float>(sum[0] / norm),
+                                   static_cast<float>(sum[1] / norm),
+                                   static_cast<float>(sum[2] / norm), 1.0f},
+                                  x, y, lvl);
+        });
+    }
+
+    return ref;
+}
+
+// Irradiance by brute force, independent of IrradianceQuadrature. Every texel of env is
+// split into sub-texels, each with its own direction and exact solid angle, on a grid of
+// at least 256 per face side, four times the largest '--exact' size swept. Sums in
+// double precision.
+std::unique_ptr<CubeImage> IrradianceReference(const CubeImage& env, int outSize) {
+    const int size = env.imgFormat().width;
+    const int sub = std::max(2, (256 + size - 1) / size);
+    const int grid = size * sub;
+
+    struct SubTexel {
+        std::array<double, 3> dir;
+        std::array<double, 3> flux; // Radiance of the texel times the solid angle
+    };
+
+    std::vector<SubTexel> texels;
+    texels.reserve(6 * static_cast<std::size_t>(grid) * grid);
+    for (int face = 0; face < 6; ++face) {
+        for (int y = 0; y < grid; ++y) {
+            for (int x = 0; x < grid; ++x) {
+                const auto px = env[face].pixel(x / sub, y / sub);
+                const auto dir =
+                    CubeFaceDir(face, (x + 0.5f) / grid, (y + 0.5f) / grid);
+                const double omega = CubeTexelSolidAngle(x, y, grid);
+                texels.push_back({{dir[0], dir[1], dir[2]},
+                                  {px[0] * omega, px[1] * omega, px[2] * omega}});
+            }
+        }
+    }
+
+    auto ref = std::make_unique<CubeImage>(
+        ImageFormat{PixelFormat::F32, outSize, outSize, 3}, 1);
+    const auto faceTexels = static_cast<std::size_t>(outSize) * outSize;
+
+    ParallelFor(6 * faceTexels, [&](std::size_t i) {
+        const int face = static_cast<int>(i / faceTexels);
+        const int x = static_cast<int>(i % faceTexels % outSize);
+        const int y = static_cast<int>(i % faceTexels / outSize);
+        const auto N = CubeFaceDir(face, (x + 0.5f) / outSize, (y + 0.5f) / outSize);
+
+        std::array<double, 3> sum{};
+        for (const auto& t : texels) {
+            double cosine = N[0] * t.dir[0] + N[1] * t.dir[1] + N[2] * t.dir[2];
+            if (cosine <= 0.0)
+                continue;
+
+            for (int c = 0; c < 3; ++c)
+                sum[c] += cosine * t.flux[c];
+        }
+
+        (*ref)[face].setPixel({static_cast<float>(sum[0]), static_cast<float>(sum[1]),
+                               static_cast<float>(sum[2]), 1.0f},
+                              x, y);
+    });
+
+    return ref;
+}
+
+// The integral brdf.frag estimates, by the midpoint rule on a dense grid over the
+// GGX half vector distribution
+std::unique_ptr<Image> BrdfReference(int size, bool multiscatter) {
+    constexpr double pi = std::numbers::pi;
+    constexpr int Grid = 256;
+
+    auto ref = std::make_unique<Image>(ImageFormat{PixelFormat::F32, size, size, 2}, 1);
+
+    ParallelFor(static_cast<std::size_t>(size) * size, [&](std::size_t i) {
+        const int x = static_cast<int>(i % size), y = static_cast<int>(i / size);
+        const double NdotV = (x + 0.5) / size;
+        const double rough = (y + 0.5) / size;
+        const double a2 = rough * rough * rough * rough;
+        const std::array V{std::sqrt(1.0 - NdotV * NdotV), 0.0, NdotV};
+
+        double I1 = 0.0, I2 = 0.0;
+        for (int v = 0; v < Grid; ++v) {
+            const double xi = (v + 0.5) / Grid;
+            const double cosTheta = std::sqrt((1.0 - xi) / (xi * (a2 - 1.0) + 1.0));
+            const double sinTheta = std::sqrt(1.0 - cosTheta * cosTheta);
+
+            for (int u = 0; u < Grid; ++u) {
+                const double phi = 2.0 * pi * (u + 0.5) / Grid;
+                const std::array H{std::cos(phi) * sinTheta, std::sin(phi) * sinTheta,
+                                   cosTheta};
+
+                const double VdotH = V[0] * H[0] + V[2] * H[2];
+                const double NdotL = 2.0 * VdotH * H[2] - V[2];
+                if (NdotL <= 0.0)
+                    continue;
+
+                const double G =
+                    0.5 / (NdotV * std::sqrt(NdotL * NdotL * (1.0 - a2) + a2) +
+                           NdotL * std::sqrt(NdotV * NdotV * (1.0 - a2) + a2));
+                const double GVis = G * 4.0 * VdotH / cosTheta * NdotL;
+                const double Fc = std::pow(1.0 - VdotH, 5.0);
+
+                I1 += (multiscatter ? Fc : 1.0 - Fc) * GVis;
+                I2 += (multiscatter ? 1.0 : Fc) * GVis;
+            }
+        }
+
+        constexpr double n = static_cast<double>(Grid) * Grid;
+        ref->setPixel(
+            {static_cast<float>(I1 / n), static_cast<float>(I2 / n), 0.0f, 0.0f}, x, y);
+    });
+
+    return ref;
+}
+
+// Option set of a pass, appended to its job arguments
+struct Setting {
+    std::string name;
+    std::vector<std::string> args;
+    bool gl = true;
+};
+
+// Sample counts swept for every variant of the sampled passes
+constexpr std::array SweepSamples{16u, 64u, 256u, 1024u, 4096u};
+
+std::vector<Setting> SampledSettings(bool specular, const fs::path& workDir) {
+    std::vector<Setting> settings;
+    for (auto spp : SweepSamples) {
+        const auto n = std::to_string(spp);
+        auto Add = [&](const std::string& variant, std::vector<std::string> args,
+                       bool gl = true) {
+            args.insert(args.begin(), {"--spp", n});
+            settings.push_back({"--spp " + n + variant, std::move(args), gl});
+        };
+
+        Add("", {});
+        Add(" --no-prefiltered", {"--no-prefiltered"});
+        Add(" --sequence owen", {"--sequence", "owen"});
+        Add(" --env-samples " + std::to_string(spp / 2),
+            {"--env-samples", std::to_string(spp / 2)});
+        Add(" --sun", {"--sun"});
+
+        if (!specular)
+            continue;
+
+        Add(" --filter cascaded", {"--filter", "cascaded"});
+
+        // Kernels hold a weight per sample and output texel, the cache is built by the
+        // untimed warm up run
+        if (spp <= 256) {
+            auto cache = workDir / std::format("pareto{}.kernels", spp);
+            Add(" --kernel-cache", {"--kernel-cache", cache.string()}, false);
+        }
+    }
+
+    if (!specular) {
+        for (int size : {8, 16, 32, 64})
+            settings.push_back({std::format("--exact {}", size),
+                                {"--exact", std::to_string(size)}, false});
+    }
+
+    return settings;
+}
+
+// Error against wall time of every setting, and which of them no other setting beats
+// on both
+class QualitySweep {
+public:
+    QualitySweep(const BenchOptions& opts, bool gl) : opts(opts), gl(gl) {}
+
+    using JobFunc = std::function<void(std::size_t, const std::vector<std::string>&)>;
+
+    // Times run(input, args) for every setting and input, then rates the output with
+    // error(input). A setting keeps its total time and its worst error over the inputs.
+    void sweep(const std::string& pass, const std::vector<Setting>& settings,
+               std::size_t inputs, const JobFunc& run,
+               const std::function<ErrorSum(std::size_t)>& error) {
+        for (const auto& setting : settings) {
+            const auto name = pass + " " + setting.name;
+            if (!opts.filter.empty() && name.find(opts.filter) == std::string::npos)
+                continue;
+            if (setting.gl && !gl)
+                continue;
+
+            Point point{pass, setting.name};
+            for (std::size_t i = 0; i < inputs; ++i) {
+                point.seconds += Median(TimeRuns(opts.repeat, [&] {
+                    run(i, setting.args);
+                }));
+
+                auto err = error(i);
+                point.rmse = std::max(point.rmse, err.rmse());
+                point.relative = std::max(point.relative, err.relative());
+            }
+
+            Print("{:<48} {:>10.3f} ms  relative error {:.3e}  rmse {:.3e}", name,
+                  point.seconds * 1e3, point.relative, point.rmse);
+            points.push_back(std::move(point));
+        }
+    }
+
+    // Settings of each pass sorted by time, optimal when more accurate than all faster
+    void findPareto() {
+        std::vector<Point*> sorted;
+        for (auto& p : points)
+            sorted.push_back(&p);
+
+        std::stable_sort(sorted.begin(), sorted.end(), [](auto* a, auto* b) {
+            return std::tie(a->pass, a->seconds, a->relative) <
+                   std::tie(b->pass, b->seconds, b->relative);
+        });
+
+        std::map<std::string, double> best;
+        for (auto* p : sorted) {
+            auto [it, first] = best.try_emplace(p->pass, p->relative);
+            p->optimal = first || p->relative < it->second;
+            it->second = std::min(it->second, p->relative);
+        }
+    }
+
+    void printTable(double maxError) const {
+        Print("Pareto optimal settings, from the fastest to the most accurate:");
+        Print("| pass | setting | time (ms) | relative error | rmse |");
+        Print("|---|---|---:|---:|---:|");
+
+        std::map<std::string, const Point*> cheapest;
+        for (const auto* p : sortedOptimal()) {
+            Print("| {} | {} | {:.3f} | {:.3e} | {:.3e} |", p->pass, p->setting,
+                  p->seconds * 1e3, p->relative, p->rmse);
+
+            if (p->relative <= maxError)
+                cheapest.try_emplace(p->pass, p);
+        }
+
+        Print("");
+        for (const auto& [pass, p] : cheapest)
+            Print("Cheapest {} setting within a relative error of {:g}: {}", pass,
+                  maxError, p->setting);
+    }
+
+    void save(const fs::path& filePath, const std::string& renderer,
+              const std::vector<std::string>& envs) const {
+        std::ofstream file(filePath);
+        if (!file)
+            FATAL("Couldn't open file {}", filePath.string());
+
+        std::string envList;
+        for (const auto& env : envs)
+            envList += std::format("{}\"{}\"", envList.empty() ? "" : ", ", env);
+
+        file << "{\n"
+             << std::format("    \"size\": {},\n", opts.size)
+             << std::format("    \"repeat\": {},\n", opts.repeat)
+             << std::format("    \"threads\": {},\n", MaxThreads())
+             << std::format("    \"renderer\": \"{}\",\n", renderer)
+             << std::format("    \"environments\": [{}],\n", envList)
+             << "    \"settings\": [\n";
+
+        for (std::size_t i = 0; i < points.size(); ++i) {
+            const auto& p = points[i];
+            file << "        {"
+                 << std::format("\"pass\": \"{}\", \"setting\": \"{}\", ", p.pass,
+                                p.setting)
+                 << std::format("\"medianSeconds\": {}, \"rmse\": {}, ", p.seconds,
+                                p.rmse)
+                 << std::format("\"relativeError\": {}, \"paretoOptimal\": {}",
+                                p.relative, p.optimal)
+                 << (i + 1 < points.size() ? "},\n" : "}\n");
+        }
+
+        file << "    ]\n}\n";
+    }
+
+private:
+    struct Point {
+        std::string pass;
+        std::string setting;
+        double seconds = 0.0;  // Sum of the median times over the inputs
+        double rmse = 0.0;     // Worst over the inputs
+        double relative = 0.0; // Worst over the inputs
+        bool optimal = false;
+    };
+
+    std::vector<const Point*> sortedOptimal() const {
+        std::vector<const Point*> optimal;
+        for (const auto& p : points)
+            if (p.optimal)
+                optimal.push_back(&p);
+
+        std::stable_sort(optimal.begin(), optimal.end(), [](auto* a, auto* b) {
+            return std::tie(a->pass, a->seconds) < std::tie(b->pass, b->seconds);
+        });
+        return optimal;
+    }
+
+    BenchOptions opts;
+    bool gl;
+    std::vector<Point> points;
+};
+
+void BenchQuality(const BenchOptions& opts, const std::string& renderer) {
+    const bool gl = renderer != "none";
+    const auto dir = opts.workDir;
+    const auto out = (dir / "pareto.cube").string();
+    const auto size = std::to_string(opts.size);
+    const int irradianceSize = 32;
+
+    // The level count is not swept, it sets the roughness of every level. Outputs with
+    // other counts hold other roughnesses, not approximations of the same reference.
+    const int levels = MaxMipLevel(opts.size);
+
+    struct TestEnv {
+        std::string name;
+        std::string file;
+        std::unique_ptr<CubeImage> irradiance, specular;
+    };
+
+    static const std::array<std::pair<std::string, Radiance>, 3> Inputs{{
+        {"sky",    SkyRadiance      },
+        {"sun",    SyntheticRadiance},
+        {"studio", StudioRadiance   },
+    }};
+
+    std::vector<TestEnv> envs;
+    for (const auto& [name, radiance] : Inputs) {
+        Print("Computing references for the '{}' environment", name);
+        auto cube = SyntheticCube(opts.size, radiance);
+        auto file = (dir / ("pareto_" + name + ".cube")).string();
+        ExportCubemap(file, CubeLayoutType::Custom, cube);
+
+        envs.push_back({name, file, IrradianceReference(cube, irradianceSize),
+                        SpecularReference(cube, levels)});
+    }
+
+    auto Error = [&](const CubeImage& ref) {
+        auto result = ImportCubeMap(out, CubeLayoutType::Custom, nullptr);
+        ErrorSum sum;
+        for (int face = 0; face < 6; ++face)
+            sum.add((*result)[face], ref[face]);
+        return sum;
+    };
+
+    QualitySweep sweep{opts, gl};
+
+    sweep.sweep(
+        "irradiance", SampledSettings(false, dir), envs.size(),
+        [&](std::size_t i, const std::vector<std::string>& args) {
+            std::vector<std::string> job{"irradiance", envs[i].file, out, "--it", "6",
+                                         "--ot",       "6",          "-s", "32"};
+            job.insert(job.end(), args.begin(), args.end());
+            RunJob(job);
+        },
+        [&](std::size_t i) { return Error(*envs[i].irradiance); });
+
+    sweep.sweep(
+        "specular", SampledSettings(true, dir), envs.size(),
+        [&](std::size_t i, const std::vector<std::string>& args) {
+            std::vector<std::string> job{"specular", envs[i].file, out,  "--it", "6",
+                                         "--ot",     "6",          "-s", size,   "-l",
+                                         std::to_string(levels)};
+            job.insert(job.end(), args.begin(), args.end());
+            RunJob(job);
+        },
+        [&](std::size_t i) { return Error(*envs[i].specular); });
+
+    // The lookup table doesn't depend on the environment
+    const auto brdfFile = (dir / "pareto_brdf.bin").string();
+    ImageFormat brdfFmt{PixelFormat::F32, opts.size, opts.size, 2};
+
+    for (bool ms : {false, true}) {
+        std::vector<Setting> settings;
+        for (auto spp : SweepSamples)
+            settings.push_back(
+                {std::format("--spp {}", spp), {"--spp", std::to_string(spp)}});
+
+        std::unique_ptr<Image> ref;
+        sweep.sweep(
+            ms ? "brdf --ms" : "brdf", settings, 1,
+            [&](std::size_t, const std::vector<std::string>& args) {
+                std::vector<std::string> job{"brdf", brdfFile, "-s", size, "--use32f"};
+                if (ms)
+                    job.push_back("--ms");
+                job.insert(job.end(), args.begin(), args.end());
+                RunJob(job);
+            },
+            [&](std::size_t) {
+                if (!ref)
+                    ref = BrdfReference(opts.size, ms);
+
+                // The table is compared in place in its mapping, no copy is made
+                ErrorSum sum;
+                sum.add(MapImage(brdfFile, &brdfFmt)->view(), *ref);
+                return sum;
+            });
+    }
+
+    sweep.findPareto();
+    sweep.printTable(opts.maxError);
+
+    std::vector<std::string> names;
+    for (const auto& env : envs)
+        names.push_back(env.name);
+    sweep.save(opts.outFile, renderer, names);
+}
+
+BenchOptions ParseBenchArgs(int argc, char* argv[]) {
+    argparse::ArgumentParser program("iblenv_bench", "1.0");
+    program.add_description("Measures the throughput of every stage of iblenv on "
+                            "synthetic inputs.");
+
+    program.add_argument("-o", "--out")
+        .help("JSON file receiving the results.")
+        .nargs(1)
+        .default_value("bench.json"s);
+    program.add_argument("-s", "--size")
+        .help("Face size of the synthetic cubemaps.")
+        .nargs(1)
+        .default_value(128)
+        .scan<'i', int>();
+    program.add_argument("--spp")
+        .help("Samples per pixel of the sampled passes.")
+        .nargs(1)
+        .default_value(256u)
+        .scan<'u', unsigned int>();
+    program.add_argument("-r", "--repeat")
+        .help("Timed runs per stage, the median is reported.")
+        .nargs(1)
+        .default_value(5)
+        .scan<'i', int>();
+    program.add_argument("-f", "--filter")
+        .help("Only runs stages whose name contains this string.")
+        .nargs(1)
+        .default_value(""s);
+    program.add_argument("--cpu-only")
+        .help("Skips stages requiring an OpenGL context.")
+        .nargs(0)
+        .implicit_value(true)
+        .default_value(false);
+    program.add_argument("--pareto")
+        .help("Instead of throughput, measures the error of irradiance, specular and "
+              "brdf jobs over a sweep of sample counts and options against brute force "
+              "CPU references, and reports the settings no other one is both faster and "
+              "more accurate than.")
+        .nargs(0)
+        .implicit_value(true)
+        .default_value(false);
+    program.add_argument("--max-error")
+        .help("With --pareto, also reports the cheapest setting of each pass within this "
+              "relative error.")
+        .nargs(1)
+        .default_value(0.01f)
+        .scan<'g', float>();
+    program.add_argument("--work-dir")
+        .help("Directory for intermediate files. Defaults to a temporary directory.")
+        .nargs(1)
+        .default_value((fs::temp_directory_path() / "iblenv_bench").string());
+    program.add_argument("-j", "--threads")
+        .help("Number of worker threads. Defaults to the number of hardware threads.")
+        .nargs(1)
+        .default_value(0u)
+        .scan<'u', unsigned int>();
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        std::exit(1);
+    }
+
+    if (auto threads = program.get<unsigned int>("-j"); threads > 0)
+        SetMaxThreads(threads);
+
+    return {.size = program.get<int>("-s"),
+            .numSamples = program.get<unsigned int>("--spp"),
+            .repeat = std::max(program.get<int>("-r"), 1),
+            .filter = program.get("-f"),
+            .cpuOnly = program.get<bool>("--cpu-only"),
+            .pareto = program.get<bool>("--pareto"),
+            .maxError = program.get<float>("--max-error"),
+            .workDir = program.get("--work-dir"),
+            .outFile = program.get("-o")};
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        auto opts = ParseBenchArgs(argc, argv);
+        fs::create_directories(opts.workDir);
+
+        std::string renderer = "none";
+        if (!opts.cpuOnly) {
+            try {
+                InitOpenGL();
+                renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+                Cleanup();
+            } catch (const std::runtime_error& err) {
+                util::PrintError(std::format("Skipping OpenGL stages: {}", err.what()));
+                Cleanup();
+            }
+        }
+
+        if (opts.pareto) {
+            BenchQuality(opts, renderer);
+            Print("Saved results to {}", opts.outFile.string());
+            return 0;
+        }
+
+        Bench bench{opts};
+        BenchImages(bench, opts);
+        BenchCubemaps(bench, opts);
+        BenchCpuPasses(bench, opts);
+        BenchCpuJobs(bench, opts);
+
+        if (renderer != "none")
+            BenchGlPasses(bench, opts);
+
+        bench.save(opts.outFile, renderer);
+        Print("Saved results to {}", opts.outFile.string());
+    } catch (const std::runtime_error& err) {
+        util::PrintError(err.what());
+        Cleanup();
+        return 1;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef IBL_BUFFER_H
+#define IBL_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <iblenv.h>
+#include <memtracker.h>
+
+namespace ibl {
+
+// Shader storage buffer
+class Buffer {
+public:
+    Buffer() { glCreateBuffers(1, &handle); }
+    ~Buffer() {
+        if (handle != 0)
+            glDeleteBuffers(1, &handle);
+    }
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    template<typename T>
+    void upload(std::span<const T> data) {
+        memory.resize(data.size_bytes());
+        glNamedBufferData(handle, data.size_bytes(), data.data(), GL_DYNAMIC_DRAW);
+    }
+
+    void bindBase(unsigned int index) const {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, handle);
+    }
+
+    GLuint handle = 0;
+
+private:
+    TrackedBytes memory{MemCategory::Buffer};
+};
+
+} // namespace ibl
+
+#endif
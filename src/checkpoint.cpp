@@ -0,0 +1,343 @@
+#include <checkpoint.h>
+
+#include <mappedfile.h>
+#include <util.h>
+
+#include <zlib.h>
+
+#include <cstring>
+#include <fstream>
+#include <optional>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace ibl;
+using namespace ibl::util;
+
+namespace {
+
+constexpr std::uint32_t CheckpointVersion = 2;
+
+// Starts both the file of finished faces and the one of partial sums, followed by the
+// job string and the chunks
+struct CheckpointHeader {
+    std::uint8_t id[4] = {'I', 'B', 'L', 'C'};
+    std::uint32_t version = CheckpointVersion;
+    std::uint32_t jobSize; // Bytes of the job string following the header
+    std::int32_t level = -1;
+    std::uint32_t batches = 0;
+};
+
+enum class ImageKind : std::uint32_t { Face, Sum, Stats };
+
+// Precedes the pixels of each image
+struct CheckpointChunk {
+    ImageKind kind;
+    std::int32_t level; // Faces only, sums and stats belong to the header's level
+    std::int32_t face;
+    std::uint32_t fmt;
+    std::int32_t width;
+    std::int32_t height;
+    std::int32_t numChannels;
+    std::uint32_t crc;
+    std::uint64_t size;
+};
+
+std::uint32_t Checksum(const std::byte* data, std::size_t size) {
+    auto crc = crc32_z(0L, Z_NULL, 0);
+    return crc32_z(crc, reinterpret_cast<const Bytef*>(data), size);
+}
+
+fs::path SumsPath(const fs::path& filePath) {
+    auto path = filePath;
+    path += ".sums";
+    return path;
+}
+
+// Flushes a closed file to the disk
+void SyncFile(const fs::path& filePath) {
+#ifdef _WIN32
+    HANDLE handle = CreateFileW(filePath.c_str(), GENERIC_WRITE,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        FATAL("Failed to open file {}", filePath.string());
+
+    const bool synced = FlushFileBuffers(handle);
+    CloseHandle(handle);
+#else
+    int fd = open(filePath.c_str(), O_WRONLY);
+    if (fd < 0)
+        FATAL("Failed to open file {}", filePath.string());
+
+    const bool synced = fsync(fd) == 0;
+    close(fd);
+#endif
+
+    if (!synced)
+        FATAL("Failed to sync file {}", filePath.string());
+}
+
+// Makes a rename into the directory of filePath durable. NTFS journals it already
+void SyncDirectory([[maybe_unused]] const fs::path& filePath) {
+#ifndef _WIN32
+    auto dir = filePath.parent_path();
+    if (dir.empty())
+        dir = ".";
+
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        FATAL("Failed to open directory {}", dir.string());
+
+    const bool synced = fsync(fd) == 0;
+    close(fd);
+
+    if (!synced)
+        FATAL("Failed to sync directory {}", dir.string());
+#endif
+}
+
+// Writes a file through a temporary one, synced before it is renamed over filePath and
+// the rename synced after, so a job killed at any point leaves either file whole
+void WriteDurably(const fs::path& filePath,
+                  const std::function<void(std::ofstream&)>& write) {
+    auto tmpPath = filePath;
+    tmpPath += ".tmp";
+
+    {
+        std::ofstream file(tmpPath, std::ios_base::out | std::ios_base::binary);
+        if (file.fail())
+            FATAL("Failed to open file {}", tmpPath.string());
+
+        write(file);
+
+        file.flush();
+        if (file.fail())
+            FATAL("Failed to write checkpoint {}", tmpPath.string());
+    }
+
+    SyncFile(tmpPath);
+    fs::rename(tmpPath, filePath);
+    SyncDirectory(filePath);
+}
+
+void WriteHeader(std::ofstream& file, const std::string& job, int level = -1,
+                 std::uint32_t batches = 0) {
+    CheckpointHeader header;
+    header.jobSize = job.size();
+    header.level = level;
+    header.batches = batches;
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(CheckpointHeader));
+    file.write(job.data(), job.size());
+}
+
+void WriteChunk(std::ofstream& file, ImageKind kind, int level, int face,
+                const Image& image) {
+    const auto fmt = image.format();
+    CheckpointChunk chunk{kind,
+                          level,
+                          face,
+                          static_cast<std::uint32_t>(fmt.pFmt),
+                          fmt.width,
+                          fmt.height,
+                          fmt.nChannels,
+                          Checksum(image.data(), image.size()),
+                          image.size()};
+
+    file.write(reinterpret_cast<const char*>(&chunk), sizeof(CheckpointChunk));
+    file.write(reinterpret_cast<const char*>(image.data()), chunk.size);
+}
+
+// Header and job string of a mapped checkpoint file, returns the offset of its chunks
+std::size_t ReadHeader(const MappedFile& file, CheckpointHeader& header,
+                       std::string& job) {
+    const auto name = file.path().string();
+    if (file.size() < sizeof(CheckpointHeader))
+        FATAL("Truncated checkpoint {}", name);
+    std::memcpy(&header, file.data(), sizeof(CheckpointHeader));
+
+    if (std::memcmp(header.id, "IBLC", 4) != 0)
+        FATAL("{} is not a checkpoint", name);
+
+    if (header.version != CheckpointVersion)
+        FATAL("Unsupported checkpoint version {} in {}", header.version, name);
+
+    const auto offset = sizeof(CheckpointHeader) + std::size_t{header.jobSize};
+    if (offset > file.size())
+        FATAL("Truncated checkpoint {}", name);
+
+    job.assign(reinterpret_cast<const char*>(file.data()) + sizeof(CheckpointHeader),
+               header.jobSize);
+    return offset;
+}
+
+// Format of the chunk at offset if the whole chunk is in data and its checksum matches
+std::optional<ImageFormat> ReadChunk(std::span<const std::byte> data, std::size_t offset,
+                                     CheckpointChunk& chunk) {
+    if (offset + sizeof(CheckpointChunk) > data.size())
+        return std::nullopt;
+    std::memcpy(&chunk, data.data() + offset, sizeof(CheckpointChunk));
+
+    if (chunk.fmt > static_cast<std::uint32_t>(PixelFormat::F32) || chunk.width < 1 ||
+        chunk.height < 1 || chunk.numChannels < 1 || chunk.numChannels > 4)
+        return std::nullopt;
+
+    const ImageFormat fmt{static_cast<PixelFormat>(chunk.fmt), chunk.width, chunk.height,
+                          chunk.numChannels};
+    const auto pixels = offset + sizeof(CheckpointChunk);
+    if (chunk.size != ImageSize(fmt) || pixels + chunk.size > data.size() ||
+        Checksum(data.data() + pixels, chunk.size) != chunk.crc)
+        return std::nullopt;
+
+    return fmt;
+}
+
+} // namespace
+
+void ibl::CreateCheckpoint(const fs::path& filePath, const std::string& job) {
+    fs::remove(SumsPath(filePath));
+    WriteDurably(filePath, [&](std::ofstream& file) { WriteHeader(file, job); });
+}
+
+std::vector<std::uint64_t>
+ibl::AppendCheckpointFaces(const fs::path& filePath,
+                           std::span<const std::pair<int, int>> faces,
+                           const std::function<Image(int, int)>& read) {
+    std::vector<std::uint64_t> offsets;
+
+    {
+        std::ofstream file(filePath, std::ios_base::app | std::ios_base::binary);
+        if (file.fail())
+            FATAL("Failed to open file {}", filePath.string());
+
+        file.seekp(0, std::ios_base::end);
+        for (auto [level, face] : faces) {
+            offsets.push_back(file.tellp());
+            WriteChunk(file, ImageKind::Face, level, face, read(level, face));
+        }
+
+        file.flush();
+        if (file.fail())
+            FATAL("Failed to write checkpoint {}", filePath.string());
+    }
+
+    SyncFile(filePath);
+    return offsets;
+}
+
+void ibl::SaveCheckpointSums(const fs::path& filePath, const Checkpoint& checkpoint) {
+    const auto sumsPath = SumsPath(filePath);
+    if (checkpoint.level < 0) {
+        if (fs::remove(sumsPath))
+            SyncDirectory(sumsPath);
+        return;
+    }
+
+    WriteDurably(sumsPath, [&](std::ofstream& file) {
+        WriteHeader(file, checkpoint.job, checkpoint.level, checkpoint.batches);
+        for (std::size_t face = 0; face < checkpoint.sums.size(); ++face)
+            WriteChunk(file, ImageKind::Sum, checkpoint.level, face,
+                       checkpoint.sums[face]);
+        for (std::size_t face = 0; face < checkpoint.stats.size(); ++face)
+            WriteChunk(file, ImageKind::Stats, checkpoint.level, face,
+                       checkpoint.stats[face]);
+    });
+}
+
+Checkpoint ibl::LoadCheckpoint(const fs::path& filePath) {
+    const auto name = filePath.string();
+
+    Checkpoint checkpoint;
+    std::size_t end = 0, fileSize = 0;
+
+    {
+        const MappedFile file{filePath};
+        CheckpointHeader header;
+        end = ReadHeader(file, header, checkpoint.job);
+        fileSize = file.size();
+
+        // Index the whole chunks, the first torn or corrupted one ends the valid faces
+        const std::span data{file.data(), file.size()};
+        CheckpointChunk chunk;
+        while (ReadChunk(data, end, chunk) && chunk.kind == ImageKind::Face) {
+            checkpoint.faces[{chunk.level, chunk.face}] = end;
+            end += sizeof(CheckpointChunk) + chunk.size;
+        }
+    }
+
+    if (end < fileSize) {
+        Print("Dropping {} bytes of unfinished face levels from checkpoint {}",
+              fileSize - end, name);
+        fs::resize_file(filePath, end);
+        SyncFile(filePath);
+    }
+
+    const auto sumsPath = SumsPath(filePath);
+    if (!fs::exists(sumsPath))
+        return checkpoint;
+
+    const MappedFile file{sumsPath};
+    CheckpointHeader header;
+    std::string job;
+    auto offset = ReadHeader(file, header, job);
+
+    if (job != checkpoint.job)
+        FATAL("Partial sums {} were saved by another job ({})", sumsPath.string(), job);
+
+    checkpoint.level = header.level;
+    checkpoint.batches = header.batches;
+
+    const std::span data{file.data(), file.size()};
+    while (offset < file.size()) {
+        CheckpointChunk chunk;
+        auto fmt = ReadChunk(data, offset, chunk);
+        if (!fmt || chunk.kind == ImageKind::Face)
+            FATAL("Corrupted partial sums in checkpoint {}", sumsPath.string());
+
+        Image image{*fmt, file.data() + offset + sizeof(CheckpointChunk)};
+        if (chunk.kind == ImageKind::Sum)
+            checkpoint.sums.push_back(std::move(image));
+        else
+            checkpoint.stats.push_back(std::move(image));
+
+        offset += sizeof(CheckpointChunk) + chunk.size;
+    }
+
+    return checkpoint;
+}
+
+Image ibl::LoadCheckpointFace(const fs::path& filePath, std::uint64_t offset) {
+    std::ifstream file(filePath, std::ios_base::in | std::ios_base::binary);
+    if (file.fail())
+        FATAL("Failed to open file {}", filePath.string());
+
+    CheckpointChunk chunk;
+    file.seekg(offset);
+    file.read(reinterpret_cast<char*>(&chunk), sizeof(CheckpointChunk));
+    if (file.fail() || chunk.kind != ImageKind::Face)
+        FATAL("Corrupted face level in checkpoint {}", filePath.string());
+
+    const ImageFormat fmt{static_cast<PixelFormat>(chunk.fmt), chunk.width, chunk.height,
+                          chunk.numChannels};
+    Image image{fmt, 1};
+    file.read(reinterpret_cast<char*>(image.data()), image.size());
+
+    if (file.fail() || image.size() != chunk.size ||
+        Checksum(image.data(), image.size()) != chunk.crc)
+        FATAL("Corrupted face level in checkpoint {}", filePath.string());
+
+    return image;
+}
+
+void ibl::RemoveCheckpoint(const fs::path& filePath) {
+    fs::remove(filePath);
+    fs::remove(SumsPath(filePath));
+}
@@ -0,0 +1,55 @@
+#ifndef IBL_CHECKPOINT_H
+#define IBL_CHECKPOINT_H
+
+#include <iblenv.h>
+#include <image.h>
+
+#include <functional>
+
+namespace fs = std::filesystem;
+
+namespace ibl {
+
+// Progress of a convolution job: the face levels it finished and the partial sums of
+// the level it was accumulating progressively. Finished faces are appended to the
+// checkpoint file as they finish, one chunk each, and stay on disk until restored.
+// The partial sums go to '<file>.sums', replaced on every save.
+struct Checkpoint {
+    std::string job; // Options of the job, a checkpoint only resumes the same one
+
+    // Offsets of the finished face level chunks in the file, by level and face
+    std::map<std::pair<int, int>, std::uint64_t> faces;
+
+    int level = -1;                 // Level being accumulated, if any
+    std::uint32_t batches = 0;      // Batches already blended into its sums
+    std::vector<Image> sums, stats; // Per face, stats only in adaptive mode
+};
+
+// Starts an empty checkpoint for job, replacing any previous one
+void CreateCheckpoint(const fs::path& filePath, const std::string& job);
+
+// Appends face levels, given as (level, face), with their pixels from read, one at a
+// time. They are on disk when this returns. Returns the offsets of their chunks. A job
+// killed while appending leaves a torn tail, which LoadCheckpoint drops.
+std::vector<std::uint64_t>
+AppendCheckpointFaces(const fs::path& filePath,
+                      std::span<const std::pair<int, int>> faces,
+                      const std::function<Image(int, int)>& read);
+
+// Replaces the partial sums of the checkpoint, or removes them if it has no level being
+// accumulated. Writes to a temporary file renamed over the previous one, a job killed
+// while saving keeps the previous sums.
+void SaveCheckpointSums(const fs::path& filePath, const Checkpoint& checkpoint);
+
+// Reads the index of the finished faces and the partial sums. A torn tail of faces is
+// cut from the file, so appending can resume after the last whole chunk.
+Checkpoint LoadCheckpoint(const fs::path& filePath);
+
+// Pixels of a finished face level, at an offset from Checkpoint::faces
+Image LoadCheckpointFace(const fs::path& filePath, std::uint64_t offset);
+
+void RemoveCheckpoint(const fs::path& filePath);
+
+} // namespace ibl
+
+#endif
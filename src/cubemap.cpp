@@ -3,9 +3,15 @@
 #include <functional>
 #include <regex>
 #include <fstream>
+#include <cstring>
 
 #include <texture.h>
 #include <util.h>
+#include <parallel.h>
+#include <mappedfile.h>
+#include <projection.h>
+
+#include <zlib.h>
 
 using namespace ibl;
 using namespace ibl::util;
@@ -13,15 +19,6 @@ using namespace std::filesystem;
 
 namespace {
 
-const std::map<int, std::string> FaceNames{
-    {0, "+X"},
-    {1, "-X"},
-    {2, "+Y"},
-    {3, "-Y"},
-    {4, "+Z"},
-    {5, "-Z"}
-};
-
 int GetFaceSide(CubeLayoutType type, int width, int height) {
     using enum CubeLayoutType;
 
@@ -173,9 +170,17 @@ void ExportSeparate(const path& filePath, const CubeImage& cube) {
         return std::format("{}_{}{}", fname, FaceNames.at(face), ext);
     };
 
-    for (const auto& [face, name] : FaceNames) {
-        SaveMipmappedImage(parent / NameOutput(face), cube[face]);
-    }
+    const int numLevels = cube.numLevels();
+    if (numLevels > 1)
+        Print("Saving {} mip levels...", numLevels);
+
+    // Every face level is an independent output
+    ParallelFor(6 * numLevels, [&](std::size_t i) {
+        int face = i / numLevels, lvl = i % numLevels;
+        auto outPath = MipLevelPath(parent / NameOutput(face), lvl, numLevels);
+
+        SaveImage(outPath, ImageView{cube[face], lvl});
+    });
 }
 
 // clang-format off
@@ -208,38 +213,311 @@ void ExportCombined(const path& filePath, MappingFunc mapFunc, const CubeImage&
 }
 // clang-format on
 
+void ExportProjection(const path& filePath, CubeLayoutType type, const CubeImage& cube,
+                      int padding) {
+    auto proj = type == CubeLayoutType::Octahedral ? Projection::Octahedral
+                                                   : Projection::Equirect;
+    auto levels = CubeToProjection(cube, proj, padding);
+
+    const int numLevels = levels.size();
+    if (numLevels > 1)
+        Print("Saving {} mip levels...", numLevels);
+
+    ParallelFor(numLevels, [&](std::size_t lvl) {
+        SaveImage(MipLevelPath(filePath, lvl, numLevels), levels[lvl]);
+    });
+}
+
+/* ------------------------------------------------------------------
+    '.cube' container (version 2)
+
+    [CubeHeader][job key][CubeChunk x numChunks][payloads...]
+
+    Each chunk holds a region of one face level (whole faces for regular
+    exports), stored level major. Payloads start at page aligned offsets
+    so uncompressed ones can be used directly from a mapped file. Partial
+    files, the shards of a sharded job, hold tiles of some face levels
+    only and are assembled by MergeCubeTiles. Their job key, the string
+    up to indexOffset, tells the shards of different jobs apart. Whole
+    files have none.
+ -------------------------------------------------------------------*/
+constexpr std::uint32_t CubeVersion = 2;
+constexpr std::uint32_t CubeAlignment = 4096;
+
+enum CubeFlags : std::uint32_t { CubeCompressed = 1, CubePartial = 2 };
+enum ChunkFlags : std::uint32_t { ChunkCompressed = 1 };
+
 struct CubeHeader {
     std::uint8_t id[4] = {'C', 'U', 'B', 'E'};
+    std::uint32_t version = CubeVersion;
     std::uint32_t fmt;
     std::int32_t width;
     std::int32_t height;
     std::uint32_t compSize;
     std::int32_t numChannels;
-    std::uint32_t totalSize;
     std::int32_t levels;
+    std::int32_t faces;
+    std::uint32_t flags;
+    std::uint32_t alignment;
+    std::uint32_t numChunks;
+    std::uint64_t totalSize; // Uncompressed payload size
+    std::uint64_t indexOffset;
 };
 
-void ExportCustom(const path& filePath, const CubeImage& cube) {
-    const auto& [parent, fname, ext] = SplitFilePath(filePath);
+struct CubeChunk {
+    std::int32_t level;
+    std::int32_t face;
+    std::int32_t x, y;
+    std::int32_t width, height;
+    std::uint64_t offset;
+    std::uint64_t size;    // Stored size
+    std::uint64_t rawSize; // Uncompressed size
+    std::uint32_t crc;     // CRC-32 of the stored bytes
+    std::uint32_t flags;
+};
 
-    auto imgFmt = cube.imgFormat();
-    auto faceSize = cube[0].size();
+std::uint64_t AlignUp(std::uint64_t val, std::uint64_t alignment) {
+    return (val + alignment - 1) / alignment * alignment;
+}
+
+std::uint32_t Checksum(const std::byte* data, std::size_t size) {
+    auto crc = crc32_z(0L, Z_NULL, 0);
+    return crc32_z(crc, reinterpret_cast<const Bytef*>(data), size);
+}
+
+// Name of a face in error messages, faces past the first cube are numbered by cube
+std::string ChunkFaceName(int face) {
+    if (face < 6)
+        return FaceNames.at(face);
+
+    return std::format("{} of cube {}", FaceNames.at(face % 6), face / 6);
+}
+
+// Compresses the payload of a chunk when asked and fills in its stored size, flags and
+// checksum. Returns the bytes to store, either src or packed.
+const std::byte* PackChunk(CubeChunk& chunk, const std::byte* src, bool compress,
+                           std::vector<Bytef>& packed) {
+    chunk.size = chunk.rawSize;
+    chunk.flags = 0;
+
+    if (compress) {
+        uLongf packedSize = compressBound(chunk.rawSize);
+        packed.resize(packedSize);
+
+        int ret = compress2(packed.data(), &packedSize,
+                            reinterpret_cast<const Bytef*>(src), chunk.rawSize,
+                            Z_DEFAULT_COMPRESSION);
+        if (ret != Z_OK)
+            FATAL("Failed to compress level {} of face {}", chunk.level,
+                  ChunkFaceName(chunk.face));
+
+        // Keep incompressible data raw, so it stays directly mappable
+        if (packedSize < chunk.rawSize) {
+            packed.resize(packedSize);
+            chunk.size = packedSize;
+            chunk.flags = ChunkCompressed;
+            src = reinterpret_cast<const std::byte*>(packed.data());
+        } else {
+            packed.clear();
+        }
+    }
+
+    chunk.crc = Checksum(src, chunk.size);
+    return src;
+}
 
+CubeHeader MakeHeader(ImageFormat imgFmt, int levels, int faces, std::uint32_t flags) {
     CubeHeader header;
     header.fmt = static_cast<std::uint32_t>(imgFmt.pFmt);
     header.width = imgFmt.width;
     header.height = imgFmt.height;
     header.compSize = ComponentSize(imgFmt.pFmt);
     header.numChannels = imgFmt.nChannels;
-    header.totalSize = faceSize * 6;
-    header.levels = cube.numLevels();
+    header.levels = levels;
+    header.faces = faces;
+    header.flags = flags;
+    header.alignment = CubeAlignment;
+    header.numChunks = 0;
+    header.totalSize = 0;
+    header.indexOffset = sizeof(CubeHeader);
+
+    return header;
+}
+
+// Lays the chunks out at aligned offsets and writes the container to
+// '<filePath stem>.cube'. payload(i) returns the stored bytes of chunk i.
+void WriteContainer(const path& filePath, CubeHeader header,
+                    std::vector<CubeChunk>& index,
+                    const std::function<const std::byte*(std::size_t)>& payload,
+                    const std::string& job = {}) {
+    const auto& [parent, fname, ext] = SplitFilePath(filePath);
+
+    header.indexOffset = sizeof(CubeHeader) + job.size();
+    header.numChunks = index.size();
+    header.totalSize = 0;
+
+    auto offset = AlignUp(header.indexOffset + index.size() * sizeof(CubeChunk),
+                          CubeAlignment);
+    for (auto& chunk : index) {
+        chunk.offset = offset;
+        offset = AlignUp(offset + chunk.size, CubeAlignment);
+        header.totalSize += chunk.rawSize;
+    }
 
     auto outName = std::format("{}{}", fname, ".cube");
     std::ofstream file(parent / outName, std::ios_base::out | std::ios_base::binary);
+    if (file.fail())
+        FATAL("Failed to open file {}", (parent / outName).string());
+
     file.write(reinterpret_cast<const char*>(&header), sizeof(CubeHeader));
+    file.write(job.data(), job.size());
+    file.write(reinterpret_cast<const char*>(index.data()),
+               index.size() * sizeof(CubeChunk));
+
+    std::uint64_t pos = header.indexOffset + index.size() * sizeof(CubeChunk);
+    const std::vector<char> padding(CubeAlignment, 0);
+
+    for (std::size_t i = 0; i < index.size(); ++i) {
+        const auto& chunk = index[i];
+
+        file.write(padding.data(), chunk.offset - pos);
+        file.write(reinterpret_cast<const char*>(payload(i)), chunk.size);
+
+        pos = chunk.offset + chunk.size;
+    }
+
+    if (file.fail())
+        FATAL("Failed writing {}", (parent / outName).string());
+}
+
+// Writes one cube, or a cube map array as 6 faces per cube
+void ExportCustom(const path& filePath, std::span<const CubeImage> cubes,
+                  const ExportOptions& opts) {
+    auto imgFmt = cubes[0].imgFormat();
+    const int levels = cubes[0].numLevels();
+    const int faces = 6 * static_cast<int>(cubes.size());
+
+    for (const auto& cube : cubes) {
+        auto fmt = cube.imgFormat();
+        if (cube.numLevels() != levels || fmt.width != imgFmt.width ||
+            fmt.pFmt != imgFmt.pFmt || fmt.nChannels != imgFmt.nChannels)
+            FATAL("Every cube of a '.cube' array needs the same format and levels");
+    }
+
+    auto FaceImage = [&](int face) -> const Image& { return cubes[face / 6][face % 6]; };
+
+    std::vector<CubeChunk> index(faces * levels);
+    std::vector<std::vector<Bytef>> packed(index.size());
+    std::vector<const std::byte*> stored(index.size());
+
+    ParallelFor(index.size(), [&](std::size_t i) {
+        int lvl = i / faces, face = i % faces;
+        auto lvlFmt = cubes[0].imgFormat(lvl);
+
+        index[i] = {.level = lvl,
+                    .face = face,
+                    .x = 0,
+                    .y = 0,
+                    .width = lvlFmt.width,
+                    .height = lvlFmt.height,
+                    .offset = 0,
+                    .size = 0,
+                    .rawSize = FaceImage(face).size(lvl),
+                    .crc = 0,
+                    .flags = 0};
+
+        const auto* src = FaceImage(face).data(lvl);
+        stored[i] = PackChunk(index[i], src, opts.compress, packed[i]);
+    });
+
+    auto flags = opts.compress ? std::uint32_t{CubeCompressed} : 0u;
+    WriteContainer(filePath, MakeHeader(imgFmt, levels, faces, flags), index,
+                   [&](std::size_t i) { return stored[i]; });
+}
+
+// Chunk index of a '.cube' file and its header, checked against the file size
+std::vector<CubeChunk> ReadIndex(const MappedFile& file, const std::string& name,
+                                 CubeHeader& header) {
+    if (file.size() < sizeof(CubeHeader))
+        FATAL("{} is not a valid .cube file", name);
+
+    std::memcpy(&header, file.data(), sizeof(CubeHeader));
+    if (std::memcmp(header.id, CubeHeader{}.id, sizeof(header.id)) != 0)
+        FATAL("{} is not a valid .cube file", name);
+
+    if (header.version != CubeVersion)
+        FATAL("Unsupported .cube version {} in {}", header.version, name);
+
+    // Faces are square, and no level is smaller than 1px
+    if (header.fmt > static_cast<std::uint32_t>(PixelFormat::F32) ||
+        header.compSize != ComponentSize(static_cast<PixelFormat>(header.fmt)) ||
+        header.numChannels < 1 || header.numChannels > 4 || header.width < 1 ||
+        header.height != header.width || header.levels < 1 ||
+        header.levels > MaxMipLevel(header.width) || header.faces < 6 ||
+        header.faces % 6 != 0)
+        FATAL("Corrupted .cube header in {}", name);
+
+    // Subtracted before comparing, crafted offsets and counts can't overflow
+    if (header.indexOffset < sizeof(CubeHeader) || header.indexOffset > file.size() ||
+        header.numChunks > (file.size() - header.indexOffset) / sizeof(CubeChunk))
+        FATAL("Truncated .cube index in {}", name);
+
+    std::vector<CubeChunk> index(header.numChunks);
+    std::memcpy(index.data(), file.data() + header.indexOffset,
+                index.size() * sizeof(CubeChunk));
+
+    const ImageFormat fmt{static_cast<PixelFormat>(header.fmt), header.width,
+                          header.height, header.numChannels};
+    std::uint64_t totalSize = 0;
+
+    for (const auto& chunk : index) {
+        if (chunk.level < 0 || chunk.level >= header.levels || chunk.face < 0 ||
+            chunk.face >= header.faces)
+            FATAL("Invalid chunk in {}", name);
+
+        // Tiles lie inside their face level and hold as many bytes as their texels
+        const std::int64_t lvlSize = ResizeLvl(header.width, chunk.level);
+        if (chunk.x < 0 || chunk.y < 0 || chunk.width < 1 || chunk.height < 1 ||
+            chunk.x + std::int64_t{chunk.width} > lvlSize ||
+            chunk.y + std::int64_t{chunk.height} > lvlSize ||
+            chunk.rawSize != ImageSize({fmt.pFmt, chunk.width, chunk.height,
+                                        fmt.nChannels}) ||
+            (!(chunk.flags & ChunkCompressed) && chunk.size != chunk.rawSize))
+            FATAL("Invalid chunk for level {} of face {} in {}", chunk.level,
+                  ChunkFaceName(chunk.face), name);
+
+        if (chunk.offset > file.size() || chunk.size > file.size() - chunk.offset)
+            FATAL("Truncated .cube payload in {}", name);
+
+        totalSize += chunk.rawSize;
+    }
+
+    if (totalSize != header.totalSize)
+        FATAL("Payload size of {} doesn't match its index", name);
 
-    for (int face = 0; face < 6; ++face)
-        file.write(reinterpret_cast<const char*>(cube[face].data()), faceSize);
+    return index;
+}
+
+// Stored bytes of a chunk checked against its checksum, inflated if compressed
+std::vector<std::byte> ReadChunk(const MappedFile& file, const CubeChunk& chunk,
+                                 const std::string& name) {
+    const auto* stored = file.data() + chunk.offset;
+    if (Checksum(stored, chunk.size) != chunk.crc)
+        FATAL("Checksum mismatch on level {} of face {} in {}", chunk.level,
+              ChunkFaceName(chunk.face), name);
+
+    if (!(chunk.flags & ChunkCompressed))
+        return {stored, stored + chunk.size};
+
+    std::vector<std::byte> raw(chunk.rawSize);
+    uLongf rawSize = chunk.rawSize;
+    int ret = uncompress(reinterpret_cast<Bytef*>(raw.data()), &rawSize,
+                         reinterpret_cast<const Bytef*>(stored), chunk.size);
+    if (ret != Z_OK || rawSize != chunk.rawSize)
+        FATAL("Failed to inflate level {} of face {} in {}", chunk.level,
+              ChunkFaceName(chunk.face), name);
+
+    return raw;
 }
 
 auto ImportSeparate(const path& filePath, ImageFormat* fmt) {
@@ -251,12 +529,13 @@ auto ImportSeparate(const path& filePath, ImageFormat* fmt) {
 
     auto cube = std::make_unique<CubeImage>();
 
-    for (const auto& [face, name] : FaceNames) {
+    // Faces are independent files, decode them concurrently
+    ParallelFor(6, [&](std::size_t face) {
         auto inputName = NameInput(face);
         auto imgFace = LoadImage(parent / inputName, fmt);
 
         (*cube)[face] = std::move(*imgFace);
-    }
+    });
 
     return cube;
 }
@@ -265,8 +544,17 @@ auto ImportSeparate(const path& filePath, ImageFormat* fmt) {
 auto ImportCombined(const path& filePath, CubeLayoutType type, MappingFunc mapFunc,
                     ImageFormat* fmt) {
                         
-    auto srcImg = LoadImage(filePath, fmt);
-    auto srcFmt = srcImg->format();
+    // Raw images are copied into the faces straight from their mapping
+    std::unique_ptr<MappedImage> mapped;
+    std::unique_ptr<Image> decoded;
+    const auto ext = filePath.extension();
+    if (ext == ".bin" || ext == ".img")
+        mapped = MapImage(filePath, fmt);
+    else
+        decoded = LoadImage(filePath, fmt);
+
+    const ImageView srcImg = mapped ? mapped->view() : ImageView{*decoded};
+    auto srcFmt = srcImg.format();
 
     if (!ValidateMapping(type, srcFmt.width, srcFmt.height))
         FATAL("Provided cubemap layout type does not match input file.");
@@ -287,7 +575,7 @@ auto ImportCombined(const path& filePath, CubeLayoutType type, MappingFunc mapFu
                        .fromX = x, .fromY = y,
                        .sizeX = faceFmt.width,
                        .sizeY = faceFmt.height}, 
-                      *srcImg);
+                      srcImg);
     }
 
     return cube;
@@ -296,13 +584,191 @@ auto ImportCombined(const path& filePath, CubeLayoutType type, MappingFunc mapFu
 
 } // namespace
 
+CubeFile::CubeFile(const fs::path& filePath, bool verify)
+    : file(std::make_unique<MappedFile>(filePath)) {
+
+    const auto name = filePath.string();
+    CubeHeader header;
+    auto index = ReadIndex(*file, name, header);
+
+    if (header.flags & CubePartial)
+        FATAL("{} holds the tiles of one shard, assemble the shards with 'merge' first",
+              name);
+
+    fmt = {static_cast<PixelFormat>(header.fmt), header.width, header.height,
+           header.numChannels};
+    levels = header.levels;
+    faces = header.faces;
+
+    // A whole file has one chunk per face level, this also bounds the views by the index
+    if (static_cast<std::uint64_t>(faces) * levels != index.size())
+        FATAL("{} has {} chunks for {} faces of {} levels", name, index.size(), faces,
+              levels);
+
+    facePtrs.assign(faces * levels, nullptr);
+    inflated.resize(faces * levels);
+
+    std::size_t inflatedSize = 0;
+    for (const auto& chunk : index) {
+        auto lvlFmt = imgFormat(chunk.level);
+        if (chunk.x != 0 || chunk.y != 0 || chunk.width != lvlFmt.width ||
+            chunk.height != lvlFmt.height || chunk.rawSize != ImageSize(lvlFmt))
+            FATAL("Chunk for level {} of face {} doesn't cover the whole face in {}",
+                  chunk.level, ChunkFaceName(chunk.face), name);
+
+        auto& ptr = facePtrs[chunk.level * faces + chunk.face];
+        if (ptr)
+            FATAL("Repeated chunk for level {} of face {} in {}", chunk.level,
+                  ChunkFaceName(chunk.face), name);
+        ptr = file->data() + chunk.offset;
+
+        if (chunk.flags & ChunkCompressed)
+            inflatedSize += chunk.rawSize;
+    }
+
+    inflatedMemory.resize(inflatedSize);
+
+    if (std::find(facePtrs.begin(), facePtrs.end(), nullptr) != facePtrs.end())
+        FATAL("Missing face levels in {}", name);
+
+    ParallelFor(index.size(), [&](std::size_t i) {
+        const auto& chunk = index[i];
+        const auto slot = chunk.level * faces + chunk.face;
+        const auto* stored = facePtrs[slot];
+
+        if (verify && Checksum(stored, chunk.size) != chunk.crc)
+            FATAL("Checksum mismatch on level {} of face {} in {}", chunk.level,
+                  ChunkFaceName(chunk.face), name);
+
+        if (chunk.flags & ChunkCompressed) {
+            inflated[slot] = std::make_unique<std::byte[]>(chunk.rawSize);
+
+            uLongf rawSize = chunk.rawSize;
+            int ret = uncompress(reinterpret_cast<Bytef*>(inflated[slot].get()), &rawSize,
+                                 reinterpret_cast<const Bytef*>(stored), chunk.size);
+            if (ret != Z_OK || rawSize != chunk.rawSize)
+                FATAL("Failed to inflate level {} of face {} in {}", chunk.level,
+                      ChunkFaceName(chunk.face), name);
+
+            facePtrs[slot] = inflated[slot].get();
+        }
+    });
+}
+
+CubeFile::~CubeFile() = default;
+
+ImageFormat CubeFile::imgFormat(int lvl) const {
+    return {fmt.pFmt, ResizeLvl(fmt.width, lvl), ResizeLvl(fmt.height, lvl),
+            fmt.nChannels};
+}
+
+ImageView CubeFile::face(int face, int lvl) const {
+    return {imgFormat(lvl), facePtrs[lvl * faces + face]};
+}
+
+std::unique_ptr<CubeImage> CubeFile::cubemap(int cube) const {
+    if (cube < 0 || cube >= numCubes())
+        FATAL("No cube {} in a '.cube' file of {} cubes", cube, numCubes());
+
+    auto cubeImg = std::make_unique<CubeImage>(fmt, levels);
+
+    for (int face = 0; face < 6; ++face) {
+        for (int lvl = 0; lvl < levels; ++lvl) {
+            auto view = this->face(6 * cube + face, lvl);
+            std::memcpy((*cubeImg)[face].data(lvl), view.data(), view.size());
+        }
+    }
+
+    return cubeImg;
+}
+
+std::array<float, 3> ibl::CubeFaceDir(int face, float s, float t) {
+    const float u = 2.0f * s - 1.0f, v = 2.0f * t - 1.0f;
+
+    std::array<float, 3> dir;
+    switch (face) {
+    case 0:
+        dir = {1.0f, -v, -u};
+        break;
+    case 1:
+        dir = {-1.0f, -v, u};
+        break;
+    case 2:
+        dir = {u, 1.0f, v};
+        break;
+    case 3:
+        dir = {u, -1.0f, -v};
+        break;
+    case 4:
+        dir = {u, -v, 1.0f};
+        break;
+    default:
+        dir = {-u, -v, -1.0f};
+        break;
+    }
+
+    const float len = std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+    for (auto& c : dir)
+        c /= len;
+
+    return dir;
+}
+
+std::tuple<int, float, float> ibl::CubeDirFaceST(const std::array<float, 3>& dir) {
+    const float ax = std::abs(dir[0]), ay = std::abs(dir[1]), az = std::abs(dir[2]);
+
+    int face;
+    float u, v;
+    if (ax >= ay && ax >= az) {
+        face = dir[0] > 0.0f ? 0 : 1;
+        u = (dir[0] > 0.0f ? -dir[2] : dir[2]) / ax;
+        v = -dir[1] / ax;
+    } else if (ay >= az) {
+        face = dir[1] > 0.0f ? 2 : 3;
+        u = dir[0] / ay;
+        v = (dir[1] > 0.0f ? dir[2] : -dir[2]) / ay;
+    } else {
+        face = dir[2] > 0.0f ? 4 : 5;
+        u = (dir[2] > 0.0f ? dir[0] : -dir[0]) / az;
+        v = -dir[1] / az;
+    }
+
+    return {face, (u + 1.0f) * 0.5f, (v + 1.0f) * 0.5f};
+}
+
+std::array<int, 3> ibl::CubeDirTexel(const std::array<float, 3>& dir, int size) {
+    const auto [face, s, t] = CubeDirFaceST(dir);
+
+    auto Texel = [size](float c) {
+        return std::clamp(static_cast<int>(c * size), 0, size - 1);
+    };
+
+    return {face, Texel(s), Texel(t)};
+}
+
+float ibl::CubeTexelSolidAngle(int x, int y, int size) {
+    // Solid angle of the face region from its center to (u, v)
+    auto AreaElement = [](double u, double v) {
+        return std::atan2(u * v, std::sqrt(u * u + v * v + 1.0));
+    };
+
+    const double inv = 2.0 / size;
+    const double u0 = x * inv - 1.0, u1 = u0 + inv;
+    const double v0 = y * inv - 1.0, v1 = v0 + inv;
+
+    return static_cast<float>(AreaElement(u0, v0) - AreaElement(u0, v1) -
+                              AreaElement(u1, v0) + AreaElement(u1, v1));
+}
+
 void ibl::ExportCubemap(const std::string& filePath, CubeLayoutType type,
-                        CubeImage& cube) {
+                        CubeImage& cube, const ExportOptions& opts) {
 
     if (type == CubeLayoutType::Separate)
         ExportSeparate(filePath, cube);
     else if (type == CubeLayoutType::Custom)
-        ExportCustom(filePath, cube);
+        ExportCustom(filePath, {&cube, 1}, opts);
+    else if (type == CubeLayoutType::Octahedral || type == CubeLayoutType::Equirect)
+        ExportProjection(filePath, type, cube, opts.padding);
     else {
         // Special case: invert -Z in both axis
         if (type == CubeLayoutType::VerticalCross)
@@ -312,12 +778,208 @@ void ibl::ExportCubemap(const std::string& filePath, CubeLayoutType type,
     }
 }
 
+void ibl::ExportCubeArray(const std::string& filePath, std::span<const CubeImage> cubes,
+                          const ExportOptions& opts) {
+    if (cubes.empty())
+        FATAL("No cubes to export to {}", filePath);
+
+    ExportCustom(filePath, cubes, opts);
+}
+
+void ibl::ExportCubeTiles(const std::string& filePath, ImageFormat fmt, int levels,
+                          std::span<const CubeTile> tiles, const std::string& job,
+                          const ExportOptions& opts) {
+    std::vector<CubeChunk> index(tiles.size());
+    std::vector<std::vector<Bytef>> packed(index.size());
+    std::vector<const std::byte*> stored(index.size());
+
+    ParallelFor(index.size(), [&](std::size_t i) {
+        const auto& tile = tiles[i];
+        const auto tileFmt = tile.image.format();
+        const int lvlSize = ResizeLvl(fmt.width, tile.level);
+
+        if (tile.level < 0 || tile.level >= levels || tile.face < 0 || tile.face >= 6 ||
+            tile.x < 0 || tile.y < 0 || tile.x + tileFmt.width > lvlSize ||
+            tile.y + tileFmt.height > lvlSize)
+            FATAL("Tile at ({}, {}) is out of level {} of face {}", tile.x, tile.y,
+                  tile.level, ChunkFaceName(tile.face));
+
+        if (tileFmt.pFmt != fmt.pFmt || tileFmt.nChannels != fmt.nChannels)
+            FATAL("Tile at ({}, {}) of level {} of face {} has another pixel format",
+                  tile.x, tile.y, tile.level, ChunkFaceName(tile.face));
+
+        index[i] = {.level = tile.level,
+                    .face = tile.face,
+                    .x = tile.x,
+                    .y = tile.y,
+                    .width = tileFmt.width,
+                    .height = tileFmt.height,
+                    .offset = 0,
+                    .size = 0,
+                    .rawSize = tile.image.size(0),
+                    .crc = 0,
+                    .flags = 0};
+
+        stored[i] = PackChunk(index[i], tile.image.data(), opts.compress, packed[i]);
+    });
+
+    auto flags = CubePartial | (opts.compress ? std::uint32_t{CubeCompressed} : 0u);
+    WriteContainer(filePath, MakeHeader(fmt, levels, 6, flags), index,
+                   [&](std::size_t i) { return stored[i]; }, job);
+}
+
+std::unique_ptr<CubeImage> ibl::MergeCubeTiles(std::span<const std::string> filePaths) {
+    if (filePaths.empty())
+        FATAL("No shards to merge");
+
+    struct Shard {
+        std::unique_ptr<MappedFile> file;
+        std::vector<CubeChunk> index;
+    };
+
+    std::vector<Shard> shards(filePaths.size());
+    CubeHeader first;
+    std::string firstJob;
+
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        shards[i].file = std::make_unique<MappedFile>(filePaths[i]);
+
+        CubeHeader header;
+        shards[i].index = ReadIndex(*shards[i].file, filePaths[i], header);
+
+        if (!(header.flags & CubePartial))
+            FATAL("{} is a whole '.cube' file, not a shard", filePaths[i]);
+
+        std::string job(reinterpret_cast<const char*>(shards[i].file->data()) +
+                            sizeof(CubeHeader),
+                        header.indexOffset - sizeof(CubeHeader));
+
+        if (i == 0) {
+            first = header;
+            firstJob = std::move(job);
+        } else if (job != firstJob)
+            FATAL("{} is a shard of another job ({}) than {} ({})", filePaths[i], job,
+                  filePaths[0], firstJob);
+        else if (header.fmt != first.fmt || header.width != first.width ||
+                 header.numChannels != first.numChannels ||
+                 header.levels != first.levels || header.faces != first.faces)
+            FATAL("{} doesn't match the format and levels of {}", filePaths[i],
+                  filePaths[0]);
+    }
+
+    const ImageFormat fmt{static_cast<PixelFormat>(first.fmt), first.width, first.height,
+                          first.numChannels};
+    const int levels = first.levels;
+    const auto pixelSize = static_cast<std::size_t>(ComponentSize(fmt.pFmt)) *
+                           fmt.nChannels;
+
+    // Every face level has to be tiled exactly once: no overlaps and no texel left
+    struct Region {
+        int x, y, width, height;
+        std::size_t shard;
+    };
+    std::vector<std::vector<Region>> regions(6 * levels);
+
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        for (const auto& chunk : shards[i].index) {
+            const int lvlSize = ResizeLvl(fmt.width, chunk.level);
+            if (chunk.x < 0 || chunk.y < 0 || chunk.width < 1 || chunk.height < 1 ||
+                chunk.x + chunk.width > lvlSize || chunk.y + chunk.height > lvlSize ||
+                chunk.rawSize != pixelSize * chunk.width * chunk.height)
+                FATAL("Tile at ({}, {}) of level {} of face {} is out of bounds in {}",
+                      chunk.x, chunk.y, chunk.level, ChunkFaceName(chunk.face),
+                      filePaths[i]);
+
+            regions[chunk.level * 6 + chunk.face].push_back(
+                {chunk.x, chunk.y, chunk.width, chunk.height, i});
+        }
+    }
+
+    for (int lvl = 0; lvl < levels; ++lvl) {
+        const std::size_t lvlSize = ResizeLvl(fmt.width, lvl);
+
+        for (int face = 0; face < 6; ++face) {
+            auto& tiles = regions[lvl * 6 + face];
+            std::sort(tiles.begin(), tiles.end(),
+                      [](const Region& a, const Region& b) { return a.x < b.x; });
+
+            std::size_t covered = 0;
+            for (std::size_t a = 0; a < tiles.size(); ++a) {
+                covered += static_cast<std::size_t>(tiles[a].width) * tiles[a].height;
+
+                for (auto b = a + 1;
+                     b < tiles.size() && tiles[b].x < tiles[a].x + tiles[a].width; ++b) {
+                    if (tiles[b].y < tiles[a].y + tiles[a].height &&
+                        tiles[a].y < tiles[b].y + tiles[b].height)
+                        FATAL("Tiles of {} and {} overlap in level {} of face {}",
+                              filePaths[tiles[a].shard], filePaths[tiles[b].shard], lvl,
+                              ChunkFaceName(face));
+                }
+            }
+
+            if (covered != lvlSize * lvlSize)
+                FATAL("Level {} of face {} misses {} of its {} texels, some shards are "
+                      "missing",
+                      lvl, ChunkFaceName(face), lvlSize * lvlSize - covered,
+                      lvlSize * lvlSize);
+        }
+    }
+
+    auto cube = std::make_unique<CubeImage>(fmt, levels);
+
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        const auto& shard = shards[i];
+
+        ParallelFor(shard.index.size(), [&](std::size_t c) {
+            const auto& chunk = shard.index[c];
+            const auto raw = ReadChunk(*shard.file, chunk, filePaths[i]);
+
+            const std::size_t lvlSize = ResizeLvl(fmt.width, chunk.level);
+            auto* dst = (*cube)[chunk.face].data(chunk.level);
+            const auto rowSize = pixelSize * chunk.width;
+
+            for (int y = 0; y < chunk.height; ++y) {
+                auto offset = ((chunk.y + y) * lvlSize + chunk.x) * pixelSize;
+                std::memcpy(dst + offset, raw.data() + y * rowSize, rowSize);
+            }
+        });
+    }
+
+    return cube;
+}
+
 std::unique_ptr<CubeImage> ibl::ImportCubeMap(const std::string& filePath,
                                               CubeLayoutType type, ImageFormat* reqFmt) {
 
     if (type == CubeLayoutType::Separate)
         return ImportSeparate(filePath, reqFmt);
 
+    // The file describes its own format, the requested one is converted to
+    if (type == CubeLayoutType::Custom) {
+        auto cube = CubeFile{filePath}.cubemap();
+        const auto fmt = cube->imgFormat();
+        if (!reqFmt || (reqFmt->pFmt == fmt.pFmt && reqFmt->nChannels == fmt.nChannels))
+            return cube;
+
+        if ((reqFmt->width > 0 && reqFmt->width != fmt.width) ||
+            (reqFmt->height > 0 && reqFmt->height != fmt.height) ||
+            reqFmt->nChannels < 1 || reqFmt->nChannels > 4)
+            FATAL("{} holds {}x{} faces with {} channels, they can't be loaded as {}x{} "
+                  "with {}",
+                  filePath, fmt.width, fmt.height, fmt.nChannels, reqFmt->width,
+                  reqFmt->height, reqFmt->nChannels);
+
+        for (int face = 0; face < 6; ++face) {
+            auto& img = (*cube)[face];
+            img = Image{{reqFmt->pFmt, fmt.width, fmt.height, reqFmt->nChannels},
+                        std::move(img)};
+        }
+        return cube;
+    }
+
+    if (type == CubeLayoutType::Octahedral || type == CubeLayoutType::Equirect)
+        FATAL("{} can only be exported", LayoutNames.at(type));
+
     auto cube = ImportCombined(filePath, type, CubeMappings.at(type), reqFmt);
 
     // Handle special case, invert -Z face for vertical cross
@@ -2,13 +2,17 @@
 #define IBL_CUBEMAP_H
 
 #include <iblenv.h>
+#include <image.h>
+
+#include <tuple>
 
 #include <glm/gtc/matrix_transform.hpp>
 
+namespace fs = std::filesystem;
+
 namespace ibl {
 
-struct ImageFormat;
-class CubeImage;
+class MappedFile;
 
 const std::vector CubeMapViews{
     glm::lookAt(glm::vec3{0}, {1.0f, 0.0f, 0.0f}, {0.0f, -1.0f, 0.0f}),
@@ -25,7 +29,9 @@ enum class CubeLayoutType {
     Separate = 3,
     VerticalSequence = 4,
     VerticalCross = 5,
-    Custom = 6
+    Custom = 6,
+    Octahedral = 7, // 2D projections, export only
+    Equirect = 8
 };
 
 const std::map<CubeLayoutType, std::string> LayoutNames{
@@ -35,10 +41,91 @@ const std::map<CubeLayoutType, std::string> LayoutNames{
     {CubeLayoutType::Separate,           "Separate Faces"           },
     {CubeLayoutType::VerticalSequence,   "Vertical Sequence"        },
     {CubeLayoutType::VerticalCross,      "Vertical Cross"           },
-    {CubeLayoutType::Custom,             "Custom Format"            }
+    {CubeLayoutType::Custom,             "Custom Format"            },
+    {CubeLayoutType::Octahedral,         "Octahedral Map"           },
+    {CubeLayoutType::Equirect,           "Equirectangular"          }
+};
+
+const std::map<int, std::string> FaceNames{
+    {0, "+X"},
+    {1, "-X"},
+    {2, "+Y"},
+    {3, "-Y"},
+    {4, "+Z"},
+    {5, "-Z"}
+};
+
+// World direction through (s, t) in [0, 1]^2 of a face, following the OpenGL cube map
+// convention where t = 0 is the first row of the face image
+std::array<float, 3> CubeFaceDir(int face, float s, float t);
+
+// Face a world direction falls in and its (s, t) in [0, 1]^2, inverse of CubeFaceDir
+std::tuple<int, float, float> CubeDirFaceST(const std::array<float, 3>& dir);
+
+// Texel of a face of the given side that a world direction falls in, {face, x, y}
+std::array<int, 3> CubeDirTexel(const std::array<float, 3>& dir, int size);
+
+// Solid angle subtended by texel (x, y) of a face of the given side
+float CubeTexelSolidAngle(int x, int y, int size);
+
+struct ExportOptions {
+    bool compress = false; // zlib compression of the '.cube' payload chunks
+    int padding = 0;       // Border texels around octahedral and equirect levels
 };
 
-void ExportCubemap(const std::string& filePath, CubeLayoutType type, CubeImage& cube);
+// Reader for the '.cube' container. Uncompressed face levels are served straight from
+// the memory mapped file, compressed ones are inflated once on open. Cube map arrays
+// store 6 faces per cube, face i of cube c is face 6 * c + i.
+class CubeFile {
+public:
+    explicit CubeFile(const fs::path& filePath, bool verify = true);
+    ~CubeFile();
+
+    ImageFormat imgFormat(int lvl = 0) const;
+    int numLevels() const { return levels; }
+    int numCubes() const { return faces / 6; }
+
+    ImageView face(int face, int lvl = 0) const;
+
+    std::unique_ptr<CubeImage> cubemap(int cube = 0) const;
+
+private:
+    std::unique_ptr<MappedFile> file;
+    std::vector<const std::byte*> facePtrs; // Level major
+    std::vector<std::unique_ptr<std::byte[]>> inflated;
+    TrackedBytes inflatedMemory{MemCategory::Decode};
+
+    ImageFormat fmt;
+    int levels = 1;
+    int faces = 6;
+};
+
+void ExportCubemap(const std::string& filePath, CubeLayoutType type, CubeImage& cube,
+                   const ExportOptions& opts = {});
+
+// Writes cubes of the same format and levels as one '.cube' cube map array
+void ExportCubeArray(const std::string& filePath, std::span<const CubeImage> cubes,
+                     const ExportOptions& opts = {});
+
+// Region of one face level, the tile's image holds its texels
+struct CubeTile {
+    int level;
+    int face;
+    int x, y;
+    Image image;
+};
+
+// Writes tiles of a cube with the given level 0 face format and levels as a partial
+// '.cube' file, the output of one shard of a job. job identifies the job the shard
+// belongs to. CubeFile rejects partial files.
+void ExportCubeTiles(const std::string& filePath, ImageFormat fmt, int levels,
+                     std::span<const CubeTile> tiles, const std::string& job,
+                     const ExportOptions& opts = {});
+
+// Assembles the partial '.cube' files of the shards of a job. They have to agree on
+// job, format and levels and cover every texel of every face level exactly once.
+std::unique_ptr<CubeImage> MergeCubeTiles(std::span<const std::string> filePaths);
+
 std::unique_ptr<CubeImage> ImportCubeMap(const std::string& filePath, CubeLayoutType type,
                                          ImageFormat* reqFmt);
 
@@ -3,6 +3,7 @@
 
 #include <glad/glad.h>
 #include <texture.h>
+#include <memtracker.h>
 
 namespace ibl {
 
@@ -18,6 +19,7 @@ public:
     }
 
     void addDepthBuffer(unsigned int width, unsigned int height) {
+        depthMemory.resize(std::size_t{width} * height * DepthTexelSize);
         glCreateRenderbuffers(1, &depthBuff);
 
         glNamedRenderbufferStorage(depthBuff, GL_DEPTH_COMPONENT24, width, height);
@@ -26,6 +28,7 @@ public:
     }
 
     void resize(int width, int height) {
+        depthMemory.resize(std::size_t(width) * height * DepthTexelSize);
         glNamedRenderbufferStorage(depthBuff, GL_DEPTH_COMPONENT24, width, height);
     }
 
@@ -40,7 +43,11 @@ public:
     void bind() { glBindFramebuffer(GL_FRAMEBUFFER, handle); }
 
     GLuint handle;
-    GLuint depthBuff;
+    GLuint depthBuff = 0;
+
+private:
+    static constexpr std::size_t DepthTexelSize = 4; // 24 bit depth, padded
+    TrackedBytes depthMemory{MemCategory::Renderbuffer};
 };
 
 } // namespace ibl
@@ -36,7 +36,7 @@ void ibl::RenderQuad() {
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
 
-void ibl::RenderCube() {
+void ibl::RenderCube(int instances) {
     if (CubeVao == 0) {
         float vertices[] = {-1.0f, -1.0f, -1.0f, 1.0f,  1.0f,  -1.0f, 1.0f, -1.0f,
                             -1.0f, -1.0f, 1.0f,  -1.0f, -1.0f, -1.0f, 1.0f, 1.0f,
@@ -60,18 +60,20 @@ void ibl::RenderCube() {
     }
 
     glBindVertexArray(CubeVao);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+    glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0, instances);
 }
 
 void ibl::CleanupGeometry() {
     if (QuadVao != 0) {
         glDeleteVertexArrays(1, &QuadVao);
         glDeleteBuffers(1, &QuadVbo);
+        QuadVao = 0;
     }
 
     if (CubeVao != 0) {
         glDeleteVertexArrays(1, &CubeVao);
         glDeleteBuffers(1, &CubeVbo);
         glDeleteBuffers(1, &CubeVboIdx);
+        CubeVao = 0;
     }
 }
@@ -4,7 +4,7 @@
 namespace ibl {
 
 void RenderQuad();
-void RenderCube();
+void RenderCube(int instances = 1);
 void CleanupGeometry();
 
 } // namespace ibl
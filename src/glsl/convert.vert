@@ -1,5 +1,15 @@
 layout(location = 0) in vec3 Position;
 
+#ifdef CUBE_ARRAY
+// Faces are projected by layered.geom, one instance per cube of the array
+out vec3 VertexPos;
+flat out int VertexCube;
+
+void main() {
+    VertexPos = Position;
+    VertexCube = gl_InstanceID;
+}
+#else
 out vec3 WorldPos;
 
 layout(location = 0) uniform mat4 Projection;
@@ -9,4 +19,5 @@ layout(location = 2) uniform mat4 Model;
 void main() {
     WorldPos = Position;
     gl_Position = Projection * View * Model * vec4(WorldPos, 1.0);
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
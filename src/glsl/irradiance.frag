@@ -1,52 +1,24 @@
 #include <common.frag>
+#include <samples.frag>
 
-layout(location = 0) out vec4 FragColor;
-in vec3 WorldPos;
-
-layout(location = 3) uniform samplerCube EnvMap;
-layout(location = 4) uniform int NumSamples;
-
-const float CosHemisPdf = 1.0 / PI;  // CosTheta cancels with the one in the sum
-
-vec3 EnvironmentIrradiance(vec3 N) {
-    vec3 E_d = vec3(0.0);
+#if defined(ENV_IMPORTANCE) || defined(SUN_LIGHT)
+// Cosine weighted hemisphere, every sample has unit weight
+float LobePdf(vec3 N, vec3 L) {
+    return max(dot(N, L), 0.0) / PI;
+}
 
-#ifdef PREFILTERED_IS
-    // Pre-filtered importance sampling constants
-    ivec2 CubeSize = textureSize(EnvMap, 0);
-    float CubeSize2 = CubeSize.x * CubeSize.x;
-    float Omega_p = 4.0 * PI / (6.0 * CubeSize2);
-    float K = 4.0;
+float LobeWeight(vec3 N, vec3 L) {
+    return dot(N, L) > 0.0 ? 1.0 : 0.0;
+}
 #endif
 
-    for (int i = 0; i < NumSamples; ++i) {
-        vec2 Xi = Hammersley(i, NumSamples);
-        vec3 Wi = SampleCosWeightedHemis(Xi, N);
-
-        float NdotWi = clamp(dot(N, Wi), 0.0, 1.0);
+layout(location = 0) out vec4 FragColor;
+in vec3 WorldPos;
 
-        if (NdotWi > 0) {
-#ifdef PREFILTERED_IS
-            float Pdf = NdotWi / PI; // Use pdf of IS we're performing
-            float Omega_s = 1.0 / (float(NumSamples) * Pdf);
-            float MipLevel = 0.5 * log2(K * Omega_s / Omega_p);
-#else
-            float MipLevel = 0;
-#endif
-            vec3 Lenv = textureLod(EnvMap, Wi, MipLevel).rgb;
-            E_d += Lenv;
-        }
-    }
-
-#ifdef DIVIDED_PI
-    return E_d / NumSamples;  // PI and CosHemisPdf cancel out
-#else
-    return E_d / (CosHemisPdf * NumSamples);
-#endif
-}
+layout(location = 3) uniform EnvSampler EnvMap;
 
 void main() {
     vec3 Normal = normalize(WorldPos);
 
-    FragColor = vec4(EnvironmentIrradiance(Normal), 1.0);
-}
\ No newline at end of file
+    FragColor = ConvolutionOutput(ConvolveEnvironment(EnvMap, Normal));
+}
@@ -0,0 +1,158 @@
+// Convolution samples precomputed on the CPU (see sampling.h). Directions are in
+// tangent space, the result is Scale * sum(Weight * L(Dir, Lod)).
+struct LobeSample {
+    vec4 DirLod;
+    float Weight;
+    float Pdf;
+};
+
+layout(std430, binding = 0) readonly buffer SampleTable {
+    LobeSample Samples[];
+};
+
+#ifdef CUBE_ARRAY
+// Cube of the array being convolved (see layered.geom)
+flat in int Cube;
+
+#define EnvSampler samplerCubeArray
+#define EnvLookup(Map, Dir, Lod) textureLod(Map, vec4(Dir, Cube), Lod)
+#else
+#define EnvSampler samplerCube
+#define EnvLookup(Map, Dir, Lod) textureLod(Map, Dir, Lod)
+#endif
+
+layout(location = 4) uniform int NumSamples;
+layout(location = 5) uniform float Scale;
+layout(location = 6) uniform int FirstSample; // Batch being accumulated
+
+#ifdef ENV_IMPORTANCE
+// Environment samples drawn by luminance, in world space. Both strategies are combined
+// with the balance heuristic, which needs the pdf of the lobe samples for any
+// direction (LobePdf) and their weight (LobeWeight), defined by the including shader.
+struct EnvSample {
+    vec4 DirLod;
+    float Pdf;
+};
+
+layout(std430, binding = 1) readonly buffer EnvSampleTable {
+    EnvSample EnvSamples[];
+};
+
+layout(location = 8) uniform samplerCube EnvPdf;
+layout(location = 9) uniform int FirstEnvSample;
+layout(location = 10) uniform int NumEnvSamples;
+layout(location = 11) uniform float LobeCount; // Lobe samples drawn
+layout(location = 12) uniform float EnvCount;  // Environment samples drawn, 0 disables
+#endif
+
+#if defined(ENV_IMPORTANCE) || defined(SUN_LIGHT)
+float LobePdf(vec3 N, vec3 L);
+float LobeWeight(vec3 N, vec3 L);
+#endif
+
+// Tangent frame around N, matches TangentToWorld
+mat3 TangentFrame(vec3 N) {
+    vec3 Up = abs(N.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 Tan = normalize(cross(Up, N));
+    vec3 Bitan = cross(N, Tan);
+
+    return mat3(Tan, Bitan, N);
+}
+
+#ifdef BLUE_NOISE_ROTATION
+layout(location = 7) uniform sampler2D BlueNoise;
+
+// Per texel Cranley-Patterson rotation of the azimuth from a blue noise mask. Weights
+// and mip levels only depend on the polar angle, so the table stays valid.
+mat3 RotateAzimuth(mat3 Frame) {
+    ivec2 Size = textureSize(BlueNoise, 0);
+    float Phi = 2.0 * PI * texelFetch(BlueNoise, ivec2(gl_FragCoord.xy) % Size, 0).r;
+    float c = cos(Phi), s = sin(Phi);
+
+    return mat3(c * Frame[0] + s * Frame[1], c * Frame[1] - s * Frame[0], Frame[2]);
+}
+#endif
+
+#ifdef SUN_LIGHT
+// Sun removed from the environment (see sun.h), integrated over its disk
+layout(location = 14) uniform vec3 SunDir;
+layout(location = 15) uniform float SunRadius;
+layout(location = 16) uniform vec3 SunScale; // Sun irradiance * Scale * LobeCount
+
+const int SunSamples = 64;
+
+vec3 SunLight(vec3 N) {
+    if (SunScale == vec3(0.0))
+        return vec3(0.0);
+
+    mat3 Frame = TangentFrame(SunDir);
+
+    // Scale * LobeWeight * LobePdf is the integrand, averaged over a Fibonacci
+    // spiral covering the disk uniformly
+    float Sum = 0.0;
+    for (int k = 0; k < SunSamples; ++k) {
+        float r = tan(SunRadius) * sqrt((k + 0.5) / SunSamples);
+        float Phi = k * 2.39996323;
+        vec3 L = normalize(Frame * vec3(r * cos(Phi), r * sin(Phi), 1.0));
+
+        Sum += LobeWeight(N, L) * LobePdf(N, L);
+    }
+
+    return SunScale * Sum / SunSamples;
+}
+#endif
+
+vec3 ConvolveEnvironment(EnvSampler EnvMap, vec3 N) {
+    mat3 Frame = TangentFrame(N);
+#ifdef BLUE_NOISE_ROTATION
+    Frame = RotateAzimuth(Frame);
+#endif
+
+    vec3 Lsum = vec3(0.0);
+    for (int i = FirstSample; i < FirstSample + NumSamples; ++i) {
+        vec4 DirLod = Samples[i].DirLod;
+        vec3 Wi = Frame * DirLod.xyz;
+
+        float Weight = Samples[i].Weight;
+#ifdef ENV_IMPORTANCE
+        float LobeP = LobeCount * Samples[i].Pdf;
+        Weight *= LobeP / (LobeP + EnvCount * texture(EnvPdf, Wi).r);
+#endif
+
+        Lsum += Weight * EnvLookup(EnvMap, Wi, DirLod.w).rgb;
+    }
+
+#ifdef ENV_IMPORTANCE
+    // Scale * LobeWeight is the integrand over LobeCount * LobePdf, so the balance
+    // heuristic weight takes the same form as for lobe samples
+    for (int i = FirstEnvSample; i < FirstEnvSample + NumEnvSamples; ++i) {
+        vec4 DirLod = EnvSamples[i].DirLod;
+
+        float LobeP = LobeCount * LobePdf(N, DirLod.xyz);
+        if (LobeP <= 0.0)
+            continue;
+
+        float Weight =
+            LobeWeight(N, DirLod.xyz) * LobeP / (LobeP + EnvCount * EnvSamples[i].Pdf);
+
+        Lsum += Weight * EnvLookup(EnvMap, DirLod.xyz, DirLod.w).rgb;
+    }
+#endif
+
+    vec3 Result = Scale * Lsum;
+#ifdef SUN_LIGHT
+    Result += SunLight(N);
+#endif
+
+    return Result;
+}
+
+// Batch statistics output luminance and its square, for convergence estimation
+vec4 ConvolutionOutput(vec3 Result) {
+#ifdef BATCH_STATS
+    float Y = dot(Result, vec3(0.2126, 0.7152, 0.0722));
+    return vec4(Y, Y * Y, 0.0, 1.0);
+#else
+    return vec4(Result, 1.0);
+#endif
+}
@@ -1,59 +1,31 @@
 #include <common.frag>
+#include <samples.frag>
 
-in vec3 WorldPos;
-layout(location = 0) out vec4 FragColor;
+#if defined(ENV_IMPORTANCE) || defined(SUN_LIGHT)
+layout(location = 13) uniform float Roughness;
 
-layout(location = 3) uniform samplerCube EnvMap;
-layout(location = 4) uniform int NumSamples;
-layout(location = 5) uniform float Roughness;
+// GGX lobe with V = N, L has pdf D / 4 and weight G * NdotL
+float LobePdf(vec3 N, vec3 L) {
+    if (dot(N, L) <= 0.0)
+        return 0.0;
 
-vec3 EnvSpecularConvolution(vec3 N) {
-    vec3 V = N; // Simplification
-
-    vec3 Lsum = vec3(0.0);
-    float Weight = 0.0;
+    return DistGGX(N, normalize(N + L), Roughness) / 4.0;
+}
 
-#ifdef PREFILTERED_IS
-    // Pre-filtered importance sampling constants
-    ivec2 CubeSize = textureSize(EnvMap, 0);
-    float CubeSize2 = CubeSize.x * CubeSize.x;
-    float Omega_p = 4.0 * PI / (6.0 * CubeSize2);
-    float K = 4.0;
+float LobeWeight(vec3 N, vec3 L) {
+    float NdotL = max(dot(N, L), 0.0);
+    return GeoSmith(1.0, NdotL, Roughness) * NdotL;
+}
 #endif
 
-    for (int i = 0; i < NumSamples; ++i) {
-        vec2 Xi = Hammersley(i, NumSamples);
-        vec3 H = SampleGGX(Xi, N, Roughness);
-        vec3 L = normalize(2.0 * dot(V, H) * H - V);
-
-        float NdotL = clamp(dot(N, L), 0.0, 1.0);
-        float NdotV = 1.0;  // N = V assumption
-
-        if (NdotL > 0.0) {
-            float G = GeoSmith(NdotV, NdotL, Roughness);
-
-#ifdef PREFILTERED_IS
-            float NdotH = clamp(dot(N, H), 0.0, 1.0);
-            float VdotH = clamp(dot(H, V), 0.0, 1.0);
-
-            // Pre-filtered importance sampling
-            float Pdf = DistGGX(N, H, Roughness) * NdotH / (4.0 * VdotH);
-            float Omega_s = 1.0 / (float(NumSamples) * Pdf);
-            float MipLevel = Roughness == 0.0 ? 0.0 : 0.5 * log2(K * Omega_s / Omega_p);
-#else
-            float MipLevel = 0.0;
-#endif
-            vec3 Lenv = textureLod(EnvMap, L, MipLevel).rgb;
-            Lsum += Lenv * G * NdotL;
-            Weight += NdotL;
-        }
-    }
+in vec3 WorldPos;
+layout(location = 0) out vec4 FragColor;
 
-    return Lsum / Weight;
-}
+layout(location = 3) uniform EnvSampler EnvMap;
 
 void main() {
     vec3 Normal = normalize(WorldPos);
 
-    FragColor = vec4(EnvSpecularConvolution(Normal), 1.0);
-}
\ No newline at end of file
+    // V = N simplification, the lobe only depends on the normal
+    FragColor = ConvolutionOutput(ConvolveEnvironment(EnvMap, Normal));
+}
@@ -9,7 +9,25 @@
 #include <geometry.h>
 #include <texture.h>
 #include <framebuffer.h>
+#include <buffer.h>
+#include <sampling.h>
 #include <cubemap.h>
+#include <astc.h>
+#include <parallel.h>
+#include <sun.h>
+#include <quadrature.h>
+#include <kernelcache.h>
+#include <projection.h>
+#include <profiler.h>
+#include <memtracker.h>
+#include <checkpoint.h>
+#include <mappedfile.h>
+
+#include <chrono>
+#include <fstream>
+#include <optional>
+
+#include <zlib.h>
 
 #include <glm/glm.hpp>
 #include <glm/matrix.hpp>
@@ -31,11 +49,52 @@ enum UniformLocs {
     Model = 2,
     EnvMap = 3,
     NumSamples = 4,
-    Roughness = 5,
+    Scale = 5,
+    FirstSample = 6,
+    BlueNoise = 7,
+    EnvPdf = 8,
+    FirstEnvSample = 9,
+    NumEnvSamples = 10,
+    LobeCount = 11,
+    EnvCount = 12,
+    Roughness = 13,
+    SunDir = 14,
+    SunRadius = 15,
+    SunScale = 16,
+    FaceViews = 17,
 };
 
+// Shader storage bindings of the convolution sample tables
+constexpr unsigned int SampleTableBinding = 0;
+constexpr unsigned int EnvSampleBinding = 1;
+
+// Texture unit and size of the blue noise mask rotating samples per texel
+constexpr unsigned int BlueNoiseUnit = 1;
+constexpr int BlueNoiseSize = 64;
+
+// Texture unit of the environment pdf, and largest environment level it is built from
+constexpr unsigned int EnvPdfUnit = 2;
+constexpr int EnvSamplingSize = 256;
+
 GLFWwindow* window;
 
+using Clock = std::chrono::steady_clock;
+
+// End of the time budget for progressive convolutions, if any
+std::optional<Clock::time_point> Deadline;
+
+// Checkpoint of the running job, and the face levels finished since it was last saved.
+// Finished faces stay in the checkpoint file, state only indexes them.
+struct Progress {
+    fs::path file;
+    Clock::duration interval;
+    Clock::time_point saved;
+    Checkpoint state;
+    std::vector<std::pair<int, int>> unsaved;
+};
+
+std::optional<Progress> JobProgress;
+
 glm::mat4 ScaleAndRotateY(const glm::vec3& scale, float degs) {
     auto I = glm::identity<glm::mat4>();
     return glm::scale(I, scale) * glm::rotate(I, glm::radians(degs), {0, 1, 0});
@@ -55,12 +114,18 @@ std::vector<std::string> GetShaderDefines(const CliOptions& opts) {
         break;
 
     case Irradiance:
-        if (opts.divideLambertConstant)
-            defines.emplace_back("DIVIDED_PI");
-        [[fallthrough]];
     case Specular:
-        if (opts.usePrefilteredIS)
-            defines.emplace_back("PREFILTERED_IS");
+        if (opts.blueNoise)
+            defines.emplace_back("BLUE_NOISE_ROTATION");
+
+        if (opts.envSamples > 0)
+            defines.emplace_back("ENV_IMPORTANCE");
+
+        if (opts.extractSun)
+            defines.emplace_back("SUN_LIGHT");
+
+        if (opts.probeArray)
+            defines.emplace_back("CUBE_ARRAY");
         break;
 
     default:
@@ -70,152 +135,947 @@ std::vector<std::string> GetShaderDefines(const CliOptions& opts) {
     return defines;
 }
 
-std::unique_ptr<Texture> SphericalProjToCubemap(const std::string& filePath, int cubeSize,
-                                                float degs = 0.0f,
-                                                bool swapHand = false) {
+std::unique_ptr<CubeImage> EquirectToCubemap(const std::string& filePath, int cubeSize) {
     Print("Converting spherical projection [to {}px cube]", cubeSize);
 
-    auto shaders = std::array{"convert.vert"s, "convert.frag"s};
-    auto program = CompileAndLinkProgram("convert", shaders);
+    // Intermediate '.img' files are resampled straight from their mapping
+    if (fs::path(filePath).extension() == ".img") {
+        auto mapped = [&] {
+            ScopedTimer timer{Stage::Load, "map " + filePath};
+            return util::MapImage(filePath);
+        }();
+
+        ScopedTimer timer{Stage::Convert, "equirect to cube"};
+        return EquirectToCube(mapped->view(), cubeSize);
+    }
+
+    auto img = [&] {
+        ScopedTimer timer{Stage::Load, "load " + filePath};
+        return util::LoadImage(filePath);
+    }();
+
+    ScopedTimer timer{Stage::Convert, "equirect to cube"};
+    return EquirectToCube(*img, cubeSize);
+}
+
+void ExportResult(const CliOptions& opts, CubeImage& cube) {
+    ScopedTimer timer{Stage::Save, "save " + opts.outFile};
+
+    if (opts.exportAstc)
+        ExportAstcCubemap(opts.outFile, cube, opts.astc);
+    else
+        ExportCubemap(opts.outFile, opts.exportType, cube, opts.exportOpts);
+}
+
+auto LoadEnvironment(const CliOptions& opts, ImageFormat* reqFmt = nullptr) {
+    if (opts.isInputEquirect)
+        return std::make_unique<Texture>(*EquirectToCubemap(opts.inFile, opts.texSize));
+
+    // Upload straight from the mapped file, skipping the intermediate CubeImage
+    if (opts.importType == CubeLayoutType::Custom && !reqFmt) {
+        auto file = [&] {
+            ScopedTimer timer{Stage::Load, "map " + opts.inFile};
+            return std::make_unique<CubeFile>(opts.inFile);
+        }();
+        return std::make_unique<Texture>(*file);
+    }
+
+    auto cube = [&] {
+        ScopedTimer timer{Stage::Load, "load " + opts.inFile};
+        return ImportCubeMap(opts.inFile, opts.importType, reqFmt);
+    }();
+    return std::make_unique<Texture>(*cube);
+}
+
+void ComputeBRDF(const CliOptions& opts) {
+    Print("Computing BRDF to {0} 2-channel {1}x{1} float texture at {2} spp",
+          opts.useHalf ? "16 bit" : "32 bit", opts.texSize, opts.numSamples);
 
-    auto img = util::LoadImage(filePath);
-    auto imgFmt = img->format();
-    if ((imgFmt.width / 2) != imgFmt.height)
-        FATAL("Input is not an equirectangular mapping.");
+    auto defines = GetShaderDefines(opts);
+    auto shaders = std::array{"brdf.vert"s, "brdf.frag"s};
+    auto program = CompileAndLinkProgram("brdf", shaders, defines);
 
-    Texture rectMap{GL_TEXTURE_2D, GL_RGB32F, imgFmt.width, imgFmt.height, 1};
-    rectMap.upload(*img);
+    GLenum intFormat = opts.useHalf ? GL_RG16F : GL_RG32F;
+    Texture brdfLUT{GL_TEXTURE_2D, intFormat, opts.texSize};
 
     Framebuffer fb{};
-    fb.addDepthBuffer(cubeSize, cubeSize);
+    fb.addDepthBuffer(brdfLUT.width, brdfLUT.height);
+    fb.addTextureBuffer(GL_COLOR_ATTACHMENT0, brdfLUT);
     fb.bind();
 
-    auto cubemap = std::make_unique<Texture>(GL_TEXTURE_CUBE_MAP, GL_RGB32F, cubeSize,
-                                             MaxMipLevel(cubeSize));
-    cubemap->setParam(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glViewport(0, 0, brdfLUT.width, brdfLUT.height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glUseProgram(program->id());
+    glUniform1i(1, opts.numSamples);
+
+    {
+        ScopedGpuTimer timer{Stage::Draw, "brdf"};
+        RenderQuad();
+    }
+
+    auto image = brdfLUT.image();
+
+    ScopedTimer timer{Stage::Save, "save " + opts.outFile};
+    SaveImage(opts.outFile, *image);
+}
+
+// Environment for the CPU paths
+std::unique_ptr<CubeImage> LoadEnvironmentCube(const CliOptions& opts) {
+    if (opts.isInputEquirect)
+        return EquirectToCubemap(opts.inFile, opts.texSize);
+
+    ScopedTimer timer{Stage::Load, "load " + opts.inFile};
+    return ImportCubeMap(opts.inFile, opts.importType, nullptr);
+}
+
+void ConvertToCubemap(const CliOptions& opts) {
+    auto cube = LoadEnvironmentCube(opts);
+
+    if (!opts.exportAstc)
+        Print("Converting cubemap to '{}'", LayoutNames.at(opts.exportType));
+
+    ExportResult(opts, *cube);
+}
+
+// Programs evaluating a convolution. The stats variant accumulates the luminance of
+// each batch estimate and its square, used to measure convergence in adaptive mode.
+struct ConvolutionPrograms {
+    std::string name;
+    std::unique_ptr<Program> main;
+    std::unique_ptr<Program> stats;
+    std::unique_ptr<Texture> blueNoise;
+    bool envImportance = false;
+    bool sunLight = false;
+};
+
+ConvolutionPrograms CompileConvolution(const CliOptions& opts, const std::string& name) {
+    auto defines = GetShaderDefines(opts);
+    auto shaders = std::vector{"convert.vert"s, name + ".frag"};
+    if (opts.probeArray)
+        shaders.insert(shaders.begin() + 1, "layered.geom");
+
+    ConvolutionPrograms programs;
+    programs.name = name;
+    programs.main = CompileAndLinkProgram(name, shaders, defines);
+    programs.envImportance = opts.envSamples > 0;
+    programs.sunLight = opts.extractSun;
+
+    if (opts.adaptiveError > 0.0f) {
+        defines.emplace_back("BATCH_STATS");
+        programs.stats = CompileAndLinkProgram(name + "_stats", shaders, defines);
+    }
+
+    if (opts.blueNoise) {
+        auto mask = BlueNoiseMask(BlueNoiseSize);
+        ImageFormat maskFmt{PixelFormat::F32, BlueNoiseSize, BlueNoiseSize, 1};
+
+        programs.blueNoise = std::make_unique<Texture>(GL_TEXTURE_2D, GL_R32F,
+                                                       BlueNoiseSize, BlueNoiseSize, 1);
+        programs.blueNoise->upload(ImageView{maskFmt,
+                                             reinterpret_cast<std::byte*>(mask.data())});
+
+        glActiveTexture(GL_TEXTURE0 + BlueNoiseUnit);
+        programs.blueNoise->bind();
+    }
 
     auto projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 5.0f);
-    auto modelMatrix = ScaleAndRotateY({1, 1, swapHand ? -1 : 1}, degs);
+    auto modelMatrix = ScaleAndRotateY({1, 1, 1}, 0);
 
-    glUseProgram(program->id());
-    glUniformMatrix4fv(Projection, 1, GL_FALSE, glm::value_ptr(projection));
-    glUniformMatrix4fv(Model, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-    glUniform1i(EnvMap, 0);
+    for (const auto* program : {programs.main.get(), programs.stats.get()}) {
+        if (!program)
+            continue;
+
+        glProgramUniform1i(program->id(), EnvMap, 0);
+        if (opts.blueNoise)
+            glProgramUniform1i(program->id(), BlueNoise, BlueNoiseUnit);
+        if (programs.envImportance)
+            glProgramUniform1i(program->id(), EnvPdf, EnvPdfUnit);
+        glProgramUniformMatrix4fv(program->id(), Projection, 1, GL_FALSE,
+                                  glm::value_ptr(projection));
+        glProgramUniformMatrix4fv(program->id(), Model, 1, GL_FALSE,
+                                  glm::value_ptr(modelMatrix));
+        if (opts.probeArray)
+            glProgramUniformMatrix4fv(program->id(), FaceViews, 6, GL_FALSE,
+                                      glm::value_ptr(CubeMapViews[0]));
+    }
+
+    glUseProgram(programs.main->id());
+
+    return programs;
+}
+
+// Luminance importance sampling of the environment. Its samples are shared by every
+// texel and level, only their batching changes.
+struct EnvImportance {
+    std::vector<EnvSample> samples;
+    Buffer buffer;
+    std::unique_ptr<Texture> pdf;
+};
 
+std::unique_ptr<EnvImportance> BuildEnvImportance(const CliOptions& opts,
+                                                  const Texture& envMap) {
+    if (opts.envSamples == 0)
+        return nullptr;
+
+    int lvl = 0;
+    while (ResizeLvl(envMap.width, lvl) > EnvSamplingSize)
+        ++lvl;
+
+    auto envCube = envMap.cubemap(lvl);
+
+    ScopedTimer timer{Stage::Compute, "environment distribution"};
+    EnvDistribution dist{*envCube};
+    if (dist.empty()) {
+        Print("Environment is black, skipping environment importance sampling");
+        return nullptr;
+    }
+
+    Print("Environment importance sampling [{} samples, {}px distribution]",
+          opts.envSamples, dist.size());
+
+    auto env = std::make_unique<EnvImportance>();
+    env->samples = dist.samples(
+        {opts.envSamples, envMap.width, opts.usePrefilteredIS, opts.sequence});
+    env->buffer.upload(std::span<const EnvSample>{env->samples});
+
+    env->pdf = std::make_unique<Texture>(GL_TEXTURE_CUBE_MAP, GL_R32F, dist.size());
+    env->pdf->upload(dist.pdfCube());
+    env->pdf->setParam(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    env->pdf->setParam(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glActiveTexture(GL_TEXTURE0 + EnvPdfUnit);
+    env->pdf->bind();
     glActiveTexture(GL_TEXTURE0);
-    rectMap.bind();
 
-    glViewport(0, 0, cubeSize, cubeSize);
+    return env;
+}
+
+void SetSampleRange(const Program& program, SampleRange range, float scale) {
+    glProgramUniform1i(program.id(), FirstSample, range.first);
+    glProgramUniform1i(program.id(), NumSamples, range.count);
+    glProgramUniform1f(program.id(), Scale, scale);
+}
+
+// Environment samples taken along with the lobe samples, none without env
+void SetEnvSampleRange(const ConvolutionPrograms& programs, const EnvImportance* env,
+                       SampleRange range, unsigned int lobeCount) {
+    if (!programs.envImportance)
+        return;
+
+    const float envCount = env ? env->samples.size() : 0.0f;
+    if (!env)
+        range = {0, 0};
+
+    for (const auto* program : {programs.main.get(), programs.stats.get()}) {
+        if (!program)
+            continue;
+
+        glProgramUniform1i(program->id(), FirstEnvSample, range.first);
+        glProgramUniform1i(program->id(), NumEnvSamples, range.count);
+        glProgramUniform1f(program->id(), LobeCount, lobeCount);
+        glProgramUniform1f(program->id(), EnvCount, envCount);
+    }
+}
+
+// Sun term of program, lobeScale is the table scale times the samples drawn. Without a
+// sun the term is zero.
+void SetSunLight(const ConvolutionPrograms& programs, const Program& program,
+                 const Sun* sun, float lobeScale) {
+    if (!programs.sunLight)
+        return;
+
+    std::array<float, 3> scale{};
+    if (sun) {
+        for (int c = 0; c < 3; ++c)
+            scale[c] = sun->irradiance[c] * lobeScale;
+
+        glProgramUniform3fv(program.id(), SunDir, 1, sun->dir.data());
+        glProgramUniform1f(program.id(), SunRadius, sun->angularRadius);
+    }
+
+    glProgramUniform3fv(program.id(), SunScale, 1, scale.data());
+}
+
+// Removes the sun from level 0 of the environment when asked and exports it. The
+// residual environment is null when there is no sun.
+struct SunExtraction {
+    std::optional<Sun> sun;
+    std::unique_ptr<Texture> residual;
+
+    const Sun* light() const { return sun ? &*sun : nullptr; }
+};
+
+SunExtraction ExtractSunLight(const CliOptions& opts, const Texture& envMap) {
+    if (!opts.extractSun)
+        return {};
+
+    auto cube = envMap.cubemap(0);
+
+    SunExtraction result;
+    {
+        ScopedTimer timer{Stage::Compute, "sun extraction"};
+        result.sun = ExtractSun(*cube, opts.sunThreshold);
+    }
+    if (!result.sun) {
+        Print("No sun above {} times the median luminance, convolving the whole "
+              "environment",
+              opts.sunThreshold);
+        return {};
+    }
+
+    const auto& sun = *result.sun;
+    Print("Sun at [{:.3f}, {:.3f}, {:.3f}], radius {:.2f} deg, irradiance [{:.1f}, "
+          "{:.1f}, {:.1f}]",
+          sun.dir[0], sun.dir[1], sun.dir[2], sun.angularRadius * 180.0f / 3.14159265f,
+          sun.irradiance[0], sun.irradiance[1], sun.irradiance[2]);
+
+    auto sunPath = fs::path{opts.outFile};
+    sunPath.replace_filename(sunPath.stem().string() + "_sun.json");
+    ExportSun(sunPath, sun);
+
+    result.residual = std::make_unique<Texture>(*cube);
+    result.residual->setParam(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    result.residual->generateMipmaps();
+
+    return result;
+}
+
+// Multiplies a level of every face of target by a constant. A cube map array is scaled
+// in one layered draw, which needs programs compiled for arrays.
+void ScaleLevel(const ConvolutionPrograms& programs, Framebuffer& fb,
+                const Texture& target, int mip, float factor) {
+    const bool array = target.textureTarget() == GL_TEXTURE_CUBE_MAP_ARRAY;
+    const int size = ResizeLvl(target.width, mip);
+    glViewport(0, 0, size, size);
+
+    // With no samples the shader outputs zero, so blending only scales the target
+    SetSampleRange(*programs.main, {0, 0}, 1.0f);
+    SetEnvSampleRange(programs, nullptr, {}, 0);
+    SetSunLight(programs, *programs.main, nullptr, 0.0f);
+
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ZERO, GL_CONSTANT_COLOR);
+    glBlendColor(factor, factor, factor, factor);
+
+    ScopedGpuTimer timer{Stage::Draw, std::format("scale level {}", mip)};
+    if (array) {
+        fb.addTextureBuffer(GL_COLOR_ATTACHMENT0, target, mip);
+        RenderCube(target.layers);
+        glDisable(GL_BLEND);
+        return;
+    }
+
     for (int face = 0; face < 6; ++face) {
         glUniformMatrix4fv(View, 1, GL_FALSE, glm::value_ptr(CubeMapViews[face]));
-        fb.addTextureLayer(GL_COLOR_ATTACHMENT0, *cubemap, face);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
+        fb.addTextureLayer(GL_COLOR_ATTACHMENT0, target, face, mip);
         RenderCube();
     }
 
-    return cubemap;
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
 }
 
-auto LoadEnvironment(const CliOptions& opts, ImageFormat* reqFmt = nullptr) {
-    if (opts.isInputEquirect)
-        return SphericalProjToCubemap(opts.inFile, opts.texSize);
+bool IsProgressive(const CliOptions& opts) {
+    return opts.batchSize > 0 || opts.tileSize > 0 || opts.adaptiveError > 0.0f;
+}
 
-    auto cube = ImportCubeMap(opts.inFile, opts.importType, reqFmt);
-    return std::make_unique<Texture>(*cube);
+// Texel region of a face level
+struct Region {
+    int x, y, width, height;
+};
+
+// Side of the tiles a sharded job is split in, unless --tile sets it
+constexpr int ShardTileSize = 256;
+
+// Regions of a face level to render. Sharded jobs split every face level in tiles,
+// numbered level, face and tile major, and shard i of N owns tiles i, i + N, i + 2N...
+// Otherwise --tile splits the face, or it's rendered whole.
+std::vector<Region> FaceTiles(const CliOptions& opts, int mip, int face) {
+    const int size = ResizeLvl(opts.texSize, mip);
+    const int tileSize = opts.tileSize > 0 ? opts.tileSize
+                         : opts.shardCount > 0 ? ShardTileSize
+                                               : size;
+
+    auto TilesPerFace = [&](int lvl) {
+        const int lvlSize = ResizeLvl(opts.texSize, lvl);
+        const int tile = std::min(tileSize, lvlSize);
+        const int perRow = (lvlSize + tile - 1) / tile;
+        return static_cast<std::size_t>(perRow) * perRow;
+    };
+
+    const auto count = static_cast<std::size_t>(opts.shardCount);
+    const auto index = static_cast<std::size_t>(opts.shardIndex);
+
+    std::size_t item = face * TilesPerFace(mip);
+    for (int lvl = 0; lvl < mip; ++lvl)
+        item += 6 * TilesPerFace(lvl);
+
+    const int tile = std::min(tileSize, size);
+    std::vector<Region> tiles;
+
+    for (int y = 0; y < size; y += tile) {
+        for (int x = 0; x < size; x += tile, ++item) {
+            if (count > 0 && item % count != index)
+                continue;
+
+            tiles.push_back({x, y, std::min(tile, size - x), std::min(tile, size - y)});
+        }
+    }
+
+    return tiles;
 }
 
-void InitOpenGL() {
-    if (!glfwInit())
-        FATAL("Couldn't initialize OpenGL context.");
+// Batches needed before trusting the convergence estimate
+constexpr std::size_t MinAdaptiveBatches = 4;
+
+// Side of the cube the convergence statistics are evaluated at
+constexpr int StatsSize = 32;
+
+// Options the convolution result depends on, the input aside
+std::string SettingsKey(const CliOptions& opts) {
+    const bool specular = opts.mode == Mode::Specular;
+    return std::format(
+        "{} (type {}) size {} levels {} spp {} prefiltered {} sequence {} "
+        "blue noise {} env samples {} sun {} threshold {} batch {} tile {} "
+        "adaptive {} half {} filter {} error {} div pi {}",
+        specular ? "specular" : "irradiance",
+        opts.isInputEquirect ? -1 : static_cast<int>(opts.importType), opts.texSize,
+        specular ? opts.mipLevels : 1, opts.numSamples, opts.usePrefilteredIS,
+        static_cast<int>(opts.sequence), opts.blueNoise, opts.envSamples, opts.extractSun,
+        opts.sunThreshold, opts.batchSize, opts.tileSize, opts.adaptiveError,
+        opts.useHalf, static_cast<int>(opts.filter), opts.cascadeError,
+        !specular && opts.divideLambertConstant);
+}
 
-    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-    window = glfwCreateWindow(1, 1, "iblenv", NULL, NULL);
-    if (!window) {
-        glfwTerminate();
-        FATAL("Couldn't create GLFW window.");
+// A checkpoint only resumes the same job
+std::string JobKey(const CliOptions& opts) {
+    return std::format("{} of {} shard {}/{}", SettingsKey(opts), opts.inFile,
+                       opts.shardIndex, opts.shardCount);
+}
+
+// CRC-32 of the input files, six of them for separate faces
+std::uint32_t InputChecksum(const CliOptions& opts) {
+    std::vector<fs::path> files{opts.inFile};
+    if (!opts.isInputEquirect && opts.importType == CubeLayoutType::Separate) {
+        const auto& [parent, fname, ext] = SplitFilePath(opts.inFile);
+        files.clear();
+        for (int face = 0; face < 6; ++face)
+            files.push_back(parent /
+                            std::format("{}_{}{}", fname, FaceNames.at(face), ext));
     }
-    glfwMakeContextCurrent(window);
 
-    int glver = gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
-    if (glver == 0)
-        FATAL("Failed to initialize OpenGL loader");
+    ScopedTimer timer{Stage::Load, "checksum " + opts.inFile};
+    auto crc = crc32_z(0L, Z_NULL, 0);
+    for (const auto& filePath : files) {
+        const MappedFile file{filePath};
+        crc = crc32_z(crc, reinterpret_cast<const Bytef*>(file.data()), file.size());
+    }
 
-#ifdef DEBUG
-    glEnable(GL_DEBUG_OUTPUT);
-    glDebugMessageCallback(OpenGLErrorCallback, 0);
-#endif
+    return crc;
+}
 
-    // Print system info
-    auto renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
-    auto vendor = reinterpret_cast<const char*>(glGetString(GL_VENDOR));
-    auto version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
-    auto glslVer =
-        reinterpret_cast<const char*>(glGetString(GL_SHADING_LANGUAGE_VERSION));
-    Print("OpenGL Renderer: {} ({})", renderer, vendor);
-    Print("OpenGL Version: {}", version);
-    Print("GLSL Version: {}\n", glslVer);
+// Shards only merge with the other shards of their job. Unlike JobKey, the key names
+// the input by its contents, shards may run on machines that see it at other paths.
+std::string ShardKey(const CliOptions& opts) {
+    return std::format("{} of input {:08x} in {} shards", SettingsKey(opts),
+                       InputChecksum(opts), opts.shardCount);
+}
 
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+void StartProgress(const CliOptions& opts) {
+    JobProgress.reset();
+    if (opts.checkpointFile.empty())
+        return;
+
+    auto& progress = JobProgress.emplace();
+    progress.file = opts.checkpointFile;
+    progress.interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(opts.checkpointInterval));
+    progress.saved = Clock::now();
+    progress.state.job = JobKey(opts);
+
+    if (!opts.resume || !fs::exists(progress.file)) {
+        CreateCheckpoint(progress.file, progress.state.job);
+        return;
+    }
+
+    auto state = [&] {
+        ScopedTimer timer{Stage::Load, "load checkpoint"};
+        return LoadCheckpoint(progress.file);
+    }();
+
+    if (state.job != progress.state.job)
+        FATAL("Checkpoint {} was saved by another job ({}), remove it to start over",
+              opts.checkpointFile, state.job);
+
+    progress.state = std::move(state);
+    const auto& resumed = progress.state;
+    Print("Resuming from {}: {} finished face levels{}", opts.checkpointFile,
+          resumed.faces.size(),
+          resumed.level < 0 ? ""s
+                            : std::format(", level {} after {} batches", resumed.level,
+                                          resumed.batches));
+}
+
+void FinishFace(int mip, int face) {
+    if (JobProgress)
+        JobProgress->unsaved.emplace_back(mip, face);
+}
+
+// Saves the checkpoint once its interval is over. Face levels finished since the last
+// save are read back from target one at a time and appended, the partial sums of the
+// level being accumulated, if any, are read back with their statistics and replaced.
+void SaveProgress(const Texture& target, int level = -1, std::uint32_t batches = 0,
+                  const Texture* stats = nullptr) {
+    if (!JobProgress || Clock::now() - JobProgress->saved < JobProgress->interval)
+        return;
+
+    auto& state = JobProgress->state;
+    auto Face = [](const Texture& tex, int face, int lvl) {
+        const auto fmt = tex.imgFormat(lvl);
+        return tex.region(face, lvl, 0, 0, fmt.width, fmt.height);
+    };
+
+    auto& unsaved = JobProgress->unsaved;
+    ScopedTimer timer{Stage::Save, "save checkpoint"};
+
+    if (!unsaved.empty()) {
+        auto ReadFace = [&](int lvl, int face) { return Face(target, face, lvl); };
+        auto offsets = AppendCheckpointFaces(JobProgress->file, unsaved, ReadFace);
+        for (std::size_t i = 0; i < unsaved.size(); ++i)
+            state.faces[unsaved[i]] = offsets[i];
+        unsaved.clear();
+    }
+
+    state.level = level;
+    state.batches = batches;
+    for (int face = 0; face < 6 && level >= 0; ++face) {
+        state.sums.push_back(Face(target, face, level));
+        if (stats)
+            state.stats.push_back(Face(*stats, face, 0));
+    }
+
+    SaveCheckpointSums(JobProgress->file, state);
+
+    // The partial sums are soon outdated
+    state.sums.clear();
+    state.stats.clear();
+
+    JobProgress->saved = Clock::now();
+    Print("  Saved checkpoint {}", JobProgress->file.string());
+}
+
+// Uploads a face level the resumed job had finished
+bool RestoreFace(const Texture& target, int mip, int face) {
+    if (!JobProgress)
+        return false;
+
+    const auto& faces = JobProgress->state.faces;
+    auto it = faces.find({mip, face});
+    if (it == faces.end())
+        return false;
+
+    target.upload(LoadCheckpointFace(JobProgress->file, it->second), face, mip);
+    return true;
+}
+
+bool RestoreLevel(const Texture& target, int mip) {
+    for (int face = 0; face < 6; ++face)
+        if (!JobProgress || !JobProgress->state.faces.contains({mip, face}))
+            return false;
+
+    for (int face = 0; face < 6; ++face)
+        RestoreFace(target, mip, face);
+
+    Print("  Restored from checkpoint");
+    return true;
+}
+
+// Uploads the partial sums of mip the resumed job was accumulating. Returns the number
+// of batches they hold, 0 if there are none.
+std::uint32_t RestoreAccumulation(const Texture& target, const Texture* stats, int mip) {
+    if (!JobProgress || JobProgress->state.level != mip)
+        return 0;
+
+    auto& state = JobProgress->state;
+    if (state.sums.size() != 6 || (stats && state.stats.size() != 6))
+        FATAL("Checkpoint {} lacks the partial sums of level {}",
+              JobProgress->file.string(), mip);
+
+    for (int face = 0; face < 6; ++face) {
+        target.upload(state.sums[face], face, mip);
+        if (stats)
+            stats->upload(state.stats[face], face, 0);
+    }
+
+    const auto batches = state.batches;
+    state.level = -1;
+    state.sums.clear();
+    state.stats.clear();
+
+    Print("  Resuming after {} batches", batches);
+    return batches;
+}
+
+// Relative RMS error of the running mean, from per texel sums of the batch
+// estimates (r) and their squares (g)
+double BatchError(const CubeImage& stats, std::size_t numBatches) {
+    double sumVar = 0.0, sumMean = 0.0;
+    std::size_t numTexels = 0;
+
+    for (int face = 0; face < 6; ++face) {
+        auto fmt = stats[face].format();
+        const auto* px = reinterpret_cast<const float*>(stats[face].data());
+
+        for (int i = 0; i < fmt.width * fmt.height; ++i) {
+            double mean = px[2 * i] / numBatches;
+            double var = std::max(px[2 * i + 1] / numBatches - mean * mean, 0.0);
+
+            sumVar += var;
+            sumMean += mean;
+        }
+
+        numTexels += fmt.width * fmt.height;
+    }
+
+    if (sumMean <= 0.0)
+        return 0.0;
+
+    return std::sqrt(sumVar / numBatches / numTexels) / (sumMean / numTexels);
+}
+
+// Renders the convolution of the sample table into a level of every face of target.
+// Progressive mode splits the samples in batches additively blended into the target,
+// scissors faces into tiles and waits for every batch, bounding the length of each
+// submission. In adaptive mode it stops once the estimated error of the level is
+// below the requested threshold. Whenever batches are skipped, either by converging
+// or by running out of time, the partial sums are rescaled to the total weight.
+// Environment samples, if any, are split in as many batches as the lobe samples. The
+// analytic sun term is added once, after any rescaling.
+void RenderConvolution(const CliOptions& opts, const ConvolutionPrograms& programs,
+                       Framebuffer& fb, const Texture& target, int mip, SampleTable table,
+                       Buffer& samples, EnvImportance* env = nullptr,
+                       const Sun* sun = nullptr) {
+    const auto& program = *programs.main;
+    const int size = ResizeLvl(target.width, mip);
+    const float lobeScale = table.scale * table.numDrawn;
+
+    glViewport(0, 0, size, size);
+    fb.resize(size, size);
+
+    if (!IsProgressive(opts)) {
+        samples.upload(std::span<const LobeSample>{table.samples});
+        samples.bindBase(SampleTableBinding);
+        SetSampleRange(program, {0, table.samples.size()}, table.scale);
+
+        if (env)
+            env->buffer.bindBase(EnvSampleBinding);
+        SetEnvSampleRange(programs, env, {0, env ? env->samples.size() : 0},
+                          table.numDrawn);
+        SetSunLight(programs, program, sun, lobeScale);
+
+        for (int face = 0; face < 6; ++face) {
+            auto tiles = FaceTiles(opts, mip, face);
+            if (tiles.empty() || RestoreFace(target, mip, face))
+                continue;
+
+            glUniformMatrix4fv(View, 1, GL_FALSE, glm::value_ptr(CubeMapViews[face]));
+            fb.addTextureLayer(GL_COLOR_ATTACHMENT0, target, face, mip);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            ScopedGpuTimer timer{Stage::Draw, std::format("{} level {} face {}",
+                                                          programs.name, mip, face)};
+            glEnable(GL_SCISSOR_TEST);
+            for (const auto& tile : tiles) {
+                glScissor(tile.x, tile.y, tile.width, tile.height);
+                RenderCube();
+            }
+            glDisable(GL_SCISSOR_TEST);
+
+            FinishFace(mip, face);
+            SaveProgress(target);
+        }
+
+        return;
+    }
+
+    // Levels finished before the job was interrupted are final, sun included
+    if (RestoreLevel(target, mip))
+        return;
+
+    auto batchSize = opts.batchSize;
+    if (batchSize == 0 && programs.stats)
+        batchSize = std::max<std::size_t>(table.samples.size() / 32, 16);
+
+    auto batches = SplitInBatches(table, batchSize);
+    samples.upload(std::span<const LobeSample>{table.samples});
+    samples.bindBase(SampleTableBinding);
+
+    std::vector<SampleRange> envBatches(batches.size());
+    if (env) {
+        auto envSamples = env->samples;
+        envBatches = SplitInBatches(envSamples, batches.size());
+        env->buffer.upload(std::span<const EnvSample>{envSamples});
+        env->buffer.bindBase(EnvSampleBinding);
+    }
+
+    const auto totalWeight = TotalWeight(table, {0, table.samples.size()});
+
+    for (int face = 0; face < 6; ++face) {
+        fb.addTextureLayer(GL_COLOR_ATTACHMENT0, target, face, mip);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    // Low resolution targets for the convergence statistics
+    std::unique_ptr<Texture> stats;
+    std::unique_ptr<Framebuffer> statsFb;
+    const int statsSize = std::min(size, StatsSize);
+
+    if (programs.stats) {
+        stats = std::make_unique<Texture>(GL_TEXTURE_CUBE_MAP, GL_RG32F, statsSize);
+        statsFb = std::make_unique<Framebuffer>();
+        statsFb->bind();
+
+        for (int face = 0; face < 6; ++face) {
+            statsFb->addTextureLayer(GL_COLOR_ATTACHMENT0, *stats, face);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+
+        fb.bind();
+    }
+
+    // Batch estimates include the sun, the accumulation adds it at the end
+    SetSunLight(programs, program, nullptr, 0.0f);
+    if (programs.stats)
+        SetSunLight(programs, *programs.stats, sun, lobeScale);
+
+    glDisable(GL_DEPTH_TEST); // Camera is inside the cube, no overdraw
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    const auto start = Clock::now();
+    std::size_t done = std::min<std::size_t>(
+        RestoreAccumulation(target, stats.get(), mip), batches.size());
+    double error = -1.0;
+
+    for (const auto& batch : std::span{batches}.subspan(done)) {
+        SetSampleRange(program, batch, table.scale);
+        SetEnvSampleRange(programs, env, envBatches[done], table.numDrawn);
+
+        glEnable(GL_SCISSOR_TEST);
+        for (int face = 0; face < 6; ++face) {
+            glUniformMatrix4fv(View, 1, GL_FALSE, glm::value_ptr(CubeMapViews[face]));
+            fb.addTextureLayer(GL_COLOR_ATTACHMENT0, target, face, mip);
+
+            auto name = std::format("{} level {} face {} batch {}", programs.name, mip,
+                                    face, done);
+            ScopedGpuTimer timer{Stage::Draw, std::move(name)};
+            for (const auto& tile : FaceTiles(opts, mip, face)) {
+                glScissor(tile.x, tile.y, tile.width, tile.height);
+                RenderCube();
+                glFlush();
+            }
+        }
+        glDisable(GL_SCISSOR_TEST);
+
+        if (programs.stats) {
+            // Scale each batch to an estimate of the whole convolution
+            auto batchScale = totalWeight / TotalWeight(table, batch) * table.scale;
+            SetSampleRange(*programs.stats, batch, batchScale);
+
+            glUseProgram(programs.stats->id());
+            statsFb->bind();
+            glViewport(0, 0, statsSize, statsSize);
+
+            ScopedGpuTimer timer{Stage::Draw,
+                                 std::format("stats level {} batch {}", mip, done)};
+            for (int face = 0; face < 6; ++face) {
+                glUniformMatrix4fv(View, 1, GL_FALSE, glm::value_ptr(CubeMapViews[face]));
+                statsFb->addTextureLayer(GL_COLOR_ATTACHMENT0, *stats, face);
+                RenderCube();
+            }
+
+            glUseProgram(program.id());
+            fb.bind();
+            glViewport(0, 0, size, size);
+        }
+
+        glFinish();
+        ++done;
+
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        Print("  Batch {}/{} [{} samples, {:.2f}s]", done, batches.size(), batch.count,
+              elapsed.count());
+
+        if (programs.stats && done >= MinAdaptiveBatches) {
+            error = BatchError(*stats->cubemap(), done);
+            if (error < opts.adaptiveError)
+                break;
+        }
+
+        if (Deadline && Clock::now() > *Deadline) {
+            Print("  Time budget exhausted");
+            break;
+        }
+
+        SaveProgress(target, mip, done, stats.get());
+    }
+
+    const auto usedSamples =
+        done < batches.size() ? batches[done].first : table.samples.size();
+
+    if (programs.stats)
+        Print("  Used {} of {} samples, estimated relative error {:.4f}", usedSamples,
+              table.samples.size(), error);
+
+    glDisable(GL_BLEND);
     glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LEQUAL);
-    glDepthMask(GL_TRUE);
-    glDepthRange(0.0, 1.0);
-    glClearDepth(1.0);
-    glCullFace(GL_BACK);
-    glFrontFace(GL_CCW);
-    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
-    glDisable(GL_CULL_FACE); // We're rendering skybox back faces
+    if (done < batches.size()) {
+        auto rescale = totalWeight / TotalWeight(table, {0, usedSamples});
+        ScaleLevel(programs, fb, target, mip, rescale);
+    }
+
+    if (sun) {
+        SetSampleRange(program, {0, 0}, 1.0f);
+        SetEnvSampleRange(programs, nullptr, {}, 0);
+        SetSunLight(programs, program, sun, lobeScale);
+
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+
+        ScopedGpuTimer timer{Stage::Draw, std::format("sun level {}", mip)};
+        for (int face = 0; face < 6; ++face) {
+            glUniformMatrix4fv(View, 1, GL_FALSE, glm::value_ptr(CubeMapViews[face]));
+            fb.addTextureLayer(GL_COLOR_ATTACHMENT0, target, face, mip);
+            RenderCube();
+        }
+
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+    }
+
+    for (int face = 0; face < 6; ++face)
+        FinishFace(mip, face);
+    SaveProgress(target);
 }
 
-void ComputeBRDF(const CliOptions& opts) {
-    Print("Computing BRDF to {0} 2-channel {1}x{1} float texture at {2} spp",
-          opts.useHalf ? "16 bit" : "32 bit", opts.texSize, opts.numSamples);
+// Level 0 of the specular chain has roughness 0. The GGX lobe is then a delta and the
+// level is the environment itself, times the gain of the estimator for a mirror.
+// Copies the environment level matching the output size and scales it in place, for
+// every cube of an array at once. Returns false when no level matches in size and
+// format.
+bool CopyMirrorLevel(const ConvolutionPrograms& programs, Framebuffer& fb,
+                     const Texture& envMap, const Texture& target, float gain) {
+    const auto dstFmt = target.imgFormat();
+
+    for (int lvl = 0; lvl < envMap.levels; ++lvl) {
+        auto srcFmt = envMap.imgFormat(lvl);
+        if (srcFmt.width != dstFmt.width)
+            continue;
+
+        if (srcFmt.pFmt != dstFmt.pFmt || srcFmt.nChannels != dstFmt.nChannels)
+            return false;
+
+        {
+            ScopedGpuTimer timer{Stage::Draw, "copy mirror level"};
+            glCopyImageSubData(envMap.handle, envMap.textureTarget(), lvl, 0, 0, 0,
+                               target.handle, target.textureTarget(), 0, 0, 0, 0,
+                               dstFmt.width, dstFmt.height, 6 * target.layers);
+        }
 
-    auto defines = GetShaderDefines(opts);
-    auto shaders = std::array{"brdf.vert"s, "brdf.frag"s};
-    auto program = CompileAndLinkProgram("brdf", shaders, defines);
+        ScaleLevel(programs, fb, target, 0, gain);
 
-    GLenum intFormat = opts.useHalf ? GL_RG16F : GL_RG32F;
-    Texture brdfLUT{GL_TEXTURE_2D, intFormat, opts.texSize};
+        Print("Level 0 [roughness 0.000]: copied from environment level {}", lvl);
+        return true;
+    }
 
-    Framebuffer fb{};
-    fb.addDepthBuffer(brdfLUT.width, brdfLUT.height);
-    fb.addTextureBuffer(GL_COLOR_ATTACHMENT0, brdfLUT);
-    fb.bind();
+    return false;
+}
 
-    glViewport(0, 0, brdfLUT.width, brdfLUT.height);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// Copy of an output level with its own mip chain, source of the next cascaded level
+std::unique_ptr<Texture> LevelAsSource(const Texture& tex, int lvl) {
+    const int size = ResizeLvl(tex.width, lvl);
 
-    glUseProgram(program->id());
-    glUniform1i(1, opts.numSamples);
+    auto source = std::make_unique<Texture>(GL_TEXTURE_CUBE_MAP, tex.internalFormat(),
+                                            size, MaxMipLevel(size));
+    {
+        ScopedGpuTimer timer{Stage::Draw, std::format("copy level {}", lvl)};
+        glCopyImageSubData(tex.handle, GL_TEXTURE_CUBE_MAP, lvl, 0, 0, 0, source->handle,
+                           GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, size, size, 6);
+    }
 
-    RenderQuad();
+    source->setParam(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    source->generateMipmaps();
 
-    SaveImage(opts.outFile, *brdfLUT.image());
+    return source;
 }
 
-void ConvertToCubemap(const CliOptions& opts) {
-    std::unique_ptr<CubeImage> cube;
-    if (opts.isInputEquirect) {
-        // Convert to cubemap and then retrieve data from gpu
-        auto cubeTex = SphericalProjToCubemap(opts.inFile, opts.texSize);
-        cubeTex->levels = 1; // Only 1 level
-        cube = cubeTex->cubemap();
-    } else {
-        cube = ImportCubeMap(opts.inFile, opts.importType, nullptr);
+std::unique_ptr<CubeImage> ToHalf(std::unique_ptr<CubeImage> cube) {
+    ScopedTimer timer{Stage::Convert, "convert to 16 bit"};
+
+    auto halfFmt = cube->imgFormat();
+    halfFmt.pFmt = PixelFormat::F16;
+
+    auto halfCube = std::make_unique<CubeImage>(halfFmt, cube->numLevels());
+    for (int face = 0; face < 6; ++face)
+        (*halfCube)[face] = Image{halfFmt, std::move((*cube)[face])};
+
+    return halfCube;
+}
+
+// Progressive results are accumulated in 32 bit floats, convert them when asked for
+// 16 bit outputs
+std::unique_ptr<CubeImage> ReadResult(const CliOptions& opts, const Texture& result) {
+    auto cube = result.cubemap();
+    if (!opts.useHalf || !IsProgressive(opts))
+        return cube;
+
+    return ToHalf(std::move(cube));
+}
+
+GLuint ResultFormat(const CliOptions& opts) {
+    return opts.useHalf && !IsProgressive(opts) ? GL_RGB16F : GL_RGB32F;
+}
+
+// Writes the convolution result. A shard only reads back the tiles it owns and writes
+// them as a partial '.cube' file, 'merge' assembles the shards.
+void ExportConvolution(const CliOptions& opts, const Texture& result) {
+    if (opts.shardCount == 0) {
+        ExportResult(opts, *ReadResult(opts, result));
+        return;
+    }
+
+    auto fmt = result.imgFormat();
+    if (opts.useHalf)
+        fmt.pFmt = PixelFormat::F16;
+
+    std::vector<CubeTile> tiles;
+    for (int lvl = 0; lvl < result.levels; ++lvl) {
+        for (int face = 0; face < 6; ++face) {
+            for (const auto& tile : FaceTiles(opts, lvl, face)) {
+                auto image = result.region(face, lvl, tile.x, tile.y, tile.width,
+                                           tile.height);
+                if (image.format().pFmt != fmt.pFmt)
+                    image = image.convertTo({fmt.pFmt, tile.width, tile.height,
+                                             fmt.nChannels});
+
+                tiles.push_back({lvl, face, tile.x, tile.y, std::move(image)});
+            }
+        }
     }
 
-    Print("Converting cubemap to '{}'", LayoutNames.at(opts.exportType));
+    ScopedTimer timer{Stage::Save, "save " + opts.outFile};
+    ExportCubeTiles(opts.outFile, fmt, result.levels, tiles, ShardKey(opts),
+                    opts.exportOpts);
 
-    ExportCubemap(opts.outFile, opts.exportType, *cube);
+    Print("Shard {}/{}: saved {} tiles", opts.shardIndex, opts.shardCount, tiles.size());
 }
 
 void ComputeIrradiance(const CliOptions& opts) {
-    auto defines = GetShaderDefines(opts);
-    auto shaders = std::array{"convert.vert"s, "irradiance.frag"s};
-    auto program = CompileAndLinkProgram("irradiance", shaders, defines);
+    auto programs = CompileConvolution(opts, "irradiance");
 
     auto envMap = LoadEnvironment(opts);
     envMap->setParam(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -225,40 +1085,100 @@ void ComputeIrradiance(const CliOptions& opts) {
     fb.addDepthBuffer(opts.texSize, opts.texSize);
     fb.bind();
 
-    GLuint intFormat = opts.useHalf ? GL_RGB16F : GL_RGB32F;
-    Texture irradiance{GL_TEXTURE_CUBE_MAP, intFormat, opts.texSize};
-
-    auto projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 5.0f);
-    auto modelMatrix = ScaleAndRotateY({1, 1, 1}, 0);
+    Texture irradiance{GL_TEXTURE_CUBE_MAP, ResultFormat(opts), opts.texSize};
 
     Print("Computing irradiance [{}px cube, {} spp, {} prefiltered IS]", opts.texSize,
           opts.numSamples, opts.usePrefilteredIS ? "with" : "without");
 
-    glUseProgram(program->id());
-    glUniform1i(EnvMap, 0);
-    glUniform1i(NumSamples, opts.numSamples);
-    glUniformMatrix4fv(Projection, 1, GL_FALSE, glm::value_ptr(projection));
-    glUniformMatrix4fv(Model, 1, GL_FALSE, glm::value_ptr(modelMatrix));
+    SamplingParams params{opts.numSamples, envMap->width, opts.usePrefilteredIS,
+                          opts.sequence};
+    auto table = IrradianceSampleTable(params, opts.divideLambertConstant);
+
+    auto extraction = ExtractSunLight(opts, *envMap);
+    const auto& source = extraction.residual ? *extraction.residual : *envMap;
+    auto env = BuildEnvImportance(opts, source);
 
     glActiveTexture(GL_TEXTURE0);
-    envMap->bind();
+    source.bind();
 
-    glViewport(0, 0, opts.texSize, opts.texSize);
-    for (int face = 0; face < 6; ++face) {
-        glUniformMatrix4fv(View, 1, GL_FALSE, glm::value_ptr(CubeMapViews[face]));
-        fb.addTextureLayer(GL_COLOR_ATTACHMENT0, irradiance, face);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    Buffer samples{};
+    RenderConvolution(opts, programs, fb, irradiance, 0, std::move(table), samples,
+                      env.get(), extraction.light());
 
-        RenderCube();
+    ExportConvolution(opts, irradiance);
+}
+
+bool RunsOnCpu(const CliOptions& opts) {
+    return opts.mode == Mode::Convert || opts.mode == Mode::Merge ||
+           (opts.mode == Mode::Irradiance && opts.quadratureSize > 0) ||
+           (opts.mode == Mode::Specular && !opts.kernelCache.empty());
+}
+
+void ComputeIrradianceQuadrature(const CliOptions& opts) {
+    auto env = LoadEnvironmentCube(opts);
+
+    const int sourceSize = std::min(opts.quadratureSize, env->imgFormat().width);
+    Print("Computing irradiance by quadrature [{}px cube from a {}px environment]",
+          opts.texSize, sourceSize);
+
+    auto cube = [&] {
+        ScopedTimer timer{Stage::Compute, "irradiance quadrature"};
+        return IrradianceQuadrature(*env, sourceSize, opts.texSize,
+                                    opts.divideLambertConstant);
+    }();
+
+    if (opts.useHalf)
+        cube = ToHalf(std::move(cube));
+
+    ExportResult(opts, *cube);
+}
+
+void ComputeSpecularKernels(const CliOptions& opts) {
+    const KernelSettings settings{opts.texSize,    opts.mipLevels, opts.texSize,
+                                  opts.numSamples, opts.sequence,  opts.usePrefilteredIS};
+
+    std::unique_ptr<SpecularKernels> kernels;
+    if (fs::exists(opts.kernelCache)) {
+        ScopedTimer timer{Stage::Load, "map " + opts.kernelCache};
+        kernels = SpecularKernels::Load(opts.kernelCache);
+        if (kernels && kernels->settings() != settings) {
+            Print("Kernel cache {} was built with other settings, rebuilding",
+                  opts.kernelCache);
+            kernels.reset();
+        }
+    }
+
+    if (!kernels) {
+        Print("Building specular kernels [{}px cube, {} levels, {} spp]", opts.texSize,
+              opts.mipLevels, opts.numSamples);
+
+        {
+            ScopedTimer timer{Stage::Compute, "build specular kernels"};
+            kernels = std::make_unique<SpecularKernels>(settings);
+        }
+
+        ScopedTimer timer{Stage::Save, "save " + opts.kernelCache};
+        kernels->save(opts.kernelCache);
     }
 
-    ExportCubemap(opts.outFile, opts.exportType, *irradiance.cubemap());
+    Print("Applying specular kernels from {} [{} non zeros]", opts.kernelCache,
+          kernels->nonZeros());
+
+    auto env = LoadEnvironmentCube(opts);
+
+    auto cube = [&] {
+        ScopedTimer timer{Stage::Compute, "apply specular kernels"};
+        return kernels->apply(*env);
+    }();
+
+    if (opts.useHalf)
+        cube = ToHalf(std::move(cube));
+
+    ExportResult(opts, *cube);
 }
 
 void ComputeSpecular(const CliOptions& opts) {
-    auto defines = GetShaderDefines(opts);
-    auto shaders = std::array{"convert.vert"s, "specular.frag"s};
-    auto program = CompileAndLinkProgram("specular", shaders, defines);
+    auto programs = CompileConvolution(opts, "specular");
 
     auto envMap = LoadEnvironment(opts);
     envMap->setParam(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -268,72 +1188,433 @@ void ComputeSpecular(const CliOptions& opts) {
     fb.addDepthBuffer(opts.texSize, opts.texSize);
     fb.bind();
 
-    GLuint intFormat = opts.useHalf ? GL_RGB16F : GL_RGB32F;
-    Texture convMap{GL_TEXTURE_CUBE_MAP, intFormat, opts.texSize, opts.mipLevels};
+    Texture convMap{GL_TEXTURE_CUBE_MAP, ResultFormat(opts), opts.texSize,
+                    opts.mipLevels};
     convMap.generateMipmaps();
 
-    auto projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 5.0f);
-    auto modelMatrix = ScaleAndRotateY({1, 1, 1}, 0);
-
     Print("Computing cube specular convolution [{}px cube, {} levels, {} spp, {} "
           "prefiltered IS]",
           opts.texSize, opts.mipLevels, opts.numSamples,
           opts.usePrefilteredIS ? "with" : "without");
 
-    glUseProgram(program->id());
-    glUniform1i(EnvMap, 0);
-    glUniform1i(NumSamples, opts.numSamples);
-    glUniformMatrix4fv(Projection, 1, GL_FALSE, glm::value_ptr(projection));
-    glUniformMatrix4fv(Model, 1, GL_FALSE, glm::value_ptr(modelMatrix));
+    // Levels filtered from the environment use the residual, the mirror level keeps the
+    // sun as it is
+    auto extraction = ExtractSunLight(opts, *envMap);
+    const auto& source = extraction.residual ? *extraction.residual : *envMap;
+    auto env = BuildEnvImportance(opts, source);
 
     glActiveTexture(GL_TEXTURE0);
-    envMap->bind();
+    source.bind();
+
+    SamplingParams params{opts.numSamples, envMap->width, opts.usePrefilteredIS,
+                          opts.sequence};
+    Buffer samples{};
+
+    const auto start = Clock::now();
+
+    CascadedLobe cascade;
+    float prevRough = 0.0f, prevGain = 1.0f;
 
     for (int mip = 0; mip < opts.mipLevels; ++mip) {
-        int mipSize = ResizeLvl(opts.texSize, mip);
-        glViewport(0, 0, mipSize, mipSize);
-        fb.resize(mipSize, mipSize);
+        float rough = opts.mipLevels > 1 ? mip / (opts.mipLevels - 1.0f) : 0.0f;
+
+        auto table = [&] {
+            ScopedTimer timer{Stage::Compute, std::format("sample table level {}", mip)};
+            return SpecularSampleTable(params, rough);
+        }();
+        const float gain = TableGain(table);
+
+        if (mip == 0) {
+            // Mirror lobe, a single sample with the gain of the estimator
+            prevGain = gain;
+            if (CopyMirrorLevel(programs, fb, *envMap, convMap, gain))
+                continue;
+        }
 
-        float rough = mip / (opts.mipLevels - 1.0f);
-        glUniform1f(Roughness, rough);
+        if (opts.filter == SpecularFilter::Cascaded && mip > 0) {
+            float incRough = cascade.fitIncrement(prevRough, rough, table);
 
-        for (int face = 0; face < 6; ++face) {
-            glUniformMatrix4fv(View, 1, GL_FALSE, glm::value_ptr(CubeMapViews[face]));
-            fb.addTextureLayer(GL_COLOR_ATTACHMENT0, convMap, face, mip);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            int srcSize = ResizeLvl(opts.texSize, mip - 1);
+            auto incTable = SpecularSampleTable(
+                {opts.numSamples, srcSize, opts.usePrefilteredIS, opts.sequence},
+                incRough);
 
-            RenderCube();
+            auto distance = cascade.distance(incTable, table);
+            if (distance <= opts.cascadeError) {
+                Print("Level {} [roughness {:.3f}]: cascaded from level {} with "
+                      "roughness {:.3f}, {} effective samples, lobe distance {:.4f}",
+                      mip, rough, mip - 1, incRough, incTable.samples.size(), distance);
+
+                cascade.compose(incTable);
+
+                // Previous level already carries its gain, normalize the increment
+                auto incWeight = TotalWeight(incTable, {0, incTable.samples.size()});
+                incTable.scale = gain / (prevGain * incWeight);
+
+                auto prevLevel = LevelAsSource(convMap, mip - 1);
+                prevLevel->bind();
+
+                RenderConvolution(opts, programs, fb, convMap, mip, std::move(incTable),
+                                  samples);
+
+                prevRough = rough, prevGain = gain;
+                continue;
+            }
+
+            Print("Level {}: cascaded lobe distance {:.4f} above {}, filtering directly",
+                  mip, distance, opts.cascadeError);
+
+            cascade.reset(table);
+            source.bind();
+        }
+
+        Print("Level {} [roughness {:.3f}]: {} effective samples", mip, rough,
+              table.samples.size());
+
+        if (programs.envImportance || programs.sunLight) {
+            for (const auto* program : {programs.main.get(), programs.stats.get()})
+                if (program)
+                    glProgramUniform1f(program->id(), Roughness, rough);
         }
+
+        // A mirror lobe has no pdf to weigh environment samples against, and it
+        // reflects the sun as it is in the environment
+        if (rough == 0.0f) {
+            envMap->bind();
+            RenderConvolution(opts, programs, fb, convMap, mip, std::move(table),
+                              samples);
+            source.bind();
+        } else {
+            RenderConvolution(opts, programs, fb, convMap, mip, std::move(table), samples,
+                              env.get(), extraction.light());
+        }
+        prevRough = rough, prevGain = gain;
+    }
+
+    glFinish();
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    Print("Specular convolution took {:.2f}s", elapsed.count());
+
+    ExportConvolution(opts, convMap);
+}
+
+// Environments of a probe list, one path per line. Blank lines and lines starting with
+// '#' are skipped, relative paths are relative to the list.
+std::vector<std::string> ReadProbeList(const std::string& listPath) {
+    std::ifstream file(listPath);
+    if (!file)
+        FATAL("Couldn't open probe list {}", listPath);
+
+    std::vector<std::string> paths;
+    for (std::string line; std::getline(file, line);) {
+        auto first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+
+        fs::path path = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+        if (path.is_relative())
+            path = fs::path{listPath}.parent_path() / path;
+
+        paths.push_back(path.string());
+    }
+
+    if (paths.empty())
+        FATAL("Probe list {} has no environments", listPath);
+
+    return paths;
+}
+
+// Uploads every environment of the probe list as one cube map array
+std::unique_ptr<Texture> LoadProbeArray(const CliOptions& opts) {
+    auto paths = ReadProbeList(opts.inFile);
+
+    std::vector<CubeImage> cubes;
+    for (const auto& path : paths) {
+        auto probeOpts = opts;
+        probeOpts.inFile = path;
+        cubes.push_back(std::move(*LoadEnvironmentCube(probeOpts)));
+
+        auto fmt = cubes.back().imgFormat(), firstFmt = cubes[0].imgFormat();
+        if (fmt.width != firstFmt.width || fmt.pFmt != firstFmt.pFmt ||
+            fmt.nChannels != firstFmt.nChannels)
+            FATAL("Environment {} doesn't have the size and format of {}", path,
+                  paths[0]);
+    }
+
+    return std::make_unique<Texture>(std::span<const CubeImage>{cubes});
+}
+
+// Renders the convolution of the sample table into a level of every cube of the target
+// array with a single draw, layered.geom routes each face of each instance to its layer
+void RenderArrayConvolution(const ConvolutionPrograms& programs, Framebuffer& fb,
+                            const Texture& target, int mip, const SampleTable& table,
+                            Buffer& samples) {
+    const int size = ResizeLvl(target.width, mip);
+    glViewport(0, 0, size, size);
+
+    samples.upload(std::span<const LobeSample>{table.samples});
+    samples.bindBase(SampleTableBinding);
+    SetSampleRange(*programs.main, {0, table.samples.size()}, table.scale);
+
+    fb.addTextureBuffer(GL_COLOR_ATTACHMENT0, target, mip);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    ScopedGpuTimer timer{Stage::Draw,
+                         std::format("{} array level {}", programs.name, mip)};
+    RenderCube(target.layers);
+}
+
+// Options the single pass over a cube map array can't honor
+void CheckArrayOptions(const CliOptions& opts) {
+    if (!opts.probeArray) {
+        if (opts.splitProbes)
+            FATAL("--split needs --array");
+        return;
+    }
+
+    if (opts.envSamples > 0 || opts.extractSun || IsProgressive(opts))
+        FATAL("--array doesn't support --env-samples, --sun, --batch, --tile, "
+              "--adaptive or --time-limit");
+
+    if (opts.quadratureSize > 0 || !opts.kernelCache.empty() ||
+        opts.filter == SpecularFilter::Cascaded)
+        FATAL("--array doesn't support --exact, --kernel-cache or --filter cascaded");
+
+    const bool cubeOutput = opts.exportType == CubeLayoutType::Custom && !opts.exportAstc;
+    if (!opts.splitProbes && !cubeOutput)
+        FATAL("Cube map arrays are written as '.cube' files (--ot 6), use --split for "
+              "other outputs");
+}
+
+// Convolves every environment of a probe list at once. Levels take one instanced draw
+// for all probes, instead of one draw per face and probe.
+void ComputeProbeArray(const CliOptions& opts) {
+    const bool specular = opts.mode == Mode::Specular;
+    auto programs = CompileConvolution(opts, specular ? "specular" : "irradiance");
+
+    auto envArray = LoadProbeArray(opts);
+    envArray->setParam(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    envArray->generateMipmaps();
+
+    const int levels = specular ? opts.mipLevels : 1;
+    Texture convArray{GL_TEXTURE_CUBE_MAP_ARRAY, ResultFormat(opts), opts.texSize,
+                      opts.texSize, levels, envArray->layers};
+
+    Print("Computing {} of {} environments [{}px cube, {} spp, {} prefiltered IS]",
+          programs.name, envArray->layers, opts.texSize, opts.numSamples,
+          opts.usePrefilteredIS ? "with" : "without");
+
+    // Every layer is rendered at once, so the framebuffer has no depth buffer
+    Framebuffer fb{};
+    fb.bind();
+    glDisable(GL_DEPTH_TEST);
+
+    glActiveTexture(GL_TEXTURE0);
+    envArray->bind();
+
+    SamplingParams params{opts.numSamples, envArray->width, opts.usePrefilteredIS,
+                          opts.sequence};
+    Buffer samples{};
+
+    const auto start = Clock::now();
+    for (int mip = 0; mip < levels; ++mip) {
+        float rough = levels > 1 ? mip / (levels - 1.0f) : 0.0f;
+
+        auto table = [&] {
+            ScopedTimer timer{Stage::Compute, std::format("sample table level {}", mip)};
+            return specular ? SpecularSampleTable(params, rough)
+                            : IrradianceSampleTable(params, opts.divideLambertConstant);
+        }();
+
+        // Mirror lobe, copied like the level 0 of a single probe
+        if (specular && mip == 0 &&
+            CopyMirrorLevel(programs, fb, *envArray, convArray, TableGain(table)))
+            continue;
+
+        if (specular)
+            Print("Level {} [roughness {:.3f}]: {} effective samples", mip, rough,
+                  table.samples.size());
+
+        RenderArrayConvolution(programs, fb, convArray, mip, table, samples);
+    }
+
+    glFinish();
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+    Print("Convolution of {} environments took {:.2f}s", envArray->layers,
+          elapsed.count());
+
+    std::vector<CubeImage> cubes;
+    for (int layer = 0; layer < convArray.layers; ++layer)
+        cubes.push_back(std::move(*convArray.arrayLayer(layer)));
+
+    if (!opts.splitProbes) {
+        ScopedTimer timer{Stage::Save, "save " + opts.outFile};
+        ExportCubeArray(opts.outFile, cubes, opts.exportOpts);
+        return;
+    }
+
+    const auto& [parent, stem, ext] = SplitFilePath(opts.outFile);
+    for (std::size_t i = 0; i < cubes.size(); ++i) {
+        auto probeOpts = opts;
+        probeOpts.outFile = (parent / std::format("{}_{}{}", stem, i, ext)).string();
+        ExportResult(probeOpts, cubes[i]);
     }
+}
+
+// Shards have to render the same thing as the whole job would, tile by tile
+void CheckShardOptions(const CliOptions& opts) {
+    if (opts.shardCount == 0)
+        return;
+
+    if (opts.probeArray || opts.quadratureSize > 0 || !opts.kernelCache.empty() ||
+        opts.filter == SpecularFilter::Cascaded)
+        FATAL("--shard doesn't support --array, --exact, --kernel-cache or --filter "
+              "cascaded");
+
+    // Batches skipped once out of time would differ from shard to shard
+    if (opts.timeLimit > 0.0f)
+        FATAL("--shard doesn't support --time-limit");
 
-    ExportCubemap(opts.outFile, opts.exportType, *convMap.cubemap());
+    if (opts.exportType != CubeLayoutType::Custom || opts.exportAstc)
+        FATAL("Shards are written as partial '.cube' files (--ot 6), pass the output "
+              "type to 'merge' instead");
+}
+
+// Checkpoints hold the face levels of the OpenGL convolution of a single environment
+void CheckCheckpointOptions(const CliOptions& opts) {
+    if (opts.resume && opts.checkpointFile.empty())
+        FATAL("--resume needs the --checkpoint file to resume from");
+
+    if (opts.checkpointFile.empty())
+        return;
+
+    if (opts.probeArray || opts.quadratureSize > 0 || !opts.kernelCache.empty())
+        FATAL("--checkpoint doesn't support --array, --exact or --kernel-cache");
+
+    if (opts.checkpointInterval < 0.0f)
+        FATAL("--checkpoint-interval can't be negative, got {}", opts.checkpointInterval);
+}
+
+void MergeShards(const CliOptions& opts) {
+    auto cube = [&] {
+        ScopedTimer timer{Stage::Load, "merge shards"};
+        return MergeCubeTiles(opts.shardFiles);
+    }();
+
+    Print("Merged {} shards [{}px cube, {} levels]", opts.shardFiles.size(),
+          cube->imgFormat().width, cube->numLevels());
+
+    ExportResult(opts, *cube);
 }
 
 } // namespace
 
+void ibl::InitOpenGL() {
+    if (!glfwInit())
+        FATAL("Couldn't initialize OpenGL context.");
+
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    window = glfwCreateWindow(1, 1, "iblenv", NULL, NULL);
+    if (!window) {
+        glfwTerminate();
+        FATAL("Couldn't create GLFW window.");
+    }
+    glfwMakeContextCurrent(window);
+
+    int glver = gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+    if (glver == 0)
+        FATAL("Failed to initialize OpenGL loader");
+
+#ifdef DEBUG
+    glEnable(GL_DEBUG_OUTPUT);
+    glDebugMessageCallback(OpenGLErrorCallback, 0);
+#endif
+
+    // Print system info
+    auto renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+    auto vendor = reinterpret_cast<const char*>(glGetString(GL_VENDOR));
+    auto version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    auto glslVer =
+        reinterpret_cast<const char*>(glGetString(GL_SHADING_LANGUAGE_VERSION));
+    Print("OpenGL Renderer: {} ({})", renderer, vendor);
+    Print("OpenGL Version: {}", version);
+    Print("GLSL Version: {}\n", glslVer);
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_TRUE);
+    glDepthRange(0.0, 1.0);
+    glClearDepth(1.0);
+    glCullFace(GL_BACK);
+    glFrontFace(GL_CCW);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    glDisable(GL_CULL_FACE); // We're rendering skybox back faces
+}
+
 void ibl::ExecuteJob(const CliOptions& opts) {
     if (opts.mode == Mode::Unknown)
         FATAL("Unknown option.");
 
-    InitOpenGL();
+    if (opts.numThreads > 0)
+        SetMaxThreads(opts.numThreads);
+
+    ResetProfiler();
+    ResetMemoryPeaks();
+    SetMemoryBudget(std::size_t{opts.memoryBudget} << 20);
+
+    Deadline.reset();
+    if (opts.timeLimit > 0.0f)
+        Deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                      std::chrono::duration<float>(opts.timeLimit));
+
+    CheckArrayOptions(opts);
+    CheckShardOptions(opts);
+    CheckCheckpointOptions(opts);
+    StartProgress(opts);
+
+    // Only jobs rendering something pay for the context
+    const bool cpu = RunsOnCpu(opts);
+    if (!cpu)
+        InitOpenGL();
 
     if (opts.mode == Mode::Brdf)
         ComputeBRDF(opts);
     else if (opts.mode == Mode::Convert)
         ConvertToCubemap(opts);
+    else if (opts.mode == Mode::Merge)
+        MergeShards(opts);
+    else if (opts.probeArray)
+        ComputeProbeArray(opts);
     else if (opts.mode == Mode::Irradiance)
-        ComputeIrradiance(opts);
+        cpu ? ComputeIrradianceQuadrature(opts) : ComputeIrradiance(opts);
     else if (opts.mode == Mode::Specular)
-        ComputeSpecular(opts);
+        cpu ? ComputeSpecularKernels(opts) : ComputeSpecular(opts);
+
+    // The output supersedes the checkpoint
+    if (JobProgress) {
+        RemoveCheckpoint(JobProgress->file);
+        JobProgress.reset();
+    }
 
     Cleanup();
+
+    Print("{}", ProfileSummary());
+    Print("{}", MemoryReport());
+    if (!opts.traceFile.empty()) {
+        ExportTrace(opts.traceFile);
+        Print("Saved trace to {}", opts.traceFile);
+    }
 }
 
 void ibl::Cleanup() {
     CleanupGeometry();
 
     if (window) {
+        ResolveGpuTimers();
         glfwDestroyWindow(window);
         glfwTerminate();
+        window = nullptr;
     }
 }
\ No newline at end of file
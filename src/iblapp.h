@@ -7,6 +7,10 @@ namespace ibl {
 
 struct CliOptions;
 
+// Creates the hidden window and OpenGL context used by the GPU passes. Jobs create
+// their own, released by Cleanup().
+void InitOpenGL();
+
 void ExecuteJob(const CliOptions& opts);
 void Cleanup();
 
@@ -13,6 +13,27 @@ std::uint8_t DecodeU8(float f32) {
     return static_cast<uint8_t>(f32 * 255.0f + 0.5f);
 }
 
+std::unique_ptr<std::byte[]> ExtractChannelData(ImageFormat imgFmt,
+                                                const std::byte* imgPtr, int c) {
+    if (c >= imgFmt.nChannels)
+        FATAL("Specified channel number is higher than available channels.");
+
+    auto compSize = ComponentSize(imgFmt.pFmt);
+    auto nPixels = imgFmt.width * imgFmt.height;
+
+    auto chData = std::make_unique<std::byte[]>(compSize * nPixels);
+
+    auto dstPtr = chData.get();
+
+    for (int p = 0; p < nPixels; ++p) {
+        std::memcpy(dstPtr, imgPtr + compSize * c, compSize);
+        imgPtr += compSize * imgFmt.nChannels;
+        dstPtr += compSize;
+    }
+
+    return chData;
+}
+
 } // namespace
 
 int ibl::ComponentSize(PixelFormat pFmt) {
@@ -48,6 +69,7 @@ Image::Image(ImageFormat format, const float* imgPtr, int levels)
 
     auto numElems = TotalPixels(format, levels) * fmt.nChannels;
 
+    memory.resize(numElems * sizeof(float));
     p32.reserve(numElems);
     p32.assign(imgPtr, imgPtr + numElems);
 }
@@ -132,6 +154,15 @@ void Image::copy(Extents ext, const Image& srcImg, int toLvl, int fromLvl) {
     }
 }
 
+void Image::copy(Extents ext, const ImageView& srcView, int toLvl, int fromLvl) {
+    for (int y = 0; y < ext.sizeY; ++y) {
+        for (int x = 0; x < ext.sizeX; ++x) {
+            const auto& px = srcView.pixel(ext.fromX + x, ext.fromY + y, fromLvl);
+            setPixel(px, ext.toX + x, ext.toY + y, toLvl);
+        }
+    }
+}
+
 Image Image::convertTo(ImageFormat newFmt, int nLvls) const {
     if (fmt.pFmt == newFmt.pFmt && fmt.nChannels == newFmt.nChannels && nLvls == levels)
         return *this;
@@ -145,6 +176,8 @@ Image Image::convertTo(ImageFormat newFmt, int nLvls) const {
 
 void Image::resizeBuffer() {
     auto numElems = TotalPixels(fmt, levels) * fmt.nChannels;
+    memory.resize(ImageSize(fmt, levels));
+
     switch (fmt.pFmt) {
     case PixelFormat::U8:
         p8.resize(numElems);
@@ -211,44 +244,72 @@ void Image::flipXY() {
 }
 
 ImageView::ImageView(const Image& image)
-    : img(&image), start(image.data()), viewSize(image.size()),
+    : img(&image), start(image.data()), viewSize(image.size()), fmt(image.format()),
       nLevels(image.numLevels()) {}
 
 ImageView::ImageView(const Image& image, int lvl)
-    : img(&image), start(image.data(lvl)), viewSize(image.size(lvl)), nLevels(1),
-      viewLevel(lvl) {}
+    : img(&image), start(image.data(lvl)), viewSize(image.size(lvl)),
+      fmt(image.format()), nLevels(1), viewLevel(lvl) {}
 
-Image ImageView::convertTo(ImageFormat newFmt, int lvl) const {
-    Image copyImg{newFmt, 1};
-    copyImg.copy(*img, lvl, viewLevel + lvl);
-    return copyImg;
+ImageView::ImageView(ImageFormat format, const std::byte* data, int levels)
+    : start(data), viewSize(ImageSize(format, levels)), fmt(format), nLevels(levels) {}
+
+Image::PixelVal ImageView::pixel(int x, int y, int lvl) const {
+    auto chanVals = Image::PixelVal{0.0f, 0.0f, 0.0f, 0.0f};
+    for (int c = 0; c < fmt.nChannels; ++c)
+        chanVals[c] = channel(x, y, c, lvl);
+    return chanVals;
 }
 
-std::unique_ptr<std::byte[]> ibl::ExtractChannel(const Image& image, int c, int lvl) {
-    const auto imgFmt = image.format(lvl);
-    if (c >= imgFmt.nChannels)
-        FATAL("Specified channel number is higher than available channels.");
+// Reads the bytes in place, the view may reference a mapped file without a backing Image
+float ImageView::channel(int x, int y, int c, int lvl) const {
+    if (c >= fmt.nChannels)
+        return 0;
 
-    auto chSize = image.size(lvl) / imgFmt.nChannels;
-    auto compSize = ComponentSize(imgFmt.pFmt);
-    auto nPixels = imgFmt.width * imgFmt.height;
+    const auto lvlFmt = format(lvl);
+    const auto texel = static_cast<std::size_t>(y) * lvlFmt.width + x;
+    const auto* ptr = data(lvl) + (texel * fmt.nChannels + c) * ComponentSize(fmt.pFmt);
 
-    auto chData = std::make_unique<std::byte[]>(chSize);
+    switch (fmt.pFmt) {
+    case PixelFormat::U8:
+        return EncodeU8(std::to_integer<std::uint8_t>(*ptr));
+    case PixelFormat::F16: {
+        Half val;
+        std::memcpy(&val, ptr, sizeof(Half));
+        return val;
+    }
+    case PixelFormat::F32: {
+        float val;
+        std::memcpy(&val, ptr, sizeof(float));
+        return val;
+    }
+    default:
+        FATAL("Unknown pixel format.");
+    }
+}
 
-    auto imgPtr = image.data(lvl);
-    auto dstPtr = chData.get();
+const std::byte* ImageView::data(int lvl) const {
+    std::size_t offset = 0;
+    for (int l = 0; l < lvl; ++l)
+        offset += ImageSize(format(l));
+    return start + offset;
+}
 
-    for (int p = 0; p < nPixels; ++p) {
-        std::memcpy(dstPtr, imgPtr + compSize * c, compSize);
-        imgPtr += compSize * imgFmt.nChannels;
-        dstPtr += compSize;
-    }
+Image ImageView::convertTo(ImageFormat newFmt, int lvl) const {
+    Image copyImg{newFmt, 1};
+    if (img)
+        copyImg.copy(*img, lvl, viewLevel + lvl);
+    else
+        copyImg.copy({.sizeX = newFmt.width, .sizeY = newFmt.height}, *this, 0, lvl);
+    return copyImg;
+}
 
-    return chData;
+std::unique_ptr<std::byte[]> ibl::ExtractChannel(const Image& image, int c, int lvl) {
+    return ExtractChannelData(image.format(lvl), image.data(lvl), c);
 }
 
 std::unique_ptr<std::byte[]> ibl::ExtractChannel(const ImageView imgView, int c,
                                                  int lvl) {
     assert(imgView.numLevels() > lvl);
-    return ExtractChannel(*imgView.image(), c, imgView.level() + lvl);
+    return ExtractChannelData(imgView.format(lvl), imgView.data(lvl), c);
 }
\ No newline at end of file
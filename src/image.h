@@ -2,6 +2,7 @@
 #define IBL_IMAGE_H
 
 #include <iblenv.h>
+#include <memtracker.h>
 #include <variant>
 #include <half/half.hpp>
 
@@ -41,6 +42,8 @@ inline std::size_t ImageSize(ImageFormat fmt, int levels = 1) {
     return TotalPixels(fmt, levels) * ComponentSize(fmt.pFmt) * fmt.nChannels;
 }
 
+class ImageView;
+
 // Mipmapped image
 class Image {
 public:
@@ -57,6 +60,7 @@ public:
     void copy(const Image& srcImg) { *this = srcImg.convertTo(fmt); }
     void copy(const Image& srcImg, int toLvl, int fromLvl = 0);
     void copy(Extents ext, const Image& srcImg, int toLvl = 0, int fromLvl = 0);
+    void copy(Extents ext, const ImageView& srcView, int toLvl = 0, int fromLvl = 0);
 
     PixelVal pixel(int x, int y, int lvl = 0) const;
     void setPixel(const PixelVal& px, int x, int y, int lvl = 0);
@@ -71,6 +75,11 @@ public:
         return &getPtr()[prevLvlSize];
     }
 
+    std::byte* data(int lvl = 0) {
+        std::size_t prevLvlSize = ImageSize(fmt, lvl);
+        return &getPtr()[prevLvlSize];
+    }
+
     ImageFormat format(int level = 0) const {
         auto w = ResizeLvl(fmt.width, level);
         auto h = ResizeLvl(fmt.height, level);
@@ -92,6 +101,7 @@ private:
     std::vector<std::uint8_t> p8;
     std::vector<Half> p16;
     std::vector<float> p32;
+    TrackedBytes memory{MemCategory::Image};
 
     ImageFormat fmt;
     int levels = 1;
@@ -116,15 +126,26 @@ private:
     int levels = 1;
 };
 
-// Non owning reference to an image (including all levels) or just one image level
+// Non owning reference to an image (including all levels) or just one image level.
+// May also reference raw pixel data laid out like an Image (e.g. a mapped file), in
+// which case there is no backing Image.
 class ImageView {
 public:
     ImageView(const Image& image);
     ImageView(const Image& image, int lvl);
+    ImageView(ImageFormat format, const std::byte* data, int levels = 1);
 
-    ImageFormat format(int lvl = 0) const { return img->format(viewLevel + lvl); }
+    Image::PixelVal pixel(int x, int y, int lvl = 0) const;
+    float channel(int x, int y, int c, int lvl = 0) const;
+
+    ImageFormat format(int lvl = 0) const {
+        auto w = ResizeLvl(fmt.width, viewLevel + lvl);
+        auto h = ResizeLvl(fmt.height, viewLevel + lvl);
+        return {fmt.pFmt, w, h, fmt.nChannels};
+    }
 
     const std::byte* data() const { return start; }
+    const std::byte* data(int lvl) const;
     std::size_t size() const { return viewSize; }
 
     Image convertTo(ImageFormat newFmt, int lvl = 0) const;
@@ -135,9 +156,10 @@ public:
     int numLevels() const { return nLevels; }
 
 private:
-    const Image* img;
+    const Image* img = nullptr;
     const std::byte* start;
     std::size_t viewSize;
+    ImageFormat fmt; // Format of the first level of the underlying data
 
     int nLevels = 1;
     int viewLevel = 0;
@@ -0,0 +1,447 @@
+#include <kernelcache.h>
+
+#include <cubemap.h>
+#include <mappedfile.h>
+#include <parallel.h>
+#include <util.h>
+
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+
+using namespace ibl;
+using namespace ibl::util;
+
+namespace {
+
+constexpr std::uint32_t KernelCacheVersion = 1;
+
+// Arrays start on cache line boundaries
+constexpr std::uint64_t KernelAlignment = 64;
+
+struct KernelCacheHeader {
+    std::uint8_t id[4] = {'I', 'B', 'L', 'K'};
+    std::uint32_t version = KernelCacheVersion;
+    std::int32_t outSize;
+    std::int32_t levels;
+    std::int32_t sourceSize;
+    std::uint32_t numSamples;
+    std::uint32_t sequence;
+    std::uint32_t prefiltered;
+    std::uint64_t indexOffset;
+};
+
+struct KernelLevel {
+    std::uint64_t rows;
+    std::uint64_t nonZeros;
+    std::uint64_t rowStartsOffset; // uint64, rows + 1
+    std::uint64_t columnsOffset;   // uint32
+    std::uint64_t weightsOffset;   // float
+};
+
+// Accumulators per row, the inner loop vectorizes over them without reassociating
+constexpr std::size_t Lanes = 8;
+
+using Rgb = std::array<float, 3>;
+
+std::uint64_t AlignUp(std::uint64_t val, std::uint64_t alignment) {
+    return (val + alignment - 1) / alignment * alignment;
+}
+
+// Sides of the environment pyramid the kernels read from, down to 1px, and where each
+// level starts in the column space
+struct Pyramid {
+    explicit Pyramid(int sourceSize) {
+        for (int size = sourceSize;; size = std::max(size / 2, 1)) {
+            sizes.push_back(size);
+            offsets.push_back(numTexels);
+            numTexels += 6 * static_cast<std::size_t>(size) * size;
+
+            if (size == 1)
+                break;
+        }
+    }
+
+    std::uint32_t column(int lvl, const std::array<int, 3>& texel) const {
+        const auto size = static_cast<std::size_t>(sizes[lvl]);
+        const auto [face, x, y] = texel;
+        return static_cast<std::uint32_t>(offsets[lvl] + (face * size + y) * size + x);
+    }
+
+    std::vector<int> sizes;
+    std::vector<std::size_t> offsets;
+    std::size_t numTexels = 0;
+};
+
+// Averages the faces of a srcSize cube into dstSize faces, weighting by solid angle.
+// Every source texel goes to the destination texel containing its center.
+// Destination texels receiving none, when upsampling, take the source texel at their
+// center.
+template<typename Fetch>
+std::vector<Rgb> Resample(Fetch&& fetch, int srcSize, int dstSize) {
+    const auto dstFace = static_cast<std::size_t>(dstSize) * dstSize;
+
+    std::vector<Rgb> dst(6 * dstFace, Rgb{});
+    std::vector<float> weights(dst.size(), 0.0f);
+
+    std::vector<float> solidAngles(static_cast<std::size_t>(srcSize) * srcSize);
+    for (int y = 0; y < srcSize; ++y)
+        for (int x = 0; x < srcSize; ++x)
+            solidAngles[y * srcSize + x] = CubeTexelSolidAngle(x, y, srcSize);
+
+    ParallelFor(6, [&](std::size_t face) {
+        for (int y = 0; y < srcSize; ++y) {
+            for (int x = 0; x < srcSize; ++x) {
+                auto idx = face * dstFace +
+                           static_cast<std::size_t>(y * dstSize / srcSize) * dstSize +
+                           x * dstSize / srcSize;
+                auto omega = solidAngles[y * srcSize + x];
+                auto px = fetch(static_cast<int>(face), x, y);
+
+                for (int c = 0; c < 3; ++c)
+                    dst[idx][c] += px[c] * omega;
+                weights[idx] += omega;
+            }
+        }
+
+        for (int y = 0; y < dstSize; ++y) {
+            for (int x = 0; x < dstSize; ++x) {
+                auto idx = face * dstFace + static_cast<std::size_t>(y) * dstSize + x;
+                if (weights[idx] > 0.0f) {
+                    for (auto& c : dst[idx])
+                        c /= weights[idx];
+                    continue;
+                }
+
+                auto dir = CubeFaceDir(static_cast<int>(face), (x + 0.5f) / dstSize,
+                                       (y + 0.5f) / dstSize);
+                auto [f, sx, sy] = CubeDirTexel(dir, srcSize);
+                dst[idx] = fetch(f, sx, sy);
+            }
+        }
+    });
+
+    return dst;
+}
+
+} // namespace
+
+SpecularKernels::SpecularKernels(const KernelSettings& settings)
+    : config(settings), storage(settings.levels) {
+
+    const Pyramid pyramid{config.sourceSize};
+    const SamplingParams params{config.numSamples, config.sourceSize, config.prefiltered,
+                                config.sequence};
+
+    for (int lvl = 0; lvl < config.levels; ++lvl) {
+        float rough = config.levels > 1 ? lvl / (config.levels - 1.0f) : 0.0f;
+        auto table = SpecularSampleTable(params, rough);
+
+        // Samples never fetch finer than the output texel footprint
+        const int size = ResizeLvl(config.outSize, lvl);
+        const float minLod =
+            std::max(std::log2(static_cast<float>(config.sourceSize) / size), 0.0f);
+        const int maxLvl = static_cast<int>(pyramid.sizes.size()) - 1;
+
+        // One row per output texel, rows of a face line are built together
+        std::vector<Storage> lines(6 * static_cast<std::size_t>(size));
+
+        ParallelFor(lines.size(), [&](std::size_t line) {
+            const int face = static_cast<int>(line / size);
+            const int y = static_cast<int>(line % size);
+            auto& out = lines[line];
+
+            std::vector<std::pair<std::uint32_t, float>> entries;
+            entries.reserve(table.samples.size());
+
+            for (int x = 0; x < size; ++x) {
+                auto N = CubeFaceDir(face, (x + 0.5f) / size, (y + 0.5f) / size);
+
+                entries.clear();
+                for (const auto& s : table.samples) {
+                    auto dir = TangentToWorld(s.dir, N);
+                    auto lod = std::max(s.lod, minLod);
+                    int p = std::min(static_cast<int>(std::lround(lod)), maxLvl);
+
+                    auto column = pyramid.column(p, CubeDirTexel(dir, pyramid.sizes[p]));
+                    entries.emplace_back(column, s.weight * table.scale);
+                }
+
+                // Samples landing on the same texel share an entry
+                std::sort(entries.begin(), entries.end());
+
+                std::uint64_t count = 0;
+                for (std::size_t i = 0; i < entries.size(); ++i) {
+                    if (count > 0 && out.columns.back() == entries[i].first) {
+                        out.weights.back() += entries[i].second;
+                        continue;
+                    }
+
+                    out.columns.push_back(entries[i].first);
+                    out.weights.push_back(entries[i].second);
+                    ++count;
+                }
+
+                out.rowStarts.push_back(count); // Row length until merged below
+            }
+        });
+
+        auto& level = storage[lvl];
+        level.rowStarts.reserve(6 * static_cast<std::size_t>(size) * size + 1);
+        level.rowStarts.push_back(0);
+
+        for (const auto& line : lines) {
+            for (auto count : line.rowStarts)
+                level.rowStarts.push_back(level.rowStarts.back() + count);
+
+            level.columns.insert(level.columns.end(), line.columns.begin(),
+                                 line.columns.end());
+            level.weights.insert(level.weights.end(), line.weights.begin(),
+                                 line.weights.end());
+        }
+
+        levels.push_back({level.rowStarts, level.columns, level.weights});
+    }
+}
+
+std::unique_ptr<SpecularKernels> SpecularKernels::Load(const fs::path& filePath,
+                                                       bool verify) {
+    std::unique_ptr<SpecularKernels> kernels{new SpecularKernels()};
+    if (!kernels->map(filePath, verify))
+        return nullptr;
+    return kernels;
+}
+
+bool SpecularKernels::map(const fs::path& filePath, bool verify) {
+    const auto name = filePath.string();
+    file = std::make_unique<MappedFile>(filePath);
+
+    auto Reject = [&](const std::string& reason) {
+        Print("Kernel cache {} is unusable: {}", name, reason);
+        return false;
+    };
+
+    // Whether count elements of a size starting at offset lie in the file, without
+    // overflowing on crafted offsets and counts
+    auto Fits = [&](std::uint64_t offset, std::uint64_t count, std::uint64_t size) {
+        return offset <= file->size() && count <= (file->size() - offset) / size;
+    };
+
+    KernelCacheHeader header;
+    if (file->size() < sizeof(KernelCacheHeader))
+        return Reject("truncated header");
+    std::memcpy(&header, file->data(), sizeof(KernelCacheHeader));
+
+    if (std::memcmp(header.id, "IBLK", 4) != 0)
+        return Reject("not a kernel cache");
+
+    if (header.version != KernelCacheVersion)
+        return Reject(std::format("version {}, expected {}", header.version,
+                                  KernelCacheVersion));
+
+    if (header.outSize < 1 || header.levels < 1 || header.sourceSize < 1 ||
+        header.sequence > static_cast<std::uint32_t>(Sequence::OwenSobol))
+        return Reject("corrupted header");
+
+    config = {header.outSize,
+              header.levels,
+              header.sourceSize,
+              header.numSamples,
+              static_cast<Sequence>(header.sequence),
+              header.prefiltered != 0};
+
+    if (!Fits(header.indexOffset, header.levels, sizeof(KernelLevel)))
+        return Reject("truncated index");
+
+    std::vector<KernelLevel> index(header.levels);
+    std::memcpy(index.data(), file->data() + header.indexOffset,
+                index.size() * sizeof(KernelLevel));
+
+    const Pyramid pyramid{config.sourceSize};
+
+    for (int lvl = 0; lvl < config.levels; ++lvl) {
+        const auto& entry = index[lvl];
+        const auto size = static_cast<std::uint64_t>(ResizeLvl(config.outSize, lvl));
+
+        if (entry.rows != 6 * size * size ||
+            !Fits(entry.rowStartsOffset, entry.rows + 1, sizeof(std::uint64_t)) ||
+            !Fits(entry.columnsOffset, entry.nonZeros, sizeof(std::uint32_t)) ||
+            !Fits(entry.weightsOffset, entry.nonZeros, sizeof(float)) ||
+            entry.rowStartsOffset % KernelAlignment != 0 ||
+            entry.columnsOffset % KernelAlignment != 0 ||
+            entry.weightsOffset % KernelAlignment != 0)
+            return Reject(std::format("corrupted kernels for level {}", lvl));
+
+        Level level{
+            {reinterpret_cast<const std::uint64_t*>(file->data() + entry.rowStartsOffset),
+             entry.rows + 1},
+            {reinterpret_cast<const std::uint32_t*>(file->data() + entry.columnsOffset),
+             entry.nonZeros},
+            {reinterpret_cast<const float*>(file->data() + entry.weightsOffset),
+             entry.nonZeros}
+        };
+
+        if (level.rowStarts.front() != 0 || level.rowStarts.back() != entry.nonZeros ||
+            !std::is_sorted(level.rowStarts.begin(), level.rowStarts.end()))
+            return Reject(std::format("corrupted row starts for level {}", lvl));
+
+        // Columns index the environment, out of range ones would read past it
+        if (verify) {
+            const auto numColumns = pyramid.numTexels;
+            if (std::any_of(level.columns.begin(), level.columns.end(),
+                            [&](std::uint32_t c) { return c >= numColumns; }))
+                return Reject(std::format("column out of range in level {}", lvl));
+        }
+
+        levels.push_back(level);
+    }
+
+    return true;
+}
+
+SpecularKernels::~SpecularKernels() = default;
+
+void SpecularKernels::save(const fs::path& filePath) const {
+    KernelCacheHeader header;
+    header.outSize = config.outSize;
+    header.levels = config.levels;
+    header.sourceSize = config.sourceSize;
+    header.numSamples = config.numSamples;
+    header.sequence = static_cast<std::uint32_t>(config.sequence);
+    header.prefiltered = config.prefiltered ? 1 : 0;
+    header.indexOffset = sizeof(KernelCacheHeader);
+
+    std::vector<KernelLevel> index(levels.size());
+    auto offset = AlignUp(header.indexOffset + index.size() * sizeof(KernelLevel),
+                          KernelAlignment);
+
+    for (std::size_t lvl = 0; lvl < levels.size(); ++lvl) {
+        const auto& level = levels[lvl];
+        auto& entry = index[lvl];
+
+        entry.rows = level.rowStarts.size() - 1;
+        entry.nonZeros = level.columns.size();
+
+        entry.rowStartsOffset = offset;
+        offset = AlignUp(offset + level.rowStarts.size_bytes(), KernelAlignment);
+        entry.columnsOffset = offset;
+        offset = AlignUp(offset + level.columns.size_bytes(), KernelAlignment);
+        entry.weightsOffset = offset;
+        offset = AlignUp(offset + level.weights.size_bytes(), KernelAlignment);
+    }
+
+    std::ofstream file(filePath, std::ios_base::out | std::ios_base::binary);
+    if (file.fail())
+        FATAL("Failed to open file {}", filePath.string());
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(KernelCacheHeader));
+    file.write(reinterpret_cast<const char*>(index.data()),
+               index.size() * sizeof(KernelLevel));
+
+    std::uint64_t pos = header.indexOffset + index.size() * sizeof(KernelLevel);
+    const std::vector<char> padding(KernelAlignment, 0);
+
+    auto Write = [&](std::uint64_t at, const void* data, std::size_t size) {
+        file.write(padding.data(), at - pos);
+        file.write(static_cast<const char*>(data), size);
+        pos = at + size;
+    };
+
+    for (std::size_t lvl = 0; lvl < levels.size(); ++lvl) {
+        const auto& level = levels[lvl];
+        Write(index[lvl].rowStartsOffset, level.rowStarts.data(),
+              level.rowStarts.size_bytes());
+        Write(index[lvl].columnsOffset, level.columns.data(), level.columns.size_bytes());
+        Write(index[lvl].weightsOffset, level.weights.data(), level.weights.size_bytes());
+    }
+
+    if (file.fail())
+        FATAL("Failed writing {}", filePath.string());
+}
+
+std::size_t SpecularKernels::nonZeros() const {
+    std::size_t total = 0;
+    for (const auto& level : levels)
+        total += level.columns.size();
+    return total;
+}
+
+std::unique_ptr<CubeImage> SpecularKernels::apply(const CubeImage& env) const {
+    const Pyramid pyramid{config.sourceSize};
+
+    // Environment pyramid as one array per channel, indexed by column
+    std::array<std::vector<float>, 3> source;
+    for (auto& channel : source)
+        channel.resize(pyramid.numTexels);
+
+    std::vector<Rgb> texels;
+    for (std::size_t p = 0; p < pyramid.sizes.size(); ++p) {
+        if (p == 0) {
+            texels = Resample(
+                [&](int face, int x, int y) {
+                    auto px = env[face].pixel(x, y);
+                    return Rgb{px[0], px[1], px[2]};
+                },
+                env.imgFormat().width, pyramid.sizes[0]);
+        } else {
+            const auto prevSize = static_cast<std::size_t>(pyramid.sizes[p - 1]);
+            texels = Resample(
+                [&, prev = std::move(texels)](int face, int x, int y) {
+                    return prev[(face * prevSize + y) * prevSize + x];
+                },
+                pyramid.sizes[p - 1], pyramid.sizes[p]);
+        }
+
+        for (std::size_t i = 0; i < texels.size(); ++i)
+            for (int c = 0; c < 3; ++c)
+                source[c][pyramid.offsets[p] + i] = texels[i][c];
+    }
+
+    ImageFormat outFmt{PixelFormat::F32, config.outSize, config.outSize, 3};
+    auto cube = std::make_unique<CubeImage>(outFmt, config.levels);
+
+    for (int lvl = 0; lvl < config.levels; ++lvl) {
+        const auto& level = levels[lvl];
+        const int size = ResizeLvl(config.outSize, lvl);
+
+        ParallelFor(6 * static_cast<std::size_t>(size), [&](std::size_t line) {
+            const auto face = static_cast<int>(line / size);
+            auto* out = reinterpret_cast<float*>((*cube)[face].data(lvl)) +
+                        3 * (line % size) * size;
+
+            for (int x = 0; x < size; ++x) {
+                const auto row = line * size + x;
+                const auto first = level.rowStarts[row], last = level.rowStarts[row + 1];
+
+                std::array<float, Lanes> r{}, g{}, b{};
+                auto k = first;
+                for (; k + Lanes <= last; k += Lanes) {
+                    for (std::size_t j = 0; j < Lanes; ++j) {
+                        const auto col = level.columns[k + j];
+                        const auto w = level.weights[k + j];
+                        r[j] += w * source[0][col];
+                        g[j] += w * source[1][col];
+                        b[j] += w * source[2][col];
+                    }
+                }
+
+                for (std::size_t j = 0; k < last; ++k, ++j) {
+                    const auto col = level.columns[k];
+                    r[j] += level.weights[k] * source[0][col];
+                    g[j] += level.weights[k] * source[1][col];
+                    b[j] += level.weights[k] * source[2][col];
+                }
+
+                float sumR = 0.0f, sumG = 0.0f, sumB = 0.0f;
+                for (std::size_t j = 0; j < Lanes; ++j)
+                    sumR += r[j], sumG += g[j], sumB += b[j];
+
+                out[3 * x] = sumR;
+                out[3 * x + 1] = sumG;
+                out[3 * x + 2] = sumB;
+            }
+        });
+    }
+
+    return cube;
+}
@@ -0,0 +1,75 @@
+#ifndef IBL_KERNELCACHE_H
+#define IBL_KERNELCACHE_H
+
+#include <iblenv.h>
+#include <image.h>
+#include <sampling.h>
+
+namespace fs = std::filesystem;
+
+namespace ibl {
+
+class MappedFile;
+
+// Everything the specular operator depends on. Environments are resampled to
+// sourceSize, so any environment fits a given set of kernels.
+struct KernelSettings {
+    int outSize;
+    int levels;
+    int sourceSize;
+    unsigned int numSamples;
+    Sequence sequence;
+    bool prefiltered;
+
+    bool operator==(const KernelSettings&) const = default;
+};
+
+// Specular convolution as a fixed linear operator, one sparse matrix (CSR) per output
+// level from the texels of a resampled environment pyramid to the output texels.
+// Building it takes the sampling cost once, applying it to an environment is a sparse
+// matrix vector product per channel.
+class SpecularKernels {
+public:
+    explicit SpecularKernels(const KernelSettings& settings);
+    ~SpecularKernels();
+
+    // Maps a kernel cache written by save(). Returns null, printing why, if the file is
+    // not a cache of this version or is truncated or corrupted.
+    static std::unique_ptr<SpecularKernels> Load(const fs::path& filePath,
+                                                 bool verify = true);
+
+    void save(const fs::path& filePath) const;
+
+    const KernelSettings& settings() const { return config; }
+    std::size_t nonZeros() const;
+
+    // Convolution of level 0 of env. Outputs RGB 32 bit floats.
+    std::unique_ptr<CubeImage> apply(const CubeImage& env) const;
+
+private:
+    SpecularKernels() = default;
+
+    bool map(const fs::path& filePath, bool verify);
+
+    struct Level {
+        std::span<const std::uint64_t> rowStarts; // Rows + 1 entries
+        std::span<const std::uint32_t> columns;
+        std::span<const float> weights;
+    };
+
+    // Arrays of built kernels, loaded ones point into the mapping
+    struct Storage {
+        std::vector<std::uint64_t> rowStarts;
+        std::vector<std::uint32_t> columns;
+        std::vector<float> weights;
+    };
+
+    KernelSettings config;
+    std::vector<Level> levels;
+    std::vector<Storage> storage;
+    std::unique_ptr<MappedFile> file;
+};
+
+} // namespace ibl
+
+#endif
@@ -0,0 +1,100 @@
+#include <mappedfile.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace ibl;
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const fs::path& filePath) : filePath(filePath) {
+    fileHandle = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+        fileHandle = nullptr;
+        FATAL("Failed to open file {}", filePath.string());
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(fileHandle, &size)) {
+        CloseHandle(fileHandle);
+        FATAL("Failed to query file size of {}.", filePath.string());
+    }
+
+    fileSize = static_cast<std::size_t>(size.QuadPart);
+    if (fileSize == 0)
+        return;
+
+    mapHandle = CreateFileMappingW(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapHandle)
+        ptr = static_cast<const std::byte*>(
+            MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0));
+
+    if (!ptr) {
+        if (mapHandle)
+            CloseHandle(mapHandle);
+        CloseHandle(fileHandle);
+        FATAL("Failed to map file {}", filePath.string());
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (ptr)
+        UnmapViewOfFile(ptr);
+    if (mapHandle)
+        CloseHandle(mapHandle);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+}
+
+#else
+
+MappedFile::MappedFile(const fs::path& filePath) : filePath(filePath) {
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd == -1)
+        FATAL("Failed to open file {}", filePath.string());
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        FATAL("Failed to query file size of {}.", filePath.string());
+    }
+
+    fileSize = static_cast<std::size_t>(st.st_size);
+    if (fileSize == 0) {
+        close(fd);
+        return;
+    }
+
+    void* addr = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps its own reference
+
+    if (addr == MAP_FAILED)
+        FATAL("Failed to map file {}", filePath.string());
+
+    ptr = static_cast<const std::byte*>(addr);
+}
+
+MappedFile::~MappedFile() {
+    if (ptr)
+        munmap(const_cast<std::byte*>(ptr), fileSize);
+}
+
+#endif
+
+MappedImage::MappedImage(std::unique_ptr<MappedFile> file, ImageFormat format,
+                         std::size_t offset, int levels)
+    : file(std::move(file)), fmt(format), offset(offset), levels(levels) {
+
+    if (this->offset + size() > this->file->size())
+        FATAL("File {} is too small for a {}x{} image", this->file->path().string(),
+              fmt.width, fmt.height);
+}
@@ -0,0 +1,65 @@
+#ifndef IBL_MAPPEDFILE_H
+#define IBL_MAPPEDFILE_H
+
+#include <iblenv.h>
+#include <image.h>
+
+namespace fs = std::filesystem;
+
+namespace ibl {
+
+// Read only memory mapping of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const fs::path& filePath);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const std::byte* data() const { return ptr; }
+    std::size_t size() const { return fileSize; }
+
+    const fs::path& path() const { return filePath; }
+
+private:
+    fs::path filePath;
+    const std::byte* ptr = nullptr;
+    std::size_t fileSize = 0;
+
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mapHandle = nullptr;
+#endif
+};
+
+// Image level(s) backed by a file mapping. Pixels are read in place, never copied
+class MappedImage {
+public:
+    MappedImage(std::unique_ptr<MappedFile> file, ImageFormat format, std::size_t offset,
+                int levels = 1);
+
+    ImageView view() const { return {fmt, file->data() + offset, levels}; }
+    ImageFormat format(int lvl = 0) const { return view().format(lvl); }
+    const std::byte* data(int lvl = 0) const { return view().data(lvl); }
+
+    std::size_t size() const { return ImageSize(fmt, levels); }
+    int numLevels() const { return levels; }
+
+    const MappedFile& mapping() const { return *file; }
+
+    // Owning copy of the pixels, prefer view() when the pixels are only read
+    std::unique_ptr<Image> image() const {
+        return std::make_unique<Image>(fmt, data(), levels);
+    }
+
+private:
+    std::unique_ptr<MappedFile> file;
+    ImageFormat fmt;
+    std::size_t offset = 0;
+    int levels = 1;
+};
+
+} // namespace ibl
+
+#endif
@@ -0,0 +1,155 @@
+#include <memtracker.h>
+
+#include <profiler.h>
+
+#include <mutex>
+#include <utility>
+
+using namespace ibl;
+using namespace std::literals;
+
+namespace {
+
+const std::array CategoryNames{"decode", "image", "texture", "renderbuffer", "buffer"};
+
+constexpr double MiB = 1024.0 * 1024.0;
+
+bool IsGpu(MemCategory category) {
+    return category >= MemCategory::Texture;
+}
+
+struct Usage {
+    std::array<std::size_t, CategoryNames.size()> current{}, peak{};
+    std::size_t host = 0, gpu = 0, peakHost = 0, peakGpu = 0;
+    std::size_t total = 0, peakTotal = 0;
+    std::string peakScope;
+};
+
+std::mutex MemoryMutex;
+Usage Memory;
+std::size_t Budget = 0;
+
+void Account(MemCategory category, std::size_t bytes) {
+    if (bytes == 0)
+        return;
+
+    std::lock_guard lock{MemoryMutex};
+    const auto idx = static_cast<int>(category);
+
+    if (Budget > 0 && Memory.total + bytes > Budget) {
+        auto scope = ActiveScope();
+        FATAL("Memory budget of {:.1f} MiB exceeded allocating {:.1f} MiB of {} memory{} "
+              "with {:.1f} MiB already in use ({:.1f} MiB host, {:.1f} MiB GPU)",
+              Budget / MiB, bytes / MiB, CategoryNames[idx],
+              scope.empty() ? "" : std::format(" during '{}'", scope), Memory.total / MiB,
+              Memory.host / MiB, Memory.gpu / MiB);
+    }
+
+    auto& side = IsGpu(category) ? Memory.gpu : Memory.host;
+    auto& sidePeak = IsGpu(category) ? Memory.peakGpu : Memory.peakHost;
+
+    Memory.current[idx] += bytes;
+    Memory.peak[idx] = std::max(Memory.peak[idx], Memory.current[idx]);
+    side += bytes;
+    sidePeak = std::max(sidePeak, side);
+
+    Memory.total += bytes;
+    if (Memory.total > Memory.peakTotal) {
+        Memory.peakTotal = Memory.total;
+        Memory.peakScope = ActiveScope();
+    }
+}
+
+void Release(MemCategory category, std::size_t bytes) {
+    if (bytes == 0)
+        return;
+
+    std::lock_guard lock{MemoryMutex};
+    Memory.current[static_cast<int>(category)] -= bytes;
+    (IsGpu(category) ? Memory.gpu : Memory.host) -= bytes;
+    Memory.total -= bytes;
+}
+
+} // namespace
+
+TrackedBytes::TrackedBytes(MemCategory category, std::size_t bytes)
+    : category(category) {
+    resize(bytes);
+}
+
+TrackedBytes::~TrackedBytes() {
+    Release(category, bytes);
+}
+
+TrackedBytes::TrackedBytes(const TrackedBytes& other) : category(other.category) {
+    resize(other.bytes);
+}
+
+TrackedBytes::TrackedBytes(TrackedBytes&& other) noexcept
+    : category(other.category), bytes(std::exchange(other.bytes, 0)) {}
+
+TrackedBytes& TrackedBytes::operator=(const TrackedBytes& other) {
+    if (this != &other) {
+        Account(other.category, other.bytes);
+        Release(category, bytes);
+        category = other.category;
+        bytes = other.bytes;
+    }
+    return *this;
+}
+
+TrackedBytes& TrackedBytes::operator=(TrackedBytes&& other) noexcept {
+    if (this != &other) {
+        Release(category, bytes);
+        category = other.category;
+        bytes = std::exchange(other.bytes, 0);
+    }
+    return *this;
+}
+
+void TrackedBytes::resize(std::size_t newBytes) {
+    if (newBytes > bytes)
+        Account(category, newBytes - bytes);
+    else
+        Release(category, bytes - newBytes);
+
+    bytes = newBytes;
+}
+
+void ibl::SetMemoryBudget(std::size_t bytes) {
+    std::lock_guard lock{MemoryMutex};
+    Budget = bytes;
+}
+
+void ibl::ResetMemoryPeaks() {
+    std::lock_guard lock{MemoryMutex};
+    Memory.peak = Memory.current;
+    Memory.peakHost = Memory.host;
+    Memory.peakGpu = Memory.gpu;
+    Memory.peakTotal = Memory.total;
+    Memory.peakScope.clear();
+}
+
+std::string ibl::MemoryReport() {
+    std::lock_guard lock{MemoryMutex};
+
+    auto Side = [&](bool gpu) {
+        std::string parts;
+        for (std::size_t i = 0; i < CategoryNames.size(); ++i) {
+            if (IsGpu(static_cast<MemCategory>(i)) != gpu || Memory.peak[i] == 0)
+                continue;
+
+            parts += std::format("{}{} {:.1f}", parts.empty() ? "" : ", ",
+                                 CategoryNames[i], Memory.peak[i] / MiB);
+        }
+        return parts.empty() ? parts : " (" + parts + ")";
+    };
+
+    auto during = Memory.peakScope.empty()
+                      ? ""s
+                      : std::format(" during '{}'", Memory.peakScope);
+
+    return std::format("Memory peak: {:.1f} MiB{}, host {:.1f} MiB{}, GPU {:.1f} MiB{}",
+                       Memory.peakTotal / MiB, during, Memory.peakHost / MiB, Side(false),
+                       Memory.peakGpu / MiB, Side(true));
+}
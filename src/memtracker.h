@@ -0,0 +1,44 @@
+#ifndef IBL_MEMTRACKER_H
+#define IBL_MEMTRACKER_H
+
+#include <iblenv.h>
+
+namespace ibl {
+
+// What tracked memory holds. Decoder outputs and images live in host memory, the rest
+// on the GPU.
+enum class MemCategory : std::uint32_t { Decode, Image, Texture, Renderbuffer, Buffer };
+
+// Bytes accounted to a category for the lifetime of their owner. Copies account their
+// bytes again. Growing checks the memory budget first and throws if it would be
+// exceeded, so the allocation it accounts for should follow.
+class TrackedBytes {
+public:
+    explicit TrackedBytes(MemCategory category, std::size_t bytes = 0);
+    ~TrackedBytes();
+
+    TrackedBytes(const TrackedBytes& other);
+    TrackedBytes(TrackedBytes&& other) noexcept;
+    TrackedBytes& operator=(const TrackedBytes& other);
+    TrackedBytes& operator=(TrackedBytes&& other) noexcept;
+
+    void resize(std::size_t newBytes);
+    std::size_t size() const { return bytes; }
+
+private:
+    MemCategory category;
+    std::size_t bytes = 0;
+};
+
+// Limit on all tracked memory, host and GPU together. Zero disables it.
+void SetMemoryBudget(std::size_t bytes);
+
+// Peaks start over from the current usage
+void ResetMemoryPeaks();
+
+// Peak usage per category and the profiler scope active at the overall peak
+std::string MemoryReport();
+
+} // namespace ibl
+
+#endif
@@ -0,0 +1,75 @@
+#include <parallel.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <limits>
+
+using namespace ibl;
+
+namespace {
+
+unsigned int NumThreads = 0;
+thread_local bool InsideParallelFor = false;
+
+} // namespace
+
+unsigned int ibl::MaxThreads() {
+    if (NumThreads == 0)
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    return NumThreads;
+}
+
+void ibl::SetMaxThreads(unsigned int numThreads) {
+    NumThreads = numThreads;
+}
+
+void ibl::ParallelFor(std::size_t count,
+                      const std::function<void(std::size_t)>& func) {
+    auto numWorkers = std::min<std::size_t>(MaxThreads(), count);
+
+    if (numWorkers <= 1 || InsideParallelFor) {
+        for (std::size_t i = 0; i < count; ++i)
+            func(i);
+        return;
+    }
+
+    constexpr auto NoError = std::numeric_limits<std::size_t>::max();
+
+    std::atomic<std::size_t> next = 0;
+    std::atomic<std::size_t> failedIdx = NoError;
+    std::exception_ptr error = nullptr;
+    std::mutex errorMutex;
+
+    auto Worker = [&]() {
+        InsideParallelFor = true;
+
+        // Indices are handed out in increasing order, so every index below the lowest
+        // failure is still run and the reported error doesn't depend on scheduling
+        for (auto i = next++; i < count && i < failedIdx; i = next++) {
+            try {
+                func(i);
+            } catch (...) {
+                std::scoped_lock lock{errorMutex};
+                if (i < failedIdx) {
+                    failedIdx = i;
+                    error = std::current_exception();
+                }
+            }
+        }
+
+        InsideParallelFor = false;
+    };
+
+    {
+        std::vector<std::jthread> workers;
+        workers.reserve(numWorkers - 1);
+        for (std::size_t w = 1; w < numWorkers; ++w)
+            workers.emplace_back(Worker);
+
+        Worker();
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
@@ -0,0 +1,21 @@
+#ifndef IBL_PARALLEL_H
+#define IBL_PARALLEL_H
+
+#include <iblenv.h>
+
+#include <functional>
+
+namespace ibl {
+
+// Number of worker threads used by ParallelFor. Defaults to the hardware concurrency.
+unsigned int MaxThreads();
+void SetMaxThreads(unsigned int numThreads);
+
+// Calls func(i) for every i in [0, count) across the worker threads. Nested calls run
+// serially on the calling thread. If any call throws, the exception of the lowest
+// failing index is rethrown after all workers have finished.
+void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& func);
+
+} // namespace ibl
+
+#endif
@@ -2,6 +2,7 @@
 
 #include <argparse/argparse.hpp>
 
+#include <charconv>
 #include <filesystem>
 
 using namespace ibl;
@@ -9,21 +10,76 @@ using namespace std::filesystem;
 using namespace argparse;
 
 namespace {
+// "i/N" of --shard
+void ParseShard(const std::string& shard, CliOptions& opts) {
+    const auto slash = shard.find('/');
+    const auto* end = shard.data() + shard.size();
+
+    const bool parsed =
+        slash != std::string::npos &&
+        std::from_chars(shard.data(), shard.data() + slash, opts.shardIndex).ptr ==
+            shard.data() + slash &&
+        std::from_chars(shard.data() + slash + 1, end, opts.shardCount).ptr == end;
+
+    if (!parsed || opts.shardIndex < 0 || opts.shardIndex >= opts.shardCount)
+        FATAL("--shard takes i/N with 0 <= i < N, got '{}'", shard);
+}
+
 void ParseSampledCube(const ArgumentParser& parser, CliOptions& opts) {
-    opts.usePrefilteredIS = !parser.get<bool>("--no-prefiltered");
     opts.numSamples = parser.get<unsigned int>("--spp");
     opts.useHalf = parser.get<bool>("--use16f");
+    opts.sequence = SequenceNames.at(parser.get("--sequence"));
+    opts.blueNoise = parser.get<bool>("--blue-noise");
+    opts.envSamples = parser.get<unsigned int>("--env-samples");
+
+    // Environment samples stand in for prefiltering. Blurred fetches would spread the
+    // bright texels they cover over directions the balance heuristic leaves to the lobe.
+    opts.usePrefilteredIS = !parser.get<bool>("--no-prefiltered") && opts.envSamples == 0;
+
+    opts.extractSun = parser.get<bool>("--sun");
+    opts.sunThreshold = parser.get<float>("--sun-threshold");
+    opts.batchSize = parser.get<unsigned int>("--batch");
+    opts.tileSize = parser.get<int>("--tile");
+    opts.timeLimit = parser.get<float>("--time-limit");
+    opts.adaptiveError = parser.get<float>("--adaptive");
+    opts.probeArray = parser.get<bool>("--array");
+    opts.splitProbes = parser.get<bool>("--split");
+    if (parser.is_used("--shard"))
+        ParseShard(parser.get("--shard"), opts);
+    if (parser.is_used("--checkpoint"))
+        opts.checkpointFile = parser.get("--checkpoint");
+    opts.checkpointInterval = parser.get<float>("--checkpoint-interval");
+    opts.resume = parser.get<bool>("--resume");
+}
+
+void ParseOutputOpts(const ArgumentParser& parser, CliOptions& opts) {
+    opts.outFile = parser.get("out");
+    opts.exportType = static_cast<CubeLayoutType>(parser.get<int>("--ot"));
+    opts.exportOpts.compress = parser.get<bool>("--compress");
+    opts.exportOpts.padding = parser.get<int>("--padding");
+    opts.numThreads = parser.get<unsigned int>("--threads");
+    if (parser.is_used("--trace"))
+        opts.traceFile = parser.get("--trace");
+    opts.memoryBudget = parser.get<unsigned int>("--mem-budget");
+
+    if (parser.is_used("--astc")) {
+        auto block = parser.get("--astc");
+        opts.exportAstc = true;
+        opts.astc.blockX = std::stoi(block.substr(0, block.find('x')));
+        opts.astc.blockY = std::stoi(block.substr(block.find('x') + 1));
+        opts.astc.quality = AstcQualityNames.at(parser.get("--astc-quality"));
+    }
 }
 
 void ParseFileOpts(const ArgumentParser& parser, CliOptions& opts) {
     opts.inFile = parser.get("input");
-    opts.outFile = parser.get("out");
     opts.texSize = parser.get<int>("-s");
 
     opts.isInputEquirect = !parser.is_used("--it");
     if (!opts.isInputEquirect)
         opts.importType = static_cast<CubeLayoutType>(parser.get<int>("--it"));
-    opts.exportType = static_cast<CubeLayoutType>(parser.get<int>("--ot"));
+
+    ParseOutputOpts(parser, opts);
 }
 
 CliOptions BuildOptions(ArgumentParser& p) {
@@ -33,6 +89,7 @@ CliOptions BuildOptions(ArgumentParser& p) {
     auto& convert = p.at<ArgumentParser>("convert");
     auto& irradiance = p.at<ArgumentParser>("irradiance");
     auto& specular = p.at<ArgumentParser>("specular");
+    auto& merge = p.at<ArgumentParser>("merge");
 
     if (p.is_subcommand_used(brdf)) {
         opts.mode = Mode::Brdf;
@@ -42,6 +99,8 @@ CliOptions BuildOptions(ArgumentParser& p) {
         opts.multiScattering = brdf.get<bool>("--ms");
         opts.useHalf = !brdf.get<bool>("--use32f");
         opts.flipUv = brdf.get<bool>("--flip-v");
+        if (brdf.is_used("--trace"))
+            opts.traceFile = brdf.get("--trace");
         return opts;
     }
 
@@ -56,6 +115,7 @@ CliOptions BuildOptions(ArgumentParser& p) {
         ParseFileOpts(irradiance, opts);
         ParseSampledCube(irradiance, opts);
         opts.divideLambertConstant = irradiance.get<bool>("--div-pi");
+        opts.quadratureSize = irradiance.get<int>("--exact");
         return opts;
     }
 
@@ -64,6 +124,17 @@ CliOptions BuildOptions(ArgumentParser& p) {
         ParseFileOpts(specular, opts);
         ParseSampledCube(specular, opts);
         opts.mipLevels = specular.get<int>("-l");
+        opts.filter = SpecularFilterNames.at(specular.get("--filter"));
+        opts.cascadeError = specular.get<float>("--cascade-error");
+        if (specular.is_used("--kernel-cache"))
+            opts.kernelCache = specular.get("--kernel-cache");
+        return opts;
+    }
+
+    if (p.is_subcommand_used(merge)) {
+        opts.mode = Mode::Merge;
+        ParseOutputOpts(merge, opts);
+        opts.shardFiles = merge.get<std::vector<std::string>>("shards");
         return opts;
     }
 
@@ -75,24 +146,67 @@ CliOptions ibl::ParseArgs(int argc, char* argv[]) {
     /* --------------  Shared -------------- */
     ArgumentParser inOut("inout", "", default_arguments::none);
     inOut.add_argument("input").help("Input filename.").nargs(1);
-    inOut.add_argument("out").help("Output filename.").nargs(1);
     inOut.add_argument("--it")
         .help("Type of cubemap mapping for input file.")
         .nargs(1)
         .choices(0, 1, 2, 3, 4, 5, 6)
         .scan<'d', int>();
-    inOut.add_argument("--ot")
-        .help("Type of cubemap mapping for output file.")
-        .nargs(1)
-        .default_value(0)
-        .choices(0, 1, 2, 3, 4, 5, 6)
-        .scan<'d', int>();
     inOut.add_argument("-s", "--cubeSize")
         .help("Size of the output cubemap.")
         .nargs(1)
         .default_value(1024)
         .scan<'d', int>();
 
+    ArgumentParser output("output", "", default_arguments::none);
+    output.add_argument("out").help("Output filename.").nargs(1);
+    output.add_argument("--ot")
+        .help("Type of cubemap mapping for output file. 7 and 8 resample the cube to an "
+              "octahedral or equirectangular 2D image, one per mip level.")
+        .nargs(1)
+        .default_value(0)
+        .choices(0, 1, 2, 3, 4, 5, 6, 7, 8)
+        .scan<'d', int>();
+    output.add_argument("--padding")
+        .help("Texels of border padding around octahedral and equirectangular outputs "
+              "(--ot 7, 8), continuing the projection across its edges so hardware "
+              "bilinear filtering needs no seam handling.")
+        .nargs(1)
+        .default_value(0)
+        .scan<'d', int>();
+    output.add_argument("-j", "--threads")
+        .help("Maximum number of CPU threads for every parallel stage: loading and "
+              "saving files, sample tables, sun extraction, exact irradiance, kernel "
+              "caches and projections. Defaults to the number of hardware threads.")
+        .nargs(1)
+        .default_value(0u)
+        .scan<'u', unsigned int>();
+    output.add_argument("--trace")
+        .help("Writes the time spent in every stage, draws timed on the GPU, to this "
+              "Chrome trace file (chrome://tracing or ui.perfetto.dev).")
+        .nargs(1);
+    output.add_argument("--mem-budget")
+        .help("Fails as soon as images, decoded files, textures and GPU buffers would "
+              "take more than this many MiB together.")
+        .nargs(1)
+        .default_value(0u)
+        .scan<'u', unsigned int>();
+    output.add_argument("--compress")
+        .help("Compresses the payload of '.cube' outputs (--ot 6).")
+        .nargs(0)
+        .implicit_value(true)
+        .default_value(false);
+    output.add_argument("--astc")
+        .help("Encodes the output to ASTC HDR with the given block footprint. Outputs "
+              "one '.astc' file per face and mip level.")
+        .nargs(1)
+        .choices("4x4", "5x4", "5x5", "6x5", "6x6", "8x5", "8x6", "8x8", "10x5", "10x6",
+                 "10x8", "10x10", "12x10", "12x12");
+    output.add_argument("--astc-quality")
+        .help("ASTC encoder effort.")
+        .nargs(1)
+        .default_value("medium")
+        .choices("fast", "medium", "thorough");
+
     ArgumentParser sampled("sampled", "", default_arguments::none);
     sampled.add_argument("--no-prefiltered")
         .help("Disables prefiltered importance sampling.")
@@ -109,6 +223,99 @@ CliOptions ibl::ParseArgs(int argc, char* argv[]) {
         .nargs(1)
         .default_value(2048u)
         .scan<'u', unsigned int>();
+    sampled.add_argument("--sequence")
+        .help("Low discrepancy sequence of the samples. 'owen' (Owen scrambled Sobol) "
+              "keeps every prefix well distributed, which suits progressive and adaptive "
+              "accumulation.")
+        .nargs(1)
+        .default_value("hammersley")
+        .choices("hammersley", "sobol", "owen");
+    sampled.add_argument("--blue-noise")
+        .help("Rotates the samples of each texel around the normal with a blue noise "
+              "mask, trading structured aliasing for high frequency noise.")
+        .nargs(0)
+        .implicit_value(true)
+        .default_value(false);
+    sampled.add_argument("--env-samples")
+        .help("Adds this many samples drawn proportionally to the environment "
+              "luminance, combined with the lobe samples by multiple importance "
+              "sampling. Converges much faster on skies with a small bright sun. "
+              "Turns off prefiltered lookups.")
+        .nargs(1)
+        .default_value(0u)
+        .scan<'u', unsigned int>();
+    sampled.add_argument("--sun")
+        .help("Removes the sun from the environment, convolves the residual sky and adds "
+              "the sun back analytically. Its parameters are exported to "
+              "'<out>_sun.json'. The residual needs far fewer samples per pixel.")
+        .nargs(0)
+        .implicit_value(true)
+        .default_value(false);
+    sampled.add_argument("--sun-threshold")
+        .help("Luminance over the median luminance of the environment above which "
+              "texels around the brightest one belong to the sun.")
+        .nargs(1)
+        .default_value(100.0f)
+        .scan<'g', float>();
+    sampled.add_argument("--batch")
+        .help("Accumulates samples progressively in batches of this size, waiting for "
+              "each batch to finish. By default all samples are taken in one pass.")
+        .nargs(1)
+        .default_value(0u)
+        .scan<'u', unsigned int>();
+    sampled.add_argument("--tile")
+        .help("Splits faces into square tiles of this size when accumulating "
+              "progressively.")
+        .nargs(1)
+        .default_value(0)
+        .scan<'i', int>();
+    sampled.add_argument("--adaptive")
+        .help("Accumulates progressively and stops each level once its estimated "
+              "relative error is below this threshold (e.g. 0.01).")
+        .nargs(1)
+        .default_value(0.0f)
+        .scan<'g', float>();
+    sampled.add_argument("--time-limit")
+        .help("Time budget in seconds for progressive accumulation. Once exhausted, the "
+              "remaining batches are skipped.")
+        .nargs(1)
+        .default_value(0.0f)
+        .scan<'g', float>();
+    sampled.add_argument("--array")
+        .help("Treats the input as a list of environments, one path per line, and "
+              "convolves them all at once as a cube map array. Writes a '.cube' file "
+              "(--ot 6) holding one cube per environment, in list order.")
+        .nargs(0)
+        .implicit_value(true)
+        .default_value(false);
+    sampled.add_argument("--split")
+        .help("With --array, writes each convolved environment to its own file instead, "
+              "'<out>_<index><ext>'.")
+        .nargs(0)
+        .implicit_value(true)
+        .default_value(false);
+    sampled.add_argument("--shard")
+        .help("Renders only shard i of N ('i/N') of the job, dealing the tiles of every "
+              "face level round robin, and writes them as a partial '.cube' file. "
+              "'merge' assembles the N shards, which can run on different machines.")
+        .nargs(1);
+    sampled.add_argument("--checkpoint")
+        .help("Saves the progress of the job to this file every --checkpoint-interval "
+              "seconds: the finished face levels, appended as they finish, and the "
+              "partial sums of the level being accumulated progressively, replaced in "
+              "'<file>.sums'. Removed once the output is written.")
+        .nargs(1);
+    sampled.add_argument("--checkpoint-interval")
+        .help("Seconds between checkpoints.")
+        .nargs(1)
+        .default_value(60.0f)
+        .scan<'g', float>();
+    sampled.add_argument("--resume")
+        .help("Continues from the --checkpoint file if it exists. It has to be saved by "
+              "the same job, with the same input and options.")
+        .nargs(0)
+        .implicit_value(true)
+        .default_value(false);
 
     /* --------------  Program -------------- */
     ArgumentParser program("iblenv", "1.0");
@@ -153,14 +360,18 @@ CliOptions ibl::ParseArgs(int argc, char* argv[]) {
         .implicit_value(true)
         .default_value(false);
 
+    brdfCmd.add_argument("--trace")
+        .help("Writes the time spent in every stage to this Chrome trace file.")
+        .nargs(1);
+
     ArgumentParser convert("convert");
     convert.add_description("Converts between multiple cubemap layouts or from a "
                             "equirectangular projection into a cubemap.");
-    convert.add_parents(inOut);
+    convert.add_parents(inOut, output);
 
     ArgumentParser irradiance("irradiance");
     irradiance.add_description("Computes irradiance into a cubemap.");
-    irradiance.add_parents(inOut, sampled);
+    irradiance.add_parents(inOut, output, sampled);
 
     irradiance.add_argument("--div-pi")
         .help("Includes the lambertian constant division in the calculation.")
@@ -168,10 +379,19 @@ CliOptions ibl::ParseArgs(int argc, char* argv[]) {
         .implicit_value(true)
         .default_value(false);
 
+    irradiance.add_argument("--exact")
+        .help("Computes irradiance on the CPU as an exact sum over the environment "
+              "downsampled to this many pixels per face (e.g. 32). Noise free, its cost "
+              "doesn't depend on the input size and cube inputs need no OpenGL context. "
+              "Sampling options are ignored.")
+        .nargs(1)
+        .default_value(0)
+        .scan<'i', int>();
+
     ArgumentParser specular("specular");
     specular.add_description("Computes separable specular lobe convolution to use with "
                              "brdf's precomputation. Outputs several cube mip levels.");
-    specular.add_parents(inOut, sampled);
+    specular.add_parents(inOut, output, sampled);
 
     specular.add_argument("-l", "--levels")
         .help("Number of mip levels in the output cubemap.")
@@ -179,12 +399,50 @@ CliOptions ibl::ParseArgs(int argc, char* argv[]) {
         .default_value(9)
         .scan<'i', int>();
 
+    specular.add_argument("--filter")
+        .help("Filtering strategy. 'direct' filters every level from the environment, "
+              "'cascaded' filters each level from the previous one with the incremental "
+              "lobe.")
+        .nargs(1)
+        .default_value("direct")
+        .choices("direct", "cascaded");
+
+    specular.add_argument("--cascade-error")
+        .help("Maximum lobe deviation (estimated total variation distance) accepted for "
+              "a cascaded level. Levels above it are filtered directly. The estimate "
+              "ignores the blur of fetching the previous level. Without that blur, a "
+              "level would deviate from direct filtering by at most 2 * distance * max "
+              "radiance. The error against brute force is only measured, by "
+              "'iblenv_bench --pareto -f cascaded'.")
+        .nargs(1)
+        .default_value(0.05f)
+        .scan<'g', float>();
+
+    specular.add_argument("--kernel-cache")
+        .help("Applies the convolution on the CPU as precomputed sparse kernels stored "
+              "in this file, building it first if it's missing, unusable (another "
+              "version, truncated or corrupted) or was built with other settings. "
+              "Kernels depend on the output size, levels, --spp, --sequence and "
+              "prefiltering, any environment can reuse them. Cube inputs need no "
+              "OpenGL context, other sampling options are ignored.")
+        .nargs(1);
+
+    ArgumentParser merge("merge");
+    merge.add_description("Assembles the partial '.cube' files written by the shards of "
+                          "an irradiance or specular job (--shard).");
+    merge.add_parents(output);
+
+    merge.add_argument("shards")
+        .help("Partial '.cube' files of all the shards.")
+        .nargs(nargs_pattern::at_least_one);
+
     /* -------------------------------------- */
 
     program.add_subparser(brdfCmd);
     program.add_subparser(convert);
     program.add_subparser(irradiance);
     program.add_subparser(specular);
+    program.add_subparser(merge);
 
     program.parse_args(argc, argv);
 
@@ -3,10 +3,19 @@
 
 #include <iblenv.h>
 #include <cubemap.h>
+#include <astc.h>
+#include <sampling.h>
 
 namespace ibl {
 
-enum class Mode { Unknown, Brdf, Irradiance, Convert, Specular };
+enum class Mode { Unknown, Brdf, Irradiance, Convert, Specular, Merge };
+
+enum class SpecularFilter { Direct, Cascaded };
+
+const std::map<std::string, SpecularFilter> SpecularFilterNames{
+    {"direct",   SpecularFilter::Direct  },
+    {"cascaded", SpecularFilter::Cascaded}
+};
 
 struct CliOptions {
     Mode mode = Mode::Unknown;
@@ -16,13 +25,39 @@ struct CliOptions {
     std::string inFile;
     unsigned int numSamples;
     int mipLevels;
+    SpecularFilter filter = SpecularFilter::Direct;
+    float cascadeError = 0.05f;
+    std::string kernelCache;
     int texSize;
     bool multiScattering;
     bool divideLambertConstant;
+    int quadratureSize = 0;
     bool usePrefilteredIS;
+    Sequence sequence = Sequence::Hammersley;
+    bool blueNoise = false;
+    unsigned int envSamples = 0;
+    bool extractSun = false;
+    float sunThreshold = 100.0f;
+    unsigned int batchSize = 0;
+    int tileSize = 0;
+    float timeLimit = 0.0f;
+    float adaptiveError = 0.0f;
+    bool probeArray = false; // Input lists environments convolved as a cube map array
+    bool splitProbes = false;
+    int shardIndex = 0, shardCount = 0; // --shard i/N, no shards runs the whole job
+    std::vector<std::string> shardFiles;
+    std::string checkpointFile;
+    float checkpointInterval = 60.0f; // Seconds
+    bool resume = false;
     bool useHalf;
     bool isInputEquirect;
     bool flipUv;
+    unsigned int numThreads = 0;
+    std::string traceFile;
+    unsigned int memoryBudget = 0; // MiB
+    bool exportAstc = false;
+    AstcOptions astc;
+    ExportOptions exportOpts;
 };
 
 CliOptions ParseArgs(int argc, char* argv[]);
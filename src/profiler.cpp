@@ -0,0 +1,212 @@
+#include <profiler.h>
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <set>
+
+using namespace ibl;
+using namespace std::literals;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const std::array StageNames{"load",     "upload",  "mips",    "compile", "draw",
+                            "readback", "convert", "compute", "save"};
+
+struct Span {
+    std::string name;
+    Stage stage;
+    std::int64_t start; // Nanoseconds since the profiler was reset
+    std::int64_t duration;
+    std::uint32_t track;
+    bool summarized;
+};
+
+struct PendingQuery {
+    GLuint begin, end;
+    Stage stage;
+    std::string name;
+};
+
+// GPU spans get a track of their own, threads are numbered from 1
+constexpr std::uint32_t GpuTrack = 0;
+
+std::mutex ProfilerMutex;
+std::vector<Span> Spans;
+std::vector<PendingQuery> Pending;
+Clock::time_point Origin = Clock::now();
+std::uint32_t MainTrack = 1;
+
+// GPU timestamps to profiler time, measured once per context
+std::optional<std::int64_t> GpuOffset;
+
+std::atomic<std::uint32_t> NextTrack{1};
+thread_local const std::uint32_t Track = NextTrack++;
+thread_local std::array<int, StageNames.size()> Depth{};
+thread_local const ScopedTimer* Innermost = nullptr;
+const ScopedTimer* MainInnermost = nullptr; // Innermost of the summarized thread
+
+std::int64_t Now() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(Clock::now() - Origin).count();
+}
+
+std::string Escape(const std::string& str) {
+    std::string escaped;
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            escaped.push_back('\\');
+        escaped.push_back(c);
+    }
+    return escaped;
+}
+
+} // namespace
+
+ScopedTimer::ScopedTimer(Stage stage, std::string name)
+    : stage(stage), name(std::move(name)), start(Now()), parent(Innermost) {
+    ++Depth[static_cast<int>(stage)];
+
+    Innermost = this;
+    if (Track == MainTrack) {
+        std::lock_guard lock{ProfilerMutex};
+        MainInnermost = this;
+    }
+}
+
+ScopedTimer::~ScopedTimer() {
+    const auto end = Now();
+    const bool outermost = --Depth[static_cast<int>(stage)] == 0;
+    const bool summarized = outermost && Track == MainTrack;
+
+    Innermost = parent;
+
+    std::lock_guard lock{ProfilerMutex};
+    if (Track == MainTrack)
+        MainInnermost = parent;
+
+    Spans.push_back({std::move(name), stage, start, end - start, Track, summarized});
+}
+
+ScopedGpuTimer::ScopedGpuTimer(Stage stage, std::string name)
+    : stage(stage), name(std::move(name)) {
+    if (!GpuOffset) {
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        GpuOffset = Now() - gpuNow;
+    }
+
+    glGenQueries(1, &begin);
+    glQueryCounter(begin, GL_TIMESTAMP);
+}
+
+ScopedGpuTimer::~ScopedGpuTimer() {
+    GLuint end = 0;
+    glGenQueries(1, &end);
+    glQueryCounter(end, GL_TIMESTAMP);
+
+    std::lock_guard lock{ProfilerMutex};
+    Pending.push_back({begin, end, stage, std::move(name)});
+}
+
+void ibl::ResetProfiler() {
+    std::lock_guard lock{ProfilerMutex};
+    Spans.clear();
+    Pending.clear();
+    GpuOffset.reset();
+    Origin = Clock::now();
+    MainTrack = Track;
+    MainInnermost = Innermost;
+}
+
+std::string ibl::ActiveScope() {
+    if (Innermost)
+        return Innermost->name;
+
+    std::lock_guard lock{ProfilerMutex};
+    return MainInnermost ? MainInnermost->name : "";
+}
+
+void ibl::ResolveGpuTimers() {
+    std::lock_guard lock{ProfilerMutex};
+
+    for (auto& query : Pending) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(query.begin, GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(query.end, GL_QUERY_RESULT, &end);
+        glDeleteQueries(1, &query.begin);
+        glDeleteQueries(1, &query.end);
+
+        auto start = static_cast<std::int64_t>(begin) + GpuOffset.value_or(0);
+        Spans.push_back({std::move(query.name), query.stage, start,
+                         static_cast<std::int64_t>(end - begin), GpuTrack, true});
+    }
+
+    // A new context has its own timestamp origin
+    Pending.clear();
+    GpuOffset.reset();
+}
+
+std::string ibl::ProfileSummary() {
+    std::array<double, StageNames.size()> cpu{}, gpu{};
+
+    {
+        std::lock_guard lock{ProfilerMutex};
+        for (const auto& span : Spans) {
+            if (!span.summarized)
+                continue;
+
+            auto& sum = span.track == GpuTrack ? gpu : cpu;
+            sum[static_cast<int>(span.stage)] += span.duration * 1e-9;
+        }
+    }
+
+    std::string summary = "Timings:";
+    for (std::size_t i = 0; i < StageNames.size(); ++i) {
+        if (cpu[i] > 0.0)
+            summary += std::format(" {} {:.3f}s,", StageNames[i], cpu[i]);
+        if (gpu[i] > 0.0)
+            summary += std::format(" {} {:.3f}s [gpu],", StageNames[i], gpu[i]);
+    }
+
+    return summary + std::format(" total {:.3f}s", Now() * 1e-9);
+}
+
+void ibl::ExportTrace(const fs::path& filePath) {
+    std::ofstream file(filePath);
+    if (!file)
+        FATAL("Couldn't open file {}", filePath.string());
+
+    std::lock_guard lock{ProfilerMutex};
+
+    std::set<std::uint32_t> tracks;
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+    for (const auto& span : Spans) {
+        tracks.insert(span.track);
+        file << std::format("{{\"name\": \"{}\", \"cat\": \"{}\", \"ph\": \"X\", ",
+                            Escape(span.name), StageNames[static_cast<int>(span.stage)])
+             << std::format("\"ts\": {:.3f}, \"dur\": {:.3f}, ", span.start * 1e-3,
+                            span.duration * 1e-3)
+             << std::format("\"pid\": 1, \"tid\": {}}},\n", span.track);
+    }
+
+    // Track names, the last event closes the list
+    for (auto track : tracks) {
+        auto name = track == GpuTrack    ? "GPU"s
+                    : track == MainTrack ? "main"s
+                                         : std::format("worker {}", track);
+        file << std::format("{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                            "\"tid\": {}, \"args\": {{\"name\": \"{}\"}}}},\n",
+                            track, name);
+    }
+
+    file << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+            "\"args\": {\"name\": \"iblenv\"}}\n]}\n";
+}
@@ -0,0 +1,76 @@
+#ifndef IBL_PROFILER_H
+#define IBL_PROFILER_H
+
+#include <iblenv.h>
+
+namespace fs = std::filesystem;
+
+namespace ibl {
+
+// Pipeline stage a timed span is attributed to in the summary
+enum class Stage : std::uint32_t {
+    Load,
+    Upload,
+    Mips,
+    Compile,
+    Draw,
+    Readback,
+    Convert,
+    Compute,
+    Save
+};
+
+// Times the enclosing scope on the CPU. In the summary only scopes on the thread that
+// started the job count, and a scope nested in another of the same stage doesn't.
+class ScopedTimer {
+public:
+    ScopedTimer(Stage stage, std::string name);
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    friend std::string ActiveScope();
+
+    Stage stage;
+    std::string name;
+    std::int64_t start;
+    const ScopedTimer* parent;
+};
+
+// Times the GL commands issued in the enclosing scope with timestamp queries. Results
+// are only read by ResolveGpuTimers, so timing never stalls the pipeline.
+class ScopedGpuTimer {
+public:
+    ScopedGpuTimer(Stage stage, std::string name);
+    ~ScopedGpuTimer();
+
+    ScopedGpuTimer(const ScopedGpuTimer&) = delete;
+    ScopedGpuTimer& operator=(const ScopedGpuTimer&) = delete;
+
+private:
+    Stage stage;
+    std::string name;
+    unsigned int begin = 0;
+};
+
+// Clears all recorded spans and makes the calling thread the one summarized
+void ResetProfiler();
+
+// Name of the innermost ScopedTimer of the calling thread, or else of the thread that
+// started the job. Empty outside any.
+std::string ActiveScope();
+
+// Reads back every pending GPU timer. Needs the context the timers were issued in.
+void ResolveGpuTimers();
+
+// Time per stage on one line. GPU stages report GPU time.
+std::string ProfileSummary();
+
+// Writes all spans in the Chrome trace event format (chrome://tracing, Perfetto)
+void ExportTrace(const fs::path& filePath);
+
+} // namespace ibl
+
+#endif
@@ -0,0 +1,217 @@
+#include <projection.h>
+
+#include <cubemap.h>
+#include <parallel.h>
+
+#include <algorithm>
+#include <cstring>
+#include <numbers>
+#include <optional>
+
+using namespace ibl;
+
+namespace {
+
+constexpr float Pi = std::numbers::pi_v<float>;
+constexpr float InvPi = std::numbers::inv_pi_v<float>;
+
+// Bilinear footprints of a row of output texels, as offsets into the source floats
+struct Footprint {
+    std::vector<std::uint32_t> top0, top1, bottom0, bottom1;
+    std::vector<float> tx, ty;
+
+    explicit Footprint(std::size_t n)
+        : top0(n), top1(n), bottom0(n), bottom1(n), tx(n), ty(n) {}
+};
+
+// Weighs the footprints of a row into out. Kept apart from the footprint computation,
+// the loop has no transcendental calls or branches left and vectorizes.
+void BlendRow(const float* src, const Footprint& fp, int channels, float* out) {
+    for (std::size_t x = 0; x < fp.tx.size(); ++x) {
+        const float tx = fp.tx[x], ty = fp.ty[x];
+        const float w00 = (1.0f - tx) * (1.0f - ty), w01 = tx * (1.0f - ty);
+        const float w10 = (1.0f - tx) * ty, w11 = tx * ty;
+
+        for (int c = 0; c < channels; ++c) {
+            out[channels * x + c] =
+                w00 * src[fp.top0[x] + c] + w01 * src[fp.top1[x] + c] +
+                w10 * src[fp.bottom0[x] + c] + w11 * src[fp.bottom1[x] + c];
+        }
+    }
+}
+
+// Direction of a point (a, b) of the octahedral square [-1, 1]^2, a along +X and b along
+// +Z. Past an edge the map continues mirrored around the edge midpoint.
+std::array<float, 3> OctahedralDir(float a, float b) {
+    while (std::abs(a) > 1.0f || std::abs(b) > 1.0f) {
+        if (std::abs(a) > 1.0f) {
+            a = std::copysign(2.0f, a) - a;
+            b = -b;
+        } else {
+            b = std::copysign(2.0f, b) - b;
+            a = -a;
+        }
+    }
+
+    std::array dir{a, 1.0f - std::abs(a) - std::abs(b), b};
+    if (dir[1] < 0.0f) {
+        dir[0] = std::copysign(1.0f - std::abs(b), a);
+        dir[2] = std::copysign(1.0f - std::abs(a), b);
+    }
+
+    const float len = std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+    for (auto& c : dir)
+        c /= len;
+
+    return dir;
+}
+
+// Direction of a point (u, v) of an equirect image, v = 0 at +Y. Past the poles and the
+// sides the trigonometric functions continue the map on their own.
+std::array<float, 3> EquirectDir(float u, float v) {
+    const float phi = (u - 0.5f) * 2.0f * Pi, lat = (0.5f - v) * Pi;
+    return {std::cos(lat) * std::cos(phi), std::sin(lat), std::cos(lat) * std::sin(phi)};
+}
+
+// Faces of one level stacked vertically as 32 bit floats, +X first
+Image StackFaces(const CubeImage& cube, int lvl) {
+    auto fmt = cube.imgFormat(lvl);
+    fmt.pFmt = PixelFormat::F32;
+
+    Image stack{{PixelFormat::F32, fmt.width, 6 * fmt.height, fmt.nChannels}, 1};
+    for (int face = 0; face < 6; ++face) {
+        auto level = ImageView{cube[face], lvl}.convertTo(fmt);
+        std::memcpy(stack.data() + face * level.size(), level.data(), level.size());
+    }
+
+    return stack;
+}
+
+Image ProjectLevel(const CubeImage& cube, int lvl, Projection proj, int padding) {
+    const auto faceFmt = cube.imgFormat(lvl);
+    const int size = faceFmt.width, channels = faceFmt.nChannels;
+    const auto stack = StackFaces(cube, lvl);
+    const auto* src = reinterpret_cast<const float*>(stack.data());
+
+    const int width = (proj == Projection::Octahedral ? 2 : 4) * size;
+    const int height = 2 * size;
+    Image out{{PixelFormat::F32, width + 2 * padding, height + 2 * padding, channels}, 1};
+    const auto outFmt = out.format();
+
+    // Offset of texel (x, y) of face. Texels off the face are looked up through the
+    // direction of their center, past a corner that lands on the nearest corner texel.
+    auto Tap = [&](int face, int x, int y) -> std::uint32_t {
+        if (x < 0 || y < 0 || x >= size || y >= size) {
+            const auto [f, tx, ty] = CubeDirTexel(
+                CubeFaceDir(face, (x + 0.5f) / size, (y + 0.5f) / size), size);
+            face = f;
+            x = tx;
+            y = ty;
+        }
+
+        return channels * ((face * size + y) * size + x);
+    };
+
+    ParallelFor(outFmt.height, [&](std::size_t row) {
+        auto* dst = reinterpret_cast<float*>(out.data()) + row * outFmt.width * channels;
+        const float v = (static_cast<float>(row) - padding + 0.5f) / height;
+
+        Footprint fp(outFmt.width);
+        for (int x = 0; x < outFmt.width; ++x) {
+            const float u = (x - padding + 0.5f) / width;
+            const auto dir = proj == Projection::Octahedral
+                                 ? OctahedralDir(2.0f * u - 1.0f, 2.0f * v - 1.0f)
+                                 : EquirectDir(u, v);
+
+            // Bilinear, taps past the face edge are fetched from the neighbouring face
+            const auto [face, s, t] = CubeDirFaceST(dir);
+            const float px = s * size - 0.5f, py = t * size - 0.5f;
+            const float x0 = std::floor(px), y0 = std::floor(py);
+            fp.tx[x] = px - x0;
+            fp.ty[x] = py - y0;
+
+            const int left = static_cast<int>(x0), top = static_cast<int>(y0);
+            fp.top0[x] = Tap(face, left, top);
+            fp.top1[x] = Tap(face, left + 1, top);
+            fp.bottom0[x] = Tap(face, left, top + 1);
+            fp.bottom1[x] = Tap(face, left + 1, top + 1);
+        }
+
+        BlendRow(src, fp, channels, dst);
+    });
+
+    if (faceFmt.pFmt != PixelFormat::F32)
+        return out.convertTo({faceFmt.pFmt, outFmt.width, outFmt.height, channels});
+
+    return out;
+}
+
+} // namespace
+
+std::unique_ptr<CubeImage> ibl::EquirectToCube(const ImageView& equirect, int size) {
+    const auto srcFmt = equirect.format();
+    if (srcFmt.width / 2 != srcFmt.height)
+        FATAL("Input is not an equirectangular mapping.");
+
+    // Float RGB source, the inner loop only reads floats
+    const ImageFormat rgbFmt{PixelFormat::F32, srcFmt.width, srcFmt.height, 3};
+    std::optional<Image> converted;
+    if (srcFmt.pFmt != PixelFormat::F32 || srcFmt.nChannels != 3)
+        converted = equirect.convertTo(rgbFmt);
+
+    const auto* src =
+        reinterpret_cast<const float*>(converted ? converted->data() : equirect.data());
+    const int width = srcFmt.width, height = srcFmt.height;
+
+    ImageFormat outFmt{PixelFormat::F32, size, size, 3};
+    auto cube = std::make_unique<CubeImage>(outFmt, 1);
+
+    ParallelFor(6 * static_cast<std::size_t>(size), [&](std::size_t row) {
+        const int face = static_cast<int>(row / size);
+        const int y = static_cast<int>(row % size);
+        auto* out = reinterpret_cast<float*>((*cube)[face].data()) + 3 * y * size;
+
+        // Texel centers of the source image around each direction, the transcendental
+        // part is done once per texel before the blend loop
+        Footprint fp(size);
+        for (int x = 0; x < size; ++x) {
+            const auto dir = CubeFaceDir(face, (x + 0.5f) / size, (y + 0.5f) / size);
+
+            // Same mapping as SphericalUVMap, v = 0 is the first row
+            float u = std::atan2(dir[2], dir[0]) * 0.5f * InvPi + 0.5f;
+            float v = 0.5f - std::asin(std::clamp(dir[1], -1.0f, 1.0f)) * InvPi;
+
+            float px = u * width - 0.5f, py = v * height - 0.5f;
+            float x0 = std::floor(px), y0 = std::floor(py);
+            fp.tx[x] = px - x0;
+            fp.ty[x] = py - y0;
+
+            // Wraps around horizontally, the poles clamp to the first and last row
+            int left = (static_cast<int>(x0) % width + width) % width;
+            int right = (left + 1) % width;
+            int top = std::clamp(static_cast<int>(y0), 0, height - 1);
+            int bottom = std::clamp(static_cast<int>(y0) + 1, 0, height - 1);
+
+            fp.top0[x] = 3 * (top * width + left);
+            fp.top1[x] = 3 * (top * width + right);
+            fp.bottom0[x] = 3 * (bottom * width + left);
+            fp.bottom1[x] = 3 * (bottom * width + right);
+        }
+
+        BlendRow(src, fp, 3, out);
+    });
+
+    return cube;
+}
+
+std::vector<Image> ibl::CubeToProjection(const CubeImage& cube, Projection proj,
+                                         int padding) {
+    if (padding < 0)
+        FATAL("Padding can't be negative, got {}", padding);
+
+    std::vector<Image> levels;
+    for (int lvl = 0; lvl < cube.numLevels(); ++lvl)
+        levels.push_back(ProjectLevel(cube, lvl, proj, padding));
+
+    return levels;
+}
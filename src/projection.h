@@ -0,0 +1,26 @@
+#ifndef IBL_PROJECTION_H
+#define IBL_PROJECTION_H
+
+#include <iblenv.h>
+#include <image.h>
+
+namespace ibl {
+
+// Resamples level 0 of an equirectangular image (width twice the height) into a cube
+// map with faces of the given side. Bilinear, wrapping around horizontally and clamped
+// at the poles. Outputs RGB 32 bit floats.
+std::unique_ptr<CubeImage> EquirectToCube(const ImageView& equirect, int size);
+
+enum class Projection { Octahedral, Equirect };
+
+// Resamples every level of a cube map to a 2D projection, one image per level in the
+// pixel format of the cube. Faces of side w map to 2w x 2w octahedral images, +Y at the
+// center and -Y folded over the corners, or to 4w x 2w equirect images laid out like
+// the input of EquirectToCube. The padding adds texels on every side that continue the
+// projection across its edges, so bilinear fetches need no seam handling.
+std::vector<Image> CubeToProjection(const CubeImage& cube, Projection proj,
+                                    int padding = 0);
+
+} // namespace ibl
+
+#endif
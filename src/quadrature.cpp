@@ -0,0 +1,116 @@
+#include <quadrature.h>
+
+#include <cubemap.h>
+#include <parallel.h>
+
+#include <numbers>
+
+using namespace ibl;
+
+namespace {
+
+// Accumulators per output texel, the inner loops vectorize over them without
+// reassociating any sum
+constexpr std::size_t Lanes = 8;
+
+// Downsampled environment as a structure of arrays, padded to a multiple of Lanes
+// with zero radiance
+struct SourceTexels {
+    std::vector<float> x, y, z; // Unit direction of the texel center
+    std::vector<float> r, g, b; // Radiance times solid angle
+
+    void resize(std::size_t n) {
+        for (auto* v : {&x, &y, &z, &r, &g, &b})
+            v->assign(n, 0.0f);
+    }
+};
+
+SourceTexels Downsample(const CubeImage& env, int size) {
+    const int srcSize = env.imgFormat().width;
+    const std::size_t faceTexels = static_cast<std::size_t>(size) * size;
+
+    SourceTexels texels;
+    texels.resize((6 * faceTexels + Lanes - 1) / Lanes * Lanes);
+
+    std::vector<float> solidAngles(static_cast<std::size_t>(srcSize) * srcSize);
+    for (int y = 0; y < srcSize; ++y)
+        for (int x = 0; x < srcSize; ++x)
+            solidAngles[y * srcSize + x] = CubeTexelSolidAngle(x, y, srcSize);
+
+    ParallelFor(6, [&](std::size_t face) {
+        const auto base = face * faceTexels;
+
+        // Every source texel adds its energy to the texel containing its center
+        for (int y = 0; y < srcSize; ++y) {
+            for (int x = 0; x < srcSize; ++x) {
+                auto dst = base + static_cast<std::size_t>(y * size / srcSize) * size +
+                           x * size / srcSize;
+                auto px = env[face].pixel(x, y);
+                auto omega = solidAngles[y * srcSize + x];
+
+                texels.r[dst] += px[0] * omega;
+                texels.g[dst] += px[1] * omega;
+                texels.b[dst] += px[2] * omega;
+            }
+        }
+
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                auto dir = CubeFaceDir(static_cast<int>(face), (x + 0.5f) / size,
+                                       (y + 0.5f) / size);
+                auto dst = base + static_cast<std::size_t>(y) * size + x;
+                texels.x[dst] = dir[0], texels.y[dst] = dir[1], texels.z[dst] = dir[2];
+            }
+        }
+    });
+
+    return texels;
+}
+
+} // namespace
+
+std::unique_ptr<CubeImage> ibl::IrradianceQuadrature(const CubeImage& env,
+                                                     int sourceSize, int outSize,
+                                                     bool dividePi) {
+    sourceSize = std::min(sourceSize, env.imgFormat().width);
+    const auto source = Downsample(env, sourceSize);
+    const auto numSource = source.x.size();
+
+    const float norm = dividePi ? std::numbers::inv_pi_v<float> : 1.0f;
+
+    ImageFormat outFmt{PixelFormat::F32, outSize, outSize, 3};
+    auto cube = std::make_unique<CubeImage>(outFmt, 1);
+
+    ParallelFor(6 * static_cast<std::size_t>(outSize), [&](std::size_t row) {
+        const int face = static_cast<int>(row / outSize);
+        const int y = static_cast<int>(row % outSize);
+        auto* out = reinterpret_cast<float*>((*cube)[face].data()) + 3 * y * outSize;
+
+        for (int x = 0; x < outSize; ++x) {
+            const auto n = CubeFaceDir(face, (x + 0.5f) / outSize, (y + 0.5f) / outSize);
+
+            std::array<float, Lanes> r{}, g{}, b{};
+            for (std::size_t i = 0; i < numSource; i += Lanes) {
+                for (std::size_t j = 0; j < Lanes; ++j) {
+                    float cosine = std::max(n[0] * source.x[i + j] +
+                                                n[1] * source.y[i + j] +
+                                                n[2] * source.z[i + j],
+                                            0.0f);
+                    r[j] += cosine * source.r[i + j];
+                    g[j] += cosine * source.g[i + j];
+                    b[j] += cosine * source.b[i + j];
+                }
+            }
+
+            float sumR = 0.0f, sumG = 0.0f, sumB = 0.0f;
+            for (std::size_t j = 0; j < Lanes; ++j)
+                sumR += r[j], sumG += g[j], sumB += b[j];
+
+            out[3 * x] = norm * sumR;
+            out[3 * x + 1] = norm * sumG;
+            out[3 * x + 2] = norm * sumB;
+        }
+    });
+
+    return cube;
+}
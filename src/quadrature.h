@@ -0,0 +1,17 @@
+#ifndef IBL_QUADRATURE_H
+#define IBL_QUADRATURE_H
+
+#include <iblenv.h>
+#include <image.h>
+
+namespace ibl {
+
+// Deterministic irradiance. Level 0 of env is downsampled to sourceSize pixels per face,
+// conserving radiant energy, and every texel of the outSize output is the exact solid
+// angle weighted sum over all downsampled texels. Outputs RGB 32 bit floats.
+std::unique_ptr<CubeImage> IrradianceQuadrature(const CubeImage& env, int sourceSize,
+                                                int outSize, bool dividePi);
+
+} // namespace ibl
+
+#endif
@@ -0,0 +1,682 @@
+#include <sampling.h>
+
+#include <cubemap.h>
+#include <parallel.h>
+
+#include <numeric>
+#include <numbers>
+#include <algorithm>
+#include <random>
+
+using namespace ibl;
+
+namespace {
+
+using std::numbers::pi_v;
+
+constexpr float Pi = pi_v<float>;
+
+// Samples are dropped while the total dropped weight stays below this fraction
+constexpr double NegligibleWeight = 1e-4;
+
+// Pre-filtered importance sampling: mip level whose texel solid angle matches the
+// solid angle covered by a sample of the given pdf
+float PrefilteredLod(const SamplingParams& params, float pdf) {
+    const float K = 4.0f;
+    float cubeSize2 = static_cast<float>(params.envSize) * params.envSize;
+    float omegaP = 4.0f * Pi / (6.0f * cubeSize2);
+    float omegaS = 1.0f / (params.numSamples * pdf);
+
+    return std::max(0.5f * std::log2(K * omegaS / omegaP), 0.0f);
+}
+
+constexpr float ToUnitFloat = 2.3283064365386963e-10f; // / 0x100000000
+
+// Largest float below one, the product above rounds up to 1 for the highest bits
+constexpr float OneMinusEpsilon = 0x1.fffffep-1f;
+
+float ToUnit(std::uint32_t bits) {
+    return std::min(bits * ToUnitFloat, OneMinusEpsilon);
+}
+
+// Fixed seeds, outputs must be reproducible
+constexpr std::uint32_t ShuffleSeed = 0x9E3779B9u;
+constexpr std::array<std::uint32_t, 2> DimensionSeeds{0x85EBCA6Bu, 0xC2B2AE35u};
+
+std::uint32_t ReverseBits(std::uint32_t bits) {
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return bits;
+}
+
+// First two Sobol dimensions. The first is the Van der Corput sequence, the second
+// uses the direction numbers of the polynomial x + 1.
+std::array<std::uint32_t, 2> Sobol(std::uint32_t i) {
+    std::uint32_t y = 0;
+    for (std::uint32_t bits = i, v = 1u << 31; bits != 0; bits >>= 1, v ^= v >> 1)
+        if (bits & 1)
+            y ^= v;
+
+    return {ReverseBits(i), y};
+}
+
+// Practical Hash-based Owen Scrambling, Burley 2020
+std::uint32_t LaineKarrasPermutation(std::uint32_t x, std::uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6C50B47Cu;
+    x ^= x * 0xB82F1E52u;
+    x ^= x * 0xC7AFE638u;
+    x ^= x * 0x8D22F6E6u;
+    return x;
+}
+
+std::uint32_t NestedUniformScramble(std::uint32_t x, std::uint32_t seed) {
+    return ReverseBits(LaineKarrasPermutation(ReverseBits(x), seed));
+}
+
+// Lobes are symmetric around the normal, so they are compared through the
+// distribution of the polar angle
+constexpr int NumThetaBins = 128;
+constexpr std::size_t CascadeLobeSamples = 512;
+constexpr unsigned int FitSamples = 256;
+
+int ThetaBin(const std::array<float, 3>& dir) {
+    float theta = std::acos(std::clamp(dir[2], -1.0f, 1.0f));
+    return std::min(static_cast<int>(theta / Pi * NumThetaBins), NumThetaBins - 1);
+}
+
+void DropNegligible(std::vector<LobeSample>& samples) {
+    std::vector<std::size_t> order(samples.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return samples[a].weight < samples[b].weight;
+    });
+
+    double total = 0.0;
+    for (const auto& s : samples)
+        total += s.weight;
+
+    std::vector<bool> dropped(samples.size(), false);
+
+    double droppedWeight = 0.0;
+    for (auto idx : order) {
+        droppedWeight += samples[idx].weight;
+        if (droppedWeight > NegligibleWeight * total)
+            break;
+        dropped[idx] = true;
+    }
+
+    // Keep the remaining samples in sequence order
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < samples.size(); ++i)
+        if (!dropped[i])
+            samples[n++] = samples[i];
+    samples.resize(n);
+}
+
+// Lobe samples with their weights normalized to 1, resampled down to at most
+// CascadeLobeSamples. Keeps lobe compositions at a bounded cost for any sample count.
+std::vector<LobeSample> BoundedLobe(const std::vector<LobeSample>& samples) {
+    double total = 0.0;
+    for (const auto& s : samples)
+        total += s.weight;
+
+    if (samples.size() <= CascadeLobeSamples) {
+        auto lobe = samples;
+        for (auto& s : lobe)
+            s.weight = static_cast<float>(s.weight / total);
+        return lobe;
+    }
+
+    // Systematic resampling, visiting the samples by polar angle. In sequence order its
+    // regular steps alias with the structure of low discrepancy sets.
+    std::vector<std::size_t> order(samples.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return samples[a].dir[2] > samples[b].dir[2];
+    });
+
+    std::vector<LobeSample> lobe;
+    lobe.reserve(CascadeLobeSamples);
+
+    double cumulative = 0.0;
+    std::size_t k = 0;
+    for (std::size_t m = 0; m < CascadeLobeSamples; ++m) {
+        double u = (m + 0.5) / CascadeLobeSamples * total;
+        while (k + 1 < order.size() && cumulative + samples[order[k]].weight < u)
+            cumulative += samples[order[k++]].weight;
+
+        lobe.push_back({samples[order[k]].dir, 0.0f, 1.0f / CascadeLobeSamples, 0.0f});
+    }
+
+    return lobe;
+}
+
+template<typename T>
+std::vector<SampleRange> Interleave(std::vector<T>& samples, std::size_t numBatches) {
+    std::vector<T> interleaved;
+    interleaved.reserve(samples.size());
+
+    std::vector<SampleRange> batches;
+    for (std::size_t b = 0; b < numBatches; ++b) {
+        SampleRange range{interleaved.size(), 0};
+        for (std::size_t i = b; i < samples.size(); i += numBatches, ++range.count)
+            interleaved.push_back(samples[i]);
+
+        batches.push_back(range);
+    }
+
+    samples = std::move(interleaved);
+
+    return batches;
+}
+
+// Environments are sampled by luminance
+float Luminance(const Image::PixelVal& px) {
+    float Y = 0.2126f * px[0] + 0.7152f * px[1] + 0.0722f * px[2];
+    return std::isfinite(Y) ? std::max(Y, 0.0f) : 0.0f;
+}
+
+} // namespace
+
+std::array<float, 2> ibl::SequencePoint(Sequence seq, std::uint32_t i, std::uint32_t n) {
+    switch (seq) {
+    case Sequence::Hammersley:
+        return Hammersley(i, n);
+
+    case Sequence::Sobol: {
+        auto [x, y] = Sobol(i);
+        return {ToUnit(x ^ DimensionSeeds[0]), ToUnit(y ^ DimensionSeeds[1])};
+    }
+
+    case Sequence::OwenSobol: {
+        auto [x, y] = Sobol(NestedUniformScramble(i, ShuffleSeed));
+        return {ToUnit(NestedUniformScramble(x, DimensionSeeds[0])),
+                ToUnit(NestedUniformScramble(y, DimensionSeeds[1]))};
+    }
+    }
+
+    return Hammersley(i, n);
+}
+
+std::vector<float> ibl::BlueNoiseMask(int size) {
+    const int n = size * size;
+    constexpr float Sigma = 1.5f;
+
+    // Toroidal gaussian energy contributed by a point at each offset
+    std::vector<float> kernel(n);
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            int dx = std::min(x, size - x), dy = std::min(y, size - y);
+            float dist2 = static_cast<float>(dx * dx + dy * dy);
+            kernel[y * size + x] = std::exp(-dist2 / (2.0f * Sigma * Sigma));
+        }
+    }
+
+    std::vector<bool> points(n, false);
+    std::vector<float> energy(n, 0.0f);
+
+    auto Toggle = [&](int p, bool on) {
+        points[p] = on;
+        int px = p % size, py = p / size;
+        float sign = on ? 1.0f : -1.0f;
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                int dx = (x - px + size) % size, dy = (y - py + size) % size;
+                energy[y * size + x] += sign * kernel[dy * size + dx];
+            }
+        }
+    };
+
+    // Tightest cluster is the point with highest energy, largest void the empty
+    // spot with the lowest
+    auto Find = [&](bool cluster) {
+        int best = -1;
+        for (int p = 0; p < n; ++p) {
+            if (points[p] != cluster)
+                continue;
+            if (best < 0 || (cluster ? energy[p] > energy[best]
+                                     : energy[p] < energy[best]))
+                best = p;
+        }
+        return best;
+    };
+
+    // Initial pattern, relaxed until moving the tightest cluster doesn't change it
+    std::mt19937 rng{ShuffleSeed};
+    std::uniform_int_distribution<int> dist(0, n - 1);
+
+    const int numInitial = std::max(n / 10, 1);
+    for (int placed = 0; placed < numInitial;) {
+        int p = dist(rng);
+        if (!points[p]) {
+            Toggle(p, true);
+            ++placed;
+        }
+    }
+
+    for (int it = 0; it < n; ++it) {
+        int cluster = Find(true);
+        Toggle(cluster, false);
+
+        int empty = Find(false);
+        Toggle(empty, true);
+
+        if (empty == cluster)
+            break;
+    }
+
+    std::vector<float> ranks(n);
+    auto initial = points;
+    auto initialEnergy = energy;
+
+    // Rank initial points by removing tightest clusters
+    for (int rank = numInitial - 1; rank >= 0; --rank) {
+        int cluster = Find(true);
+        Toggle(cluster, false);
+        ranks[cluster] = rank;
+    }
+
+    // Fill the remaining ranks by inserting into the largest voids
+    points = std::move(initial);
+    energy = std::move(initialEnergy);
+
+    for (int rank = numInitial; rank < n; ++rank) {
+        int empty = Find(false);
+        Toggle(empty, true);
+        ranks[empty] = rank;
+    }
+
+    for (auto& r : ranks)
+        r /= n;
+
+    return ranks;
+}
+
+std::array<float, 3> ibl::TangentToWorld(const std::array<float, 3>& v,
+                                         const std::array<float, 3>& n) {
+    std::array<float, 3> up{0.0f, 0.0f, 1.0f};
+    if (std::abs(n[2]) >= 0.999f)
+        up = {1.0f, 0.0f, 0.0f};
+
+    std::array<float, 3> t{up[1] * n[2] - up[2] * n[1], up[2] * n[0] - up[0] * n[2],
+                           up[0] * n[1] - up[1] * n[0]};
+    float len = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+    for (auto& c : t)
+        c /= len;
+
+    std::array<float, 3> b{n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2],
+                           n[0] * t[1] - n[1] * t[0]};
+
+    return {t[0] * v[0] + b[0] * v[1] + n[0] * v[2],
+            t[1] * v[0] + b[1] * v[1] + n[1] * v[2],
+            t[2] * v[0] + b[2] * v[1] + n[2] * v[2]};
+}
+
+// http://holger.dammertz.org/stuff/notes_HammersleyOnHemisphere.html
+float ibl::RadicalInverseVdC(std::uint32_t bits) {
+    return static_cast<float>(ReverseBits(bits)) * ToUnitFloat;
+}
+
+SampleTable ibl::IrradianceSampleTable(const SamplingParams& params, bool dividePi) {
+    SampleTable table;
+    table.samples.reserve(params.numSamples);
+
+    for (std::uint32_t i = 0; i < params.numSamples; ++i) {
+        auto [u, v] = SequencePoint(params.sequence, i, params.numSamples);
+
+        // Cosine weighted hemisphere, the cosine cancels with the pdf
+        float phi = 2.0f * Pi * u;
+        float cosTheta = std::sqrt(v);
+        float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+
+        if (cosTheta <= 0.0f)
+            continue;
+
+        float lod = 0.0f;
+        if (params.prefiltered)
+            lod = PrefilteredLod(params, cosTheta / Pi);
+
+        table.samples.push_back(
+            {{std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta}, lod, 1.0f,
+             cosTheta / Pi});
+    }
+
+    table.numDrawn = params.numSamples;
+
+    // PI and the cosine pdf normalization cancel out when dividing by PI
+    table.scale = (dividePi ? 1.0f : Pi) / params.numSamples;
+
+    return table;
+}
+
+SampleTable ibl::SpecularSampleTable(const SamplingParams& params, float roughness) {
+    const float a = roughness * roughness;
+    const float a2 = a * a;
+
+    SampleTable table;
+    table.samples.reserve(params.numSamples);
+
+    double sumNdotL = 0.0;
+
+    for (std::uint32_t i = 0; i < params.numSamples; ++i) {
+        auto [u, v] = SequencePoint(params.sequence, i, params.numSamples);
+
+        // GGX distributed half vector
+        float phi = 2.0f * Pi * u;
+        float cosTheta = std::sqrt((1.0f - v) / (v * (a2 - 1.0f) + 1.0f));
+        float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+
+        std::array<float, 3> H{std::cos(phi) * sinTheta, std::sin(phi) * sinTheta,
+                               cosTheta};
+
+        // Reflect V = N = (0, 0, 1) about H
+        float NdotH = H[2];
+        std::array<float, 3> L{2.0f * NdotH * H[0], 2.0f * NdotH * H[1],
+                               2.0f * NdotH * NdotH - 1.0f};
+
+        float NdotL = std::clamp(L[2], 0.0f, 1.0f);
+        if (NdotL <= 0.0f)
+            continue;
+
+        // Smith height correlated visibility, with NdotV = 1
+        float ggx1 = std::sqrt((NdotL * NdotL - NdotL * NdotL * a2) + a2);
+        float ggx2 = NdotL;
+        float G = 0.5f / (ggx1 + ggx2);
+
+        // Pdf of L is D * NdotH / (4 * VdotH), NdotH == VdotH
+        float denom = NdotH * NdotH * (a2 - 1.0f) + 1.0f;
+        float pdf = roughness > 0.0f ? a2 / (Pi * denom * denom) / 4.0f : DeltaPdf;
+
+        float lod = 0.0f;
+        if (params.prefiltered && roughness > 0.0f)
+            lod = PrefilteredLod(params, pdf);
+
+        sumNdotL += NdotL;
+        table.samples.push_back({L, lod, G * NdotL, pdf});
+    }
+
+    table.numDrawn = params.numSamples;
+
+    if (table.samples.empty())
+        FATAL("No valid specular samples for roughness {}", roughness);
+
+    table.scale = static_cast<float>(1.0 / sumNdotL);
+
+    // A perfect mirror reflects only the normal direction, every sample is the same
+    if (roughness == 0.0f) {
+        float weight = 0.0f;
+        for (const auto& s : table.samples)
+            weight += s.weight;
+
+        table.samples = {
+            {{0.0f, 0.0f, 1.0f}, 0.0f, weight, DeltaPdf}
+        };
+        return table;
+    }
+
+    DropNegligible(table.samples);
+
+    return table;
+}
+
+std::vector<SampleRange> ibl::SplitInBatches(SampleTable& table, std::size_t batchSize) {
+    const auto numSamples = table.samples.size();
+    if (batchSize == 0 || batchSize >= numSamples)
+        return {{0, numSamples}};
+
+    return Interleave(table.samples, (numSamples + batchSize - 1) / batchSize);
+}
+
+std::vector<SampleRange> ibl::SplitInBatches(std::vector<EnvSample>& samples,
+                                             std::size_t numBatches) {
+    return Interleave(samples, std::max<std::size_t>(numBatches, 1));
+}
+
+double ibl::TotalWeight(const SampleTable& table, SampleRange range) {
+    double total = 0.0;
+    for (std::size_t i = range.first; i < range.first + range.count; ++i)
+        total += table.samples[i].weight;
+    return total;
+}
+
+AliasTable::AliasTable(std::span<const double> weights)
+    : threshold(weights.size()), alias(weights.size()), pmf(weights.size()) {
+
+    sum = std::accumulate(weights.begin(), weights.end(), 0.0);
+    if (weights.empty() || sum <= 0.0)
+        return;
+
+    const auto n = weights.size();
+
+    // Vose's construction, pairs every underfull entry with an overfull one
+    std::vector<double> scaled(n);
+    std::vector<std::uint32_t> small, large;
+    for (std::uint32_t i = 0; i < n; ++i) {
+        pmf[i] = weights[i] / sum;
+        scaled[i] = pmf[i] * n;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    while (!small.empty() && !large.empty()) {
+        auto s = small.back(), l = large.back();
+        small.pop_back();
+
+        threshold[s] = static_cast<float>(scaled[s]);
+        alias[s] = l;
+
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // Leftovers are full up to rounding
+    for (auto i : large)
+        threshold[i] = 1.0f, alias[i] = i;
+    for (auto i : small)
+        threshold[i] = 1.0f, alias[i] = i;
+}
+
+std::uint32_t AliasTable::sample(float u, float* rest) const {
+    const auto n = threshold.size();
+
+    double scaled = static_cast<double>(u) * n;
+    auto idx = std::min(static_cast<std::size_t>(scaled), n - 1);
+    auto frac = static_cast<float>(scaled - idx);
+
+    if (frac < threshold[idx]) {
+        if (rest)
+            *rest = frac / threshold[idx];
+        return static_cast<std::uint32_t>(idx);
+    }
+
+    if (rest)
+        *rest = std::min((frac - threshold[idx]) / (1.0f - threshold[idx]),
+                         OneMinusEpsilon);
+    return alias[idx];
+}
+
+EnvDistribution::EnvDistribution(const CubeImage& env) {
+    faceSize = env.imgFormat().width;
+
+    const int numTexels = faceSize * faceSize;
+    solidAngles.resize(numTexels);
+    for (int y = 0; y < faceSize; ++y)
+        for (int x = 0; x < faceSize; ++x)
+            solidAngles[y * faceSize + x] = CubeTexelSolidAngle(x, y, faceSize);
+
+    ParallelFor(6, [&](std::size_t face) {
+        std::vector<float> luminance(numTexels);
+        for (int y = 0; y < faceSize; ++y)
+            for (int x = 0; x < faceSize; ++x)
+                luminance[y * faceSize + x] = Luminance(env[face].pixel(x, y));
+
+        // Bilinear lookups spread a texel over its neighbours, so each texel takes the
+        // brightest luminance around it. A lone bright texel would otherwise leave its
+        // filtered tails to samples of near zero pdf.
+        std::vector<double> weights(numTexels);
+        for (int y = 0; y < faceSize; ++y) {
+            for (int x = 0; x < faceSize; ++x) {
+                float lum = 0.0f;
+                const int x0 = std::max(x - 1, 0), x1 = std::min(x + 1, faceSize - 1);
+                const int y0 = std::max(y - 1, 0), y1 = std::min(y + 1, faceSize - 1);
+                for (int ny = y0; ny <= y1; ++ny)
+                    for (int nx = x0; nx <= x1; ++nx)
+                        lum = std::max(lum, luminance[ny * faceSize + nx]);
+
+                auto texel = y * faceSize + x;
+                weights[texel] = static_cast<double>(lum) * solidAngles[texel];
+            }
+        }
+
+        texelTables[face] = AliasTable{weights};
+    });
+
+    std::array<double, 6> faceWeights;
+    for (int face = 0; face < 6; ++face)
+        faceWeights[face] = texelTables[face].total();
+
+    faceTable = AliasTable{faceWeights};
+}
+
+float EnvDistribution::pdf(int face, std::uint32_t texel) const {
+    if (texelTables[face].total() <= 0.0)
+        return 0.0f;
+
+    auto prob = faceTable.probability(face) * texelTables[face].probability(texel);
+    return static_cast<float>(prob / solidAngles[texel]);
+}
+
+CubeImage EnvDistribution::pdfCube() const {
+    CubeImage cube{{PixelFormat::F32, faceSize, faceSize, 1}, 1};
+
+    for (int face = 0; face < 6; ++face) {
+        auto* px = reinterpret_cast<float*>(cube[face].data());
+        for (std::uint32_t texel = 0; texel < solidAngles.size(); ++texel)
+            px[texel] = pdf(face, texel);
+    }
+
+    return cube;
+}
+
+std::vector<EnvSample> EnvDistribution::samples(const SamplingParams& params) const {
+    std::vector<EnvSample> samples;
+    if (empty())
+        return samples;
+
+    samples.reserve(params.numSamples);
+
+    for (std::uint32_t i = 0; i < params.numSamples; ++i) {
+        // The remainders below live in the low bits of u. Those of the Hammersley
+        // lattice line up with the alias buckets and skew the texel counts, so the
+        // environment is always drawn with a scrambled sequence.
+        auto [u, v] = SequencePoint(Sequence::OwenSobol, i, params.numSamples);
+
+        // u picks the face, its remainder the texel and the next remainder the
+        // horizontal offset within the texel
+        float rest = 0.0f, s = 0.0f;
+        auto face = static_cast<int>(faceTable.sample(u, &rest));
+        auto texel = texelTables[face].sample(rest, &s);
+
+        const int x = texel % faceSize, y = texel / faceSize;
+        auto dir = CubeFaceDir(face, (x + s) / faceSize, (y + v) / faceSize);
+
+        float pdf = this->pdf(face, texel);
+
+        float lod = 0.0f;
+        if (params.prefiltered)
+            lod = PrefilteredLod(params, pdf);
+
+        samples.push_back({dir, lod, pdf});
+    }
+
+    return samples;
+}
+
+CascadedLobe::CascadedLobe() : lobe{{{0.0f, 0.0f, 1.0f}, 0.0f, 1.0f, DeltaPdf}} {}
+
+std::vector<double> CascadedLobe::composedHistogram(
+    const std::vector<LobeSample>& inc) const {
+    // Every incremental direction fetches the previous level, which holds the
+    // previous effective lobe around that direction
+    std::vector<double> hist(NumThetaBins, 0.0);
+    for (const auto& i : inc) {
+        for (const auto& j : lobe) {
+            double w = static_cast<double>(i.weight) * j.weight;
+            hist[ThetaBin(TangentToWorld(j.dir, i.dir))] += w;
+        }
+    }
+
+    return hist;
+}
+
+double CascadedLobe::distance(const SampleTable& incremental,
+                              const SampleTable& direct) const {
+    auto composed = composedHistogram(BoundedLobe(incremental.samples));
+
+    std::vector<double> target(NumThetaBins, 0.0);
+    auto directWeight = TotalWeight(direct, {0, direct.samples.size()});
+    for (const auto& s : direct.samples)
+        target[ThetaBin(s.dir)] += s.weight / directWeight;
+
+    double dist = 0.0;
+    for (int b = 0; b < NumThetaBins; ++b)
+        dist += std::abs(composed[b] - target[b]);
+
+    return 0.5 * dist;
+}
+
+void CascadedLobe::compose(const SampleTable& incremental) {
+    auto inc = BoundedLobe(incremental.samples);
+
+    std::vector<LobeSample> pairs;
+    pairs.reserve(inc.size() * lobe.size());
+    for (const auto& i : inc)
+        for (const auto& j : lobe)
+            pairs.push_back(
+                {TangentToWorld(j.dir, i.dir), 0.0f, i.weight * j.weight, 0.0f});
+
+    // Keep a bounded representation of the new lobe
+    lobe = BoundedLobe(pairs);
+}
+
+void CascadedLobe::reset(const SampleTable& direct) {
+    lobe = BoundedLobe(direct.samples);
+}
+
+float CascadedLobe::fitIncrement(float from, float to, const SampleTable& direct) const {
+    // Small table, only used to compare lobe shapes
+    const SamplingParams params{FitSamples, 1, false, Sequence::Hammersley};
+
+    auto Distance = [&](float rough) {
+        return distance(SpecularSampleTable(params, rough), direct);
+    };
+
+    // Golden section search around the Gaussian estimate
+    float guess = IncrementalRoughness(from, to);
+    float lo = 0.5f * guess, hi = std::min(1.5f * guess, 1.0f);
+
+    constexpr float InvPhi = 0.6180339887f;
+    float x1 = hi - InvPhi * (hi - lo), x2 = lo + InvPhi * (hi - lo);
+    double d1 = Distance(x1), d2 = Distance(x2);
+
+    for (int it = 0; it < 12; ++it) {
+        if (d1 < d2) {
+            hi = x2, x2 = x1, d2 = d1;
+            x1 = hi - InvPhi * (hi - lo);
+            d1 = Distance(x1);
+        } else {
+            lo = x1, x1 = x2, d1 = d2;
+            x2 = lo + InvPhi * (hi - lo);
+            d2 = Distance(x2);
+        }
+    }
+
+    float best = 0.5f * (lo + hi);
+    return Distance(best) < Distance(guess) ? best : guess;
+}
@@ -0,0 +1,187 @@
+#ifndef IBL_SAMPLING_H
+#define IBL_SAMPLING_H
+
+#include <iblenv.h>
+#include <image.h>
+
+namespace ibl {
+
+// Tangent space sample of a convolution lobe. Matches the std430 layout of the
+// sample table read by the convolution shaders (see glsl/samples.frag).
+struct alignas(16) LobeSample {
+    std::array<float, 3> dir; // Tangent space direction, z is the normal
+    float lod;                // Environment mip level to fetch
+    float weight;             // Radiance weight
+    float pdf;                // Solid angle pdf the direction was drawn with
+};
+
+// Solid angle pdf standing for a delta lobe (mirror), overwhelms any other strategy
+constexpr float DeltaPdf = 1e30f;
+
+// Result of a convolution is scale * sum(weight * L(dir, lod))
+struct SampleTable {
+    std::vector<LobeSample> samples;
+    float scale = 1.0f;
+    unsigned int numDrawn = 0; // Samples drawn, before discarding any
+};
+
+// Environment sample drawn proportionally to luminance. Matches the std430 layout of
+// the environment sample table (see glsl/samples.frag).
+struct alignas(16) EnvSample {
+    std::array<float, 3> dir; // World space direction
+    float lod;                // Environment mip level to fetch
+    float pdf;                // Solid angle pdf of the environment distribution
+};
+
+// Low discrepancy sequences for the sample tables
+enum class Sequence {
+    Hammersley, // Fixed 2D point set, needs the sample count upfront
+    Sobol,      // Sobol (0, 2) sequence with a random digital shift
+    OwenSobol   // Sobol with hashed Owen scrambling, every prefix is well distributed
+};
+
+const std::map<std::string, Sequence> SequenceNames{
+    {"hammersley", Sequence::Hammersley},
+    {"sobol",      Sequence::Sobol     },
+    {"owen",       Sequence::OwenSobol }
+};
+
+struct SamplingParams {
+    unsigned int numSamples; // Samples drawn, before dropping negligible ones
+    int envSize;             // Side of the environment cube being sampled
+    bool prefiltered;        // Fetch from mip levels matching each sample's solid angle
+    Sequence sequence;
+};
+
+// Contiguous range of a sample table
+struct SampleRange {
+    std::size_t first = 0;
+    std::size_t count = 0;
+};
+
+float RadicalInverseVdC(std::uint32_t bits);
+
+// Rotates a tangent space direction around the normal n, same basis as the shaders
+std::array<float, 3> TangentToWorld(const std::array<float, 3>& v,
+                                    const std::array<float, 3>& n);
+
+inline std::array<float, 2> Hammersley(std::uint32_t i, std::uint32_t n) {
+    return {static_cast<float>(i) / static_cast<float>(n), RadicalInverseVdC(i)};
+}
+
+// i-th point of a sequence of n points in [0, 1)^2
+std::array<float, 2> SequencePoint(Sequence seq, std::uint32_t i, std::uint32_t n);
+
+// Void and cluster blue noise, size x size ranks normalized to [0, 1)
+std::vector<float> BlueNoiseMask(int size);
+
+SampleTable IrradianceSampleTable(const SamplingParams& params, bool dividePi);
+SampleTable SpecularSampleTable(const SamplingParams& params, float roughness);
+
+// Reorders the environment samples into numBatches interleaved batches
+std::vector<SampleRange> SplitInBatches(std::vector<EnvSample>& samples,
+                                        std::size_t numBatches);
+
+// Reorders the table into batches of at most batchSize samples. Batches interleave the
+// sequence (batch b holds samples b, b + n, b + 2n...), so each one spans the whole
+// lobe and a sum over the first batches is already a usable estimate.
+std::vector<SampleRange> SplitInBatches(SampleTable& table, std::size_t batchSize);
+
+// Sum of the weights of a range of the table
+double TotalWeight(const SampleTable& table, SampleRange range);
+
+// Overall gain of a table, scale * sum(weight)
+inline float TableGain(const SampleTable& table) {
+    return table.scale * TotalWeight(table, {0, table.samples.size()});
+}
+
+// Walker's alias method, constant time sampling of a discrete distribution
+class AliasTable {
+public:
+    AliasTable() = default;
+    explicit AliasTable(std::span<const double> weights);
+
+    // Index for u in [0, 1). The remainder of u is rescaled to [0, 1) into 'rest', so
+    // one uniform number also drives a continuous choice within the entry.
+    std::uint32_t sample(float u, float* rest = nullptr) const;
+
+    double probability(std::uint32_t i) const { return pmf[i]; }
+    double total() const { return sum; }
+    std::size_t size() const { return pmf.size(); }
+
+private:
+    std::vector<float> threshold;
+    std::vector<std::uint32_t> alias;
+    std::vector<double> pmf;
+    double sum = 0.0;
+};
+
+// Distribution over the texels of an environment cube level proportional to the largest
+// luminance around each texel times its solid angle. Picks a face first and then a
+// texel within it, the face tables are built in parallel.
+class EnvDistribution {
+public:
+    explicit EnvDistribution(const CubeImage& env);
+
+    // No radiance at all, nothing to sample
+    bool empty() const { return faceTable.total() <= 0.0; }
+    int size() const { return faceSize; }
+
+    // Solid angle pdf of every texel, a single channel float cube
+    CubeImage pdfCube() const;
+
+    // Draws params.numSamples directions, params.envSize is the side of the level 0
+    // of the environment when prefiltering
+    std::vector<EnvSample> samples(const SamplingParams& params) const;
+
+private:
+    float pdf(int face, std::uint32_t texel) const;
+
+    AliasTable faceTable;
+    std::array<AliasTable, 6> texelTables;
+    std::vector<float> solidAngles; // Per texel of a face, all faces are alike
+    int faceSize = 0;
+};
+
+// GGX roughness of the lobe that widens a lobe of roughness 'from' into one of
+// roughness 'to'. Lobe widths compose like Gaussians in slope space, alpha^2 adds up.
+inline float IncrementalRoughness(float from, float to) {
+    float alpha2 = to * to * to * to - from * from * from * from;
+    return std::sqrt(std::sqrt(std::max(alpha2, 0.0f)));
+}
+
+// Effective lobe of a cascade of filters, where each level is filtered from the
+// previous one with an incremental lobe.
+class CascadedLobe {
+public:
+    CascadedLobe(); // Starts as a mirror, a delta along the normal
+
+    // Estimated total variation distance between the cascade composed with an
+    // incremental lobe and the direct lobe, on theta histograms of both sample sets.
+    // Were the lobes exact and the previous level fetched without bilinear or lod blur,
+    // the cascaded level would deviate from the direct one by at most
+    // 2 * distance * gain * max(L). The estimate ignores both, it is not a bound: no
+    // bound is derived for the cascade. 'iblenv_bench --pareto -f cascaded' measures
+    // the cascaded output against the brute force reference instead.
+    double distance(const SampleTable& incremental, const SampleTable& direct) const;
+
+    void compose(const SampleTable& incremental);
+
+    // Restarts the cascade from a level filtered directly
+    void reset(const SampleTable& direct);
+
+    // Incremental roughness taking the cascade at roughness 'from' closest to the
+    // direct lobe at roughness 'to'. GGX lobes do not compose exactly, the Gaussian
+    // estimate degrades at high roughness.
+    float fitIncrement(float from, float to, const SampleTable& direct) const;
+
+private:
+    // inc has its weights normalized to 1
+    std::vector<double> composedHistogram(const std::vector<LobeSample>& inc) const;
+
+    std::vector<LobeSample> lobe; // At most 512 samples, weights normalized to 1
+};
+
+} // namespace ibl
+
+#endif
@@ -6,6 +6,7 @@
 #include <iostream>
 
 #include <util.h>
+#include <profiler.h>
 
 using namespace ibl;
 using namespace ibl::util;
@@ -169,6 +170,8 @@ Shader ibl::LoadShaderFile(const fs::path& filePath) {
         type = Fragment;
     else if (ext == ".vert" || ext == ".vs")
         type = Vertex;
+    else if (ext == ".geom" || ext == ".gs")
+        type = Geometry;
     else
         FATAL("Couldn't deduce type for shader: {}", filePath.string());
 
@@ -195,6 +198,7 @@ std::string ibl::BuildDefinesBlock(std::span<std::string> defines) {
 std::unique_ptr<Program> ibl::CompileAndLinkProgram(const std::string& name,
                                                     std::span<std::string> sourceNames,
                                                     std::span<std::string> definesList) {
+    ScopedTimer timer{Stage::Compile, "compile " + name};
 
     auto program = std::make_unique<Program>(name);
     auto defines = BuildDefinesBlock(definesList);
@@ -0,0 +1,180 @@
+#include <sun.h>
+
+#include <cubemap.h>
+#include <parallel.h>
+
+#include <algorithm>
+#include <fstream>
+#include <numbers>
+
+using namespace ibl;
+
+namespace {
+
+using std::numbers::pi;
+
+// Bright texels are only part of the sun within this angle of the brightest one
+constexpr double MaxSunAngle = 10.0 * pi / 180.0;
+
+float Luminance(const Image::PixelVal& px) {
+    float Y = 0.2126f * px[0] + 0.7152f * px[1] + 0.0722f * px[2];
+    return std::isfinite(Y) ? std::max(Y, 0.0f) : 0.0f;
+}
+
+double Dot(const std::array<float, 3>& a, const std::array<float, 3>& b) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Per texel data of a face, row major
+struct FaceTexels {
+    std::vector<float> luminance;
+    std::vector<std::array<float, 3>> dirs;
+};
+
+} // namespace
+
+std::optional<Sun> ibl::ExtractSun(CubeImage& env, float threshold) {
+    const int size = env.imgFormat().width;
+    const int numTexels = size * size;
+
+    std::vector<float> solidAngles(numTexels);
+    for (int y = 0; y < size; ++y)
+        for (int x = 0; x < size; ++x)
+            solidAngles[y * size + x] = CubeTexelSolidAngle(x, y, size);
+
+    std::array<FaceTexels, 6> faces;
+    ParallelFor(6, [&](std::size_t face) {
+        auto& texels = faces[face];
+        texels.luminance.resize(numTexels);
+        texels.dirs.resize(numTexels);
+
+        for (int y = 0; y < size; ++y) {
+            for (int x = 0; x < size; ++x) {
+                texels.luminance[y * size + x] = Luminance(env[face].pixel(x, y));
+                texels.dirs[y * size + x] = CubeFaceDir(
+                    static_cast<int>(face), (x + 0.5f) / size, (y + 0.5f) / size);
+            }
+        }
+    });
+
+    // Brightest texel and median luminance
+    std::vector<float> all;
+    all.reserve(6 * static_cast<std::size_t>(numTexels));
+    for (const auto& texels : faces)
+        all.insert(all.end(), texels.luminance.begin(), texels.luminance.end());
+
+    const auto peakIdx = std::max_element(all.begin(), all.end()) - all.begin();
+    const float peak = all[peakIdx];
+    const auto peakDir = faces[peakIdx / numTexels].dirs[peakIdx % numTexels];
+
+    auto mid = all.begin() + all.size() / 2;
+    std::nth_element(all.begin(), mid, all.end());
+    const float limit = threshold * *mid;
+
+    if (peak <= 0.0f || peak <= limit)
+        return std::nullopt;
+
+    // Sun region, bright texels close to the peak
+    const double cosMaxAngle = std::cos(MaxSunAngle);
+    double regionAngle = 0.0;
+
+    for (int face = 0; face < 6; ++face) {
+        for (int texel = 0; texel < numTexels; ++texel) {
+            if (faces[face].luminance[texel] > limit &&
+                Dot(faces[face].dirs[texel], peakDir) >= cosMaxAngle)
+                regionAngle += solidAngles[texel];
+        }
+    }
+
+    // Radius of the cone with the same solid angle
+    const double radius = std::acos(std::max(1.0 - regionAngle / (2.0 * pi), -1.0));
+
+    // Fill radiance from a ring around the region, at least a couple of texels wide
+    const double texelAngle = 2.0 * pi / (4.0 * size);
+    const double cosRing = std::cos(std::min(2.0 * radius + 2.0 * texelAngle, pi));
+
+    std::array<double, 3> fill{};
+    double ringAngle = 0.0;
+
+    for (int face = 0; face < 6; ++face) {
+        for (int texel = 0; texel < numTexels; ++texel) {
+            const auto& texels = faces[face];
+            if (texels.luminance[texel] > limit ||
+                Dot(texels.dirs[texel], peakDir) < cosRing)
+                continue;
+
+            auto px = env[face].pixel(texel % size, texel / size);
+            for (int c = 0; c < 3; ++c)
+                fill[c] += px[c] * solidAngles[texel];
+            ringAngle += solidAngles[texel];
+        }
+    }
+
+    if (ringAngle > 0.0)
+        for (auto& c : fill)
+            c /= ringAngle;
+
+    // Move the radiance above the fill into the sun
+    std::array<double, 3> energy{};
+    std::array<double, 3> centroid{};
+
+    for (int face = 0; face < 6; ++face) {
+        for (int texel = 0; texel < numTexels; ++texel) {
+            const auto& texels = faces[face];
+            const auto& dir = texels.dirs[texel];
+            if (texels.luminance[texel] <= limit || Dot(dir, peakDir) < cosMaxAngle)
+                continue;
+
+            const int x = texel % size, y = texel / size;
+            auto px = env[face].pixel(x, y);
+
+            Image::PixelVal excess{};
+            for (int c = 0; c < 3; ++c) {
+                excess[c] = std::max(px[c] - static_cast<float>(fill[c]), 0.0f);
+                energy[c] += excess[c] * solidAngles[texel];
+                px[c] = static_cast<float>(fill[c]);
+            }
+
+            const double weight = Luminance(excess) * solidAngles[texel];
+            for (int c = 0; c < 3; ++c)
+                centroid[c] += weight * dir[c];
+
+            env[face].setPixel(px, x, y);
+        }
+    }
+
+    const double len = std::sqrt(centroid[0] * centroid[0] + centroid[1] * centroid[1] +
+                                 centroid[2] * centroid[2]);
+
+    Sun sun;
+    sun.dir = peakDir;
+    if (len > 0.0)
+        for (int c = 0; c < 3; ++c)
+            sun.dir[c] = static_cast<float>(centroid[c] / len);
+
+    sun.angularRadius = static_cast<float>(radius);
+    sun.solidAngle = static_cast<float>(regionAngle);
+    for (int c = 0; c < 3; ++c) {
+        sun.irradiance[c] = static_cast<float>(energy[c]);
+        sun.radiance[c] = static_cast<float>(energy[c] / regionAngle);
+    }
+
+    return sun;
+}
+
+void ibl::ExportSun(const fs::path& filePath, const Sun& sun) {
+    std::ofstream file(filePath);
+    if (!file)
+        FATAL("Couldn't open file {}", filePath.string());
+
+    auto Vec3 = [](const std::array<float, 3>& v) {
+        return std::format("[{}, {}, {}]", v[0], v[1], v[2]);
+    };
+
+    file << "{\n"
+         << std::format("    \"direction\": {},\n", Vec3(sun.dir))
+         << std::format("    \"angularRadius\": {},\n", sun.angularRadius)
+         << std::format("    \"solidAngle\": {},\n", sun.solidAngle)
+         << std::format("    \"irradiance\": {},\n", Vec3(sun.irradiance))
+         << std::format("    \"radiance\": {}\n", Vec3(sun.radiance)) << "}\n";
+}
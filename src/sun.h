@@ -0,0 +1,33 @@
+#ifndef IBL_SUN_H
+#define IBL_SUN_H
+
+#include <iblenv.h>
+#include <image.h>
+
+#include <optional>
+
+namespace fs = std::filesystem;
+
+namespace ibl {
+
+// Sun removed from an environment, modelled as a disk of constant radiance
+struct Sun {
+    std::array<float, 3> dir;        // Unit world direction towards the sun center
+    float angularRadius;             // Radians
+    float solidAngle;                // Steradians, of the removed region
+    std::array<float, 3> irradiance; // Irradiance at normal incidence, per channel
+    std::array<float, 3> radiance;   // Mean radiance over the disk
+};
+
+// Finds the brightest texel of level 0 and, if it is more than threshold times the
+// median luminance, removes the bright region around it. Removed texels are filled
+// with the mean radiance of a ring around the region. Only radiance above that fill
+// is moved to the returned sun.
+std::optional<Sun> ExtractSun(CubeImage& env, float threshold);
+
+// Writes the sun parameters as JSON for runtime use
+void ExportSun(const fs::path& filePath, const Sun& sun);
+
+} // namespace ibl
+
+#endif
@@ -1,5 +1,10 @@
 #include <texture.h>
 
+#include <cubemap.h>
+#include <profiler.h>
+
+#include <cstring>
+
 using namespace ibl;
 
 struct ibl::FormatInfo {
@@ -47,8 +52,8 @@ unsigned int DeduceIntFormat(int compSize, int numChannels) {
 } // namespace
 
 Texture::Texture(unsigned int target, unsigned int format, int width, int height,
-                 int levels)
-    : width(width), height(height), levels(levels), target(target) {
+                 int levels, int layers)
+    : width(width), height(height), levels(levels), layers(layers), target(target) {
 
     init(format);
 }
@@ -67,6 +72,36 @@ Texture::Texture(const CubeImage& cube) {
     upload(cube);
 }
 
+Texture::Texture(const CubeFile& cube) {
+    auto fmt = cube.imgFormat();
+
+    target = GL_TEXTURE_CUBE_MAP;
+    width = fmt.width;
+    height = fmt.height;
+    levels = MaxMipLevel(width);
+
+    auto intFormat = DeduceIntFormat(ComponentSize(fmt.pFmt), fmt.nChannels);
+    init(intFormat);
+
+    upload(cube);
+}
+
+Texture::Texture(std::span<const CubeImage> cubes) {
+    auto fmt = cubes[0].imgFormat();
+
+    target = GL_TEXTURE_CUBE_MAP_ARRAY;
+    width = fmt.width;
+    height = fmt.height;
+    levels = MaxMipLevel(width);
+    layers = cubes.size();
+
+    auto intFormat = DeduceIntFormat(ComponentSize(fmt.pFmt), fmt.nChannels);
+    init(intFormat);
+
+    for (std::size_t layer = 0; layer < cubes.size(); ++layer)
+        upload(cubes[layer], layer);
+}
+
 Texture::~Texture() {
     if (handle != 0)
         glDeleteTextures(1, &handle);
@@ -79,14 +114,21 @@ void Texture::init(unsigned int format) {
 
     info = &pair->second;
 
+    std::size_t totalSize = 0;
+    for (int lvl = 0; lvl < levels; ++lvl)
+        totalSize += sizeBytes(lvl);
+    memory.resize(totalSize);
+
     glCreateTextures(target, 1, &handle);
 
     if (target == GL_TEXTURE_2D || target == GL_TEXTURE_CUBE_MAP)
         glTextureStorage2D(handle, levels, info->intFormat, width, height);
+    else if (target == GL_TEXTURE_CUBE_MAP_ARRAY)
+        glTextureStorage3D(handle, levels, info->intFormat, width, height, 6 * layers);
 
     glTextureParameteri(handle, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTextureParameteri(handle, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    if (target == GL_TEXTURE_CUBE_MAP)
+    if (target == GL_TEXTURE_CUBE_MAP || target == GL_TEXTURE_CUBE_MAP_ARRAY)
         glTextureParameteri(handle, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
     glTextureParameteri(handle, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -98,6 +140,7 @@ void Texture::bind() const {
 }
 
 std::unique_ptr<std::byte[]> Texture::data(int level) const {
+    ScopedTimer timer{Stage::Readback, std::format("readback level {}", level)};
     auto size = sizeBytes(level);
     auto dataPtr = std::make_unique<std::byte[]>(size);
     glGetTextureImage(handle, level, info->format, info->type, size, dataPtr.get());
@@ -105,38 +148,61 @@ std::unique_ptr<std::byte[]> Texture::data(int level) const {
 }
 
 std::unique_ptr<std::byte[]> Texture::data(int face, int level) const {
+    ScopedTimer timer{Stage::Readback,
+                      std::format("readback face {} level {}", face, level)};
     auto size = sizeBytesFace(level);
     auto dataPtr = std::make_unique<std::byte[]>(size);
 
-    glBindTexture(target, handle);
-    glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, info->format, info->type,
-                  dataPtr.get());
-    glBindTexture(target, 0);
+    // Leaves the bindings alone, the convolution reads the bound environment
+    glGetTextureSubImage(handle, level, 0, 0, face, ResizeLvl(width, level),
+                         ResizeLvl(height, level), 1, info->format, info->type, size,
+                         dataPtr.get());
 
     return dataPtr;
 }
 
 void Texture::upload(const ImageView& image, int lvl) const {
+    ScopedTimer timer{Stage::Upload, std::format("upload level {}", lvl)};
     auto imgFmt = image.format(lvl);
     glTextureSubImage2D(handle, lvl, 0, 0, imgFmt.width, imgFmt.height, info->format,
                         info->type, image.data());
 }
 
-void Texture::upload(const CubeImage& cubemap) const {
+void Texture::upload(const CubeImage& cubemap, int layer) const {
+    ScopedTimer timer{Stage::Upload, "upload cubemap"};
+    for (int lvl = 0; lvl < cubemap.numLevels(); ++lvl) {
+        for (int face = 0; face < 6; ++face) {
+            glTextureSubImage3D(handle, lvl, 0, 0, 6 * layer + face,
+                                ResizeLvl(width, lvl), ResizeLvl(height, lvl), 1,
+                                info->format, info->type, cubemap[face].data(lvl));
+        }
+    }
+}
+
+void Texture::upload(const CubeFile& cubemap) const {
+    ScopedTimer timer{Stage::Upload, "upload mapped cubemap"};
     for (int lvl = 0; lvl < cubemap.numLevels(); ++lvl) {
         for (int face = 0; face < 6; ++face) {
             glTextureSubImage3D(handle, lvl, 0, 0, face, ResizeLvl(width, lvl),
                                 ResizeLvl(height, lvl), 1, info->format, info->type,
-                                cubemap[face].data(lvl));
+                                cubemap.face(face, lvl).data());
         }
     }
 }
 
+void Texture::upload(const Image& image, int face, int lvl) const {
+    ScopedTimer timer{Stage::Upload, std::format("upload face {} level {}", face, lvl)};
+    glTextureSubImage3D(handle, lvl, 0, 0, face, ResizeLvl(width, lvl),
+                        ResizeLvl(height, lvl), 1, info->format, info->type,
+                        image.data());
+}
+
 std::unique_ptr<Image> Texture::image(int level) const {
     return std::make_unique<Image>(imgFormat(level), data(level).get(), 1);
 }
 
 std::unique_ptr<CubeImage> Texture::cubemap() const {
+    ScopedTimer timer{Stage::Readback, "readback cubemap"};
     const auto fmt = imgFormat();
 
     auto cube = std::make_unique<CubeImage>(fmt, levels);
@@ -152,8 +218,53 @@ std::unique_ptr<CubeImage> Texture::cubemap() const {
     return cube;
 }
 
+std::unique_ptr<CubeImage> Texture::cubemap(int level) const {
+    ScopedTimer timer{Stage::Readback, std::format("readback cubemap level {}", level)};
+    auto cube = std::make_unique<CubeImage>(imgFormat(level), 1);
+
+    for (int faceIdx = 0; faceIdx < 6; ++faceIdx)
+        (*cube)[faceIdx] = face(faceIdx, level);
+
+    return cube;
+}
+
+std::unique_ptr<CubeImage> Texture::arrayLayer(int layer) const {
+    ScopedTimer timer{Stage::Readback, std::format("readback layer {}", layer)};
+    const auto fmt = imgFormat();
+
+    auto cube = std::make_unique<CubeImage>(fmt, levels);
+
+    // The 6 faces of a level are contiguous, read them at once
+    for (int lvl = 0; lvl < levels; ++lvl) {
+        const auto faceSize = sizeBytesFace(lvl);
+        auto dataPtr = std::make_unique<std::byte[]>(6 * faceSize);
+        glGetTextureSubImage(handle, lvl, 0, 0, 6 * layer, ResizeLvl(width, lvl),
+                             ResizeLvl(height, lvl), 6, info->format, info->type,
+                             6 * faceSize, dataPtr.get());
+
+        for (int face = 0; face < 6; ++face)
+            std::memcpy((*cube)[face].data(lvl), dataPtr.get() + face * faceSize,
+                        faceSize);
+    }
+
+    return cube;
+}
+
+Image Texture::region(int face, int level, int x, int y, int width, int height) const {
+    ScopedTimer timer{Stage::Readback,
+                      std::format("readback face {} level {} region", face, level)};
+    Image img{{info->pxFmt, width, height, info->numChannels}, 1};
+
+    glGetTextureSubImage(handle, level, x, y, face, width, height, 1, info->format,
+                         info->type, img.size(0), img.data());
+
+    return img;
+}
+
 std::size_t Texture::sizeBytes(unsigned int level) const {
-    int faces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+    int faces = target == GL_TEXTURE_CUBE_MAP         ? 6
+                : target == GL_TEXTURE_CUBE_MAP_ARRAY ? 6 * layers
+                                                      : 1;
     return sizeBytesFace(level) * faces;
 }
 
@@ -168,10 +279,15 @@ ImageFormat Texture::imgFormat(int lvl) const {
             info->numChannels};
 }
 
+unsigned int Texture::internalFormat() const {
+    return info->intFormat;
+}
+
 void Texture::setParam(GLenum param, GLint val) const {
     glTextureParameteri(handle, param, val);
 }
 
 void Texture::generateMipmaps() const {
+    ScopedGpuTimer timer{Stage::Mips, "generate mipmaps"};
     glGenerateTextureMipmap(handle);
 }
\ No newline at end of file
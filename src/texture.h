@@ -9,6 +9,7 @@
 namespace ibl {
 
 struct FormatInfo;
+class CubeFile;
 
 class Texture {
 public:
@@ -16,8 +17,11 @@ public:
         : Texture(target, format, sideSize, sideSize, 1) {}
     Texture(unsigned int target, unsigned int format, int side, int levels)
         : Texture(target, format, side, side, levels) {}
-    Texture(unsigned int target, unsigned int format, int width, int height, int levels);
+    Texture(unsigned int target, unsigned int format, int width, int height, int levels,
+            int layers = 1);
     explicit Texture(const CubeImage& cube);
+    explicit Texture(const CubeFile& cube);
+    explicit Texture(std::span<const CubeImage> cubes); // Cube map array
 
     ~Texture();
 
@@ -27,19 +31,29 @@ public:
     void setParam(GLenum param, GLint val) const;
 
     void upload(const ImageView& image, int lvl = 0) const;
-    void upload(const CubeImage& cubemap) const;
+    void upload(const CubeImage& cubemap, int layer = 0) const;
+    void upload(const CubeFile& cubemap) const;
+    void upload(const Image& image, int face, int lvl) const; // One face level of a cube
 
     std::size_t sizeBytes(unsigned int level = 0) const;
     std::size_t sizeBytesFace(unsigned int level = 0) const;
 
     ImageFormat imgFormat(int level = 0) const;
+    unsigned int internalFormat() const;
+    unsigned int textureTarget() const { return target; }
 
     std::unique_ptr<Image> image(int level = 0) const;
     std::unique_ptr<CubeImage> cubemap() const;
+    std::unique_ptr<CubeImage> cubemap(int level) const; // Just one level
+    std::unique_ptr<CubeImage> arrayLayer(int layer) const; // Cube of a cube map array
+
+    // Texels of a region of one face level
+    Image region(int face, int level, int x, int y, int width, int height) const;
 
     unsigned int handle = 0;
     int width = 0, height = 0;
     int levels = 1;
+    int layers = 1; // Cubes of a cube map array
 
 private:
     void init(unsigned int format);
@@ -53,6 +67,7 @@ private:
 
     const FormatInfo* info = nullptr;
     unsigned int target = 0;
+    TrackedBytes memory{MemCategory::Texture};
 };
 
 inline int MaxMipLevel(int width, int height = 0, int depth = 0) {
@@ -1,8 +1,11 @@
 #include <util.h>
 
 #include <image.h>
+#include <mappedfile.h>
+#include <parallel.h>
 
 #include <fstream>
+#include <cstring>
 #include <functional>
 #include <unordered_map>
 
@@ -33,26 +36,42 @@ namespace fs = std::filesystem;
 
 namespace {
 
-std::unique_ptr<Image> LoadRawImage(const std::string& filePath, const ImageFormat& fmt) {
-    std::ifstream file(filePath,
-                       std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
-    if (file.fail())
-        FATAL("Failed to open file {}", filePath);
+// Pixels allocated by a decoder, accounted until released
+template<typename T>
+using DecodedPtr = std::unique_ptr<T, decltype(&std::free)>;
 
-    auto size = file.tellg();
-    if (size == -1)
-        FATAL("Failed to query file size of {}.", filePath);
+// Size of an EXR image from its header, without decoding the pixels
+void ReadEXRSize(const std::string& filePath, int* width, int* height) {
+    EXRVersion version;
+    EXRHeader header;
+    InitEXRHeader(&header);
 
-    file.seekg(0, std::ios::beg);
+    const char* err = nullptr;
+    int ret = ParseEXRVersionFromFile(&version, filePath.c_str());
+    if (ret == TINYEXR_SUCCESS)
+        ret = ParseEXRHeaderFromFile(&header, &version, filePath.c_str(), &err);
+
+    if (ret != TINYEXR_SUCCESS) {
+        std::string errStr = "";
+        if (err) {
+            errStr = err;
+            FreeEXRErrorMessage(err);
+        }
+        FreeEXRHeader(&header);
+        FATAL("Failed to load EXR image {}: {}", filePath, errStr);
+    }
 
-    auto imgSize = ibl::ImageSize(fmt);
-    if (size != static_cast<long>(imgSize))
-        FATAL("Incompatible format specified for image {}", filePath);
+    *width = header.data_window.max_x - header.data_window.min_x + 1;
+    *height = header.data_window.max_y - header.data_window.min_y + 1;
+    FreeEXRHeader(&header);
+}
 
-    auto data = std::make_unique<std::byte[]>(size);
-    file.read(reinterpret_cast<char*>(data.get()), size);
+std::unique_ptr<MappedImage> MapRawImage(const fs::path& filePath, const ImageFormat& fmt) {
+    auto file = std::make_unique<MappedFile>(filePath);
+    if (file->size() != ImageSize(fmt))
+        FATAL("Incompatible format specified for image {}", filePath.string());
 
-    return std::make_unique<Image>(fmt, data.get(), 1);
+    return std::make_unique<MappedImage>(std::move(file), fmt, 0);
 }
 
 std::string GetPixelFormat(const ImageFormat& fmt) {
@@ -110,46 +129,79 @@ void SaveImgFormatImage(const fs::path& filePath, const ImageView& img) {
     file.write(reinterpret_cast<const char*>(img.data()), header.totalSize);
 }
 
+std::unique_ptr<MappedImage> MapImgFormatImage(const fs::path& filePath) {
+    auto file = std::make_unique<MappedFile>(filePath);
+
+    ImgHeader header;
+    if (file->size() < sizeof(ImgHeader))
+        FATAL("{} is not a valid .img file", filePath.string());
+
+    std::memcpy(&header, file->data(), sizeof(ImgHeader));
+    if (std::memcmp(header.id, ImgHeader{}.id, sizeof(header.id)) != 0)
+        FATAL("{} is not a valid .img file", filePath.string());
+
+    if (header.fmt > static_cast<std::uint32_t>(PixelFormat::F32) ||
+        header.numChannels < 1 || header.numChannels > 4 || header.levels < 1)
+        FATAL("Corrupted .img header in {}", filePath.string());
+
+    ImageFormat fmt{static_cast<PixelFormat>(header.fmt), header.width, header.height,
+                    header.numChannels};
+    if (header.totalSize != ImageSize(fmt, header.levels))
+        FATAL("Corrupted .img header in {}", filePath.string());
+
+    return std::make_unique<MappedImage>(std::move(file), fmt, sizeof(ImgHeader),
+                                         header.levels);
+}
+
 // ------------------------------------------------------------------
 //    Load image functions
 // ------------------------------------------------------------------
 std::unique_ptr<Image> LoadPNGImage(const std::string& filePath) {
     ImageFormat srcFmt{.pFmt = PixelFormat::U8};
+    if (!stbi_info(filePath.c_str(), &srcFmt.width, &srcFmt.height, &srcFmt.nChannels))
+        FATAL("Failed to load PNG image: {}", filePath);
+
+    // Sized from the header, so the budget is checked before the decoder allocates
+    TrackedBytes decoded{MemCategory::Decode, ImageSize(srcFmt)};
+
     auto* data = reinterpret_cast<std::byte*>(
         stbi_load(filePath.c_str(), &srcFmt.width, &srcFmt.height, &srcFmt.nChannels, 0));
 
     if (!data)
         FATAL("Failed to load PNG image: {}", filePath);
 
+    DecodedPtr<std::byte> pixels{data, &std::free};
+
     Print("Loaded {}x{} image {}", srcFmt.width, srcFmt.height, filePath);
 
     ImageFormat dstFmt = srcFmt;
     dstFmt.pFmt = PixelFormat::F32;
     dstFmt.nChannels = 3; // Get rid of alpha if available on source image
 
-    auto retImg = std::make_unique<Image>(dstFmt, Image{srcFmt, data});
-    free(data);
-
-    return retImg;
+    return std::make_unique<Image>(dstFmt, Image{srcFmt, pixels.get()});
 }
 
 std::unique_ptr<Image> LoadHDRImage(const std::string& filePath) {
     ImageFormat srcFmt{.pFmt = PixelFormat::F32};
+    if (!stbi_info(filePath.c_str(), &srcFmt.width, &srcFmt.height, &srcFmt.nChannels))
+        FATAL("Failed to load HDR image: {}", filePath);
+
+    TrackedBytes decoded{MemCategory::Decode, ImageSize(srcFmt)};
+
     auto* data =
         stbi_loadf(filePath.c_str(), &srcFmt.width, &srcFmt.height, &srcFmt.nChannels, 0);
 
     if (!data)
         FATAL("Failed to load HDR image: {}", filePath);
 
+    DecodedPtr<float> pixels{data, &std::free};
+
     Print("Loaded {}x{} image {}", srcFmt.width, srcFmt.height, filePath);
 
     ImageFormat dstFmt = srcFmt;
     dstFmt.nChannels = 3; // Get rid of alpha if available on source image
 
-    auto retImg = std::make_unique<Image>(dstFmt, Image{srcFmt, data});
-    free(data);
-
-    return retImg;
+    return std::make_unique<Image>(dstFmt, Image{srcFmt, pixels.get()});
 }
 
 std::unique_ptr<Image> LoadEXRImage(const std::string& filePath, bool keepAlpha = false) {
@@ -157,6 +209,9 @@ std::unique_ptr<Image> LoadEXRImage(const std::string& filePath, bool keepAlpha
     const char* err = nullptr;
 
     ImageFormat srcFmt = {.pFmt = PixelFormat::F32, .nChannels = 4};
+    ReadEXRSize(filePath, &srcFmt.width, &srcFmt.height);
+
+    TrackedBytes decoded{MemCategory::Decode, ImageSize(srcFmt)};
 
     int ret = LoadEXRWithLayer(&out, &srcFmt.width, &srcFmt.height, filePath.c_str(),
                                NULL, &err);
@@ -170,16 +225,15 @@ std::unique_ptr<Image> LoadEXRImage(const std::string& filePath, bool keepAlpha
         FATAL("Failed to load EXR image {}: {}", filePath, errStr);
     }
 
+    DecodedPtr<float> pixels{out, &std::free};
+
     Print("Loaded {}x{} image {}", srcFmt.width, srcFmt.height, filePath);
 
     ImageFormat dstFmt = srcFmt;
     if (!keepAlpha) // Throw away the alpha on copy
         dstFmt.nChannels = 3;
 
-    auto retImg = std::make_unique<Image>(dstFmt, Image{srcFmt, out});
-    free(out);
-
-    return retImg;
+    return std::make_unique<Image>(dstFmt, Image{srcFmt, pixels.get()});
 }
 
 // ------------------------------------------------------------------
@@ -301,32 +355,45 @@ std::unique_ptr<Image> util::LoadImage(const fs::path& filePath, ImageFormat* fm
         return LoadHDRImage(filePath.string());
     else if (ext == ".png")
         return LoadPNGImage(filePath.string());
+    else if (ext == ".bin" || ext == ".img")
+        return MapImage(filePath, fmt)->image();
+
+    FATAL("Unsupported format {}", ext);
+}
+
+std::unique_ptr<MappedImage> util::MapImage(const fs::path& filePath, ImageFormat* fmt) {
+    auto ext = filePath.extension().string();
+    if (ext == ".img")
+        return MapImgFormatImage(filePath);
     else if (ext == ".bin") {
         if (!fmt)
             FATAL("ImageFormat is required for loading raw dumps.");
 
-        return LoadRawImage(filePath.string(), *fmt);
+        return MapRawImage(filePath, *fmt);
     }
 
-    FATAL("Unsupported format {}", ext);
+    FATAL("Unsupported format {} for mapping", ext);
 }
 
-void util::SaveMipmappedImage(const fs::path& filePath, const Image& image) {
+fs::path util::MipLevelPath(const fs::path& filePath, int lvl, int numLevels) {
+    if (numLevels <= 1)
+        return filePath;
+
     const auto& [parent, fname, ext] = SplitFilePath(filePath);
+    return parent / std::format("{}_{}{}", fname, lvl, ext);
+}
 
+void util::SaveMipmappedImage(const fs::path& filePath, const Image& image) {
     auto numLevels = image.numLevels();
 
-    auto NameOutput = [&](int lvl) -> auto {
-        if (numLevels > 1)
-            return std::format("{}_{}{}", fname, lvl, ext);
-        return filePath.filename().string();
-    };
-
     if (numLevels > 1)
         Print("Saving {} mip levels...", numLevels);
 
-    for (int lvl = 0; lvl < image.numLevels(); ++lvl)
-        SaveImage(parent / NameOutput(lvl), ImageView{image, lvl});
+    // Levels are encoded and written concurrently
+    ParallelFor(numLevels, [&](std::size_t i) {
+        int lvl = i;
+        SaveImage(MipLevelPath(filePath, lvl, numLevels), ImageView{image, lvl});
+    });
 }
 
 void util::SaveImage(const fs::path& filePath, const ImageView& image) {
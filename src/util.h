@@ -5,6 +5,7 @@
 
 #include <optional>
 #include <filesystem>
+#include <mutex>
 
 #include <glad/glad.h>
 
@@ -15,6 +16,7 @@ namespace ibl {
 struct ImageFormat;
 class Image;
 class ImageView;
+class MappedImage;
 
 namespace util {
 
@@ -23,9 +25,16 @@ namespace util {
 // ------------------------------------------------------------------
 std::unique_ptr<Image> LoadImage(const fs::path& filePath, ImageFormat* fmt = nullptr);
 
+// Maps '.bin' and '.img' files in place. Raw dumps ('.bin') require the format.
+std::unique_ptr<MappedImage> MapImage(const fs::path& filePath,
+                                      ImageFormat* fmt = nullptr);
+
 void SaveImage(const fs::path& filePath, const ImageView& image);
 void SaveMipmappedImage(const fs::path& filePath, const Image& image);
 
+// Filename of a level when saving mip levels as separate files (name_lvl.ext)
+fs::path MipLevelPath(const fs::path& filePath, int lvl, int numLevels);
+
 // ------------------------------------------------------------------
 //    General IO
 // ------------------------------------------------------------------
@@ -42,11 +51,16 @@ inline auto SplitFilePath(const fs::path& filePath) {
 // ------------------------------------------------------------------
 //    Error handling
 // ------------------------------------------------------------------
+// Serializes output of messages printed from worker threads
+inline std::mutex PrintMutex;
+
 inline void PrintMsg(const std::string& message) {
+    std::lock_guard lock{PrintMutex};
     std::cout << "[INFO] " << message << '\n';
 }
 
 inline void PrintError(const std::string& message) {
+    std::lock_guard lock{PrintMutex};
     std::cerr << "[ERROR] " << message << '\n';
 }
 
@@ -0,0 +1,470 @@
+#include <iblapp.h>
+
+#include <parser.h>
+#include <util.h>
+#include <image.h>
+#include <cubemap.h>
+#include <mappedfile.h>
+
+#include <argparse/argparse.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <numbers>
+#include <optional>
+
+using namespace ibl;
+using namespace ibl::util;
+using namespace std::literals;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Exit code CTest reports as skipped, only used when there is no OpenGL context
+constexpr int SkipCode = 77;
+
+constexpr int EnvSize = 32;
+constexpr int LutSize = 32;
+
+enum class OutputKind { Cubemap, BrdfLut, Projection, CubeArray };
+
+// One job on the synthetic inputs. In args, '{in}', '{equirect}' and '{probes}' (a list
+// of two environments) stand for the inputs, '{out}' for the output and '{work}' for
+// the work directory.
+struct TestCase {
+    std::string name;
+    std::vector<std::string> args;
+    std::string ext; // Of the output and its golden file
+    OutputKind kind = OutputKind::Cubemap;
+    CubeLayoutType layout = CubeLayoutType::Custom;
+    bool gl = true;
+    double tolerance = 1e-3; // Relative RMSE against the golden output
+};
+
+const std::vector<TestCase> TestCases{
+    {"brdf", {"brdf", "{out}", "-s", "32", "--spp", "256", "--use32f"}, ".bin",
+     OutputKind::BrdfLut},
+    {"brdf-ms", {"brdf", "{out}", "-s", "32", "--spp", "256", "--use32f", "--ms"}, ".bin",
+     OutputKind::BrdfLut},
+    {"convert-equirect", {"convert", "{equirect}", "{out}", "-s", "32", "--ot", "6"},
+     ".cube", OutputKind::Cubemap, CubeLayoutType::Custom, false, 1e-5},
+    {"convert-layout", {"convert", "{in}", "{out}", "--it", "6", "--ot", "0"}, ".exr",
+     OutputKind::Cubemap, CubeLayoutType::HorizontalCross, false, 1e-6},
+    {"convert-octahedral", {"convert", "{in}", "{out}", "--it", "6", "--ot", "7",
+                            "--padding", "2"},
+     ".exr", OutputKind::Projection, CubeLayoutType::Octahedral, false, 1e-5},
+    {"irradiance", {"irradiance", "{in}", "{out}", "--it", "6", "--ot", "6", "-s", "16",
+                    "--spp", "256"},
+     ".cube"},
+    {"irradiance-sun", {"irradiance", "{in}", "{out}", "--it", "6", "--ot", "6", "-s",
+                        "16", "--spp", "256", "--sun", "--env-samples", "64"},
+     ".cube"},
+    {"irradiance-exact", {"irradiance", "{in}", "{out}", "--it", "6", "--ot", "6", "-s",
+                          "16", "--exact", "16"},
+     ".cube", OutputKind::Cubemap, CubeLayoutType::Custom, false, 1e-5},
+    {"irradiance-array", {"irradiance", "{probes}", "{out}", "--it", "6", "--ot", "6",
+                          "-s", "16", "--spp", "256", "--array"},
+     ".cube", OutputKind::CubeArray},
+    {"specular", {"specular", "{in}", "{out}", "--it", "6", "--ot", "6", "-s", "32", "-l",
+                  "6", "--spp", "256"},
+     ".cube"},
+    {"specular-cascaded", {"specular", "{in}", "{out}", "--it", "6", "--ot", "6", "-s",
+                           "32", "-l", "6", "--spp", "256", "--filter", "cascaded"},
+     ".cube"},
+    {"specular-kernels", {"specular", "{in}", "{out}", "--it", "6", "--ot", "6", "-s",
+                          "32", "-l", "6", "--spp", "64", "--kernel-cache",
+                          "{work}/specular.kernels"},
+     ".cube", OutputKind::Cubemap, CubeLayoutType::Custom, false, 1e-5},
+};
+
+struct RegressOptions {
+    std::vector<std::string> cases;
+    fs::path goldenDir;
+    fs::path baselineDir;
+    fs::path workDir;
+    float slowdown;
+    float slack;
+    int repeat;
+    bool updateGoldens;
+    bool updateBaseline;
+};
+
+// Sky with a moderately bright sun, deterministic and cheap to generate
+std::array<float, 3> SyntheticRadiance(const std::array<float, 3>& dir) {
+    constexpr std::array<float, 3> sunDir{0.32f, 0.83f, 0.46f};
+    constexpr float sunCos = 0.995f; // ~6 degrees
+
+    const float cosSun = dir[0] * sunDir[0] + dir[1] * sunDir[1] + dir[2] * sunDir[2];
+    if (cosSun > sunCos)
+        return {500.0f, 460.0f, 400.0f};
+
+    const float sky = 0.5f + 0.5f * dir[1];
+    return {0.2f + 0.4f * sky, 0.3f + 0.5f * sky, 0.4f + 0.8f * sky};
+}
+
+void WriteInputs(const fs::path& dir) {
+    constexpr float pi = std::numbers::pi_v<float>;
+
+    // The second probe of the list sees the sky mirrored, with the sun on the other side
+    for (bool mirrored : {false, true}) {
+        CubeImage cube{{PixelFormat::F32, EnvSize, EnvSize, 3}, 1};
+        for (int face = 0; face < 6; ++face) {
+            for (int y = 0; y < EnvSize; ++y) {
+                for (int x = 0; x < EnvSize; ++x) {
+                    auto dir =
+                        CubeFaceDir(face, (x + 0.5f) / EnvSize, (y + 0.5f) / EnvSize);
+                    if (mirrored)
+                        dir[0] = -dir[0];
+
+                    auto rgb = SyntheticRadiance(dir);
+                    cube[face].setPixel({rgb[0], rgb[1], rgb[2], 1.0f}, x, y);
+                }
+            }
+        }
+        auto name = mirrored ? "probe.cube" : "env.cube";
+        ExportCubemap((dir / name).string(), CubeLayoutType::Custom, cube);
+    }
+
+    std::ofstream probes(dir / "probes.txt");
+    probes << "env.cube\nprobe.cube\n";
+
+    const int height = EnvSize;
+    Image equirect{{PixelFormat::F32, 2 * height, height, 3}, 1};
+    for (int y = 0; y < height; ++y) {
+        const float theta = pi * (y + 0.5f) / height;
+        for (int x = 0; x < 2 * height; ++x) {
+            const float phi = 2.0f * pi * (x + 0.5f) / (2 * height);
+            auto rgb = SyntheticRadiance({std::sin(theta) * std::cos(phi),
+                                          std::cos(theta),
+                                          std::sin(theta) * std::sin(phi)});
+            equirect.setPixel({rgb[0], rgb[1], rgb[2], 1.0f}, x, y);
+        }
+    }
+    SaveImage(dir / "env.exr", equirect);
+}
+
+void RunJob(const TestCase& test, const fs::path& dir, const fs::path& out) {
+    const std::vector<std::pair<std::string, std::string>> placeholders{
+        {"{in}",       (dir / "env.cube").string()  },
+        {"{equirect}", (dir / "env.exr").string()   },
+        {"{probes}",   (dir / "probes.txt").string()},
+        {"{out}",      out.string()                 },
+        {"{work}",     dir.string()                 },
+    };
+
+    std::vector<std::string> argStrings{"iblenv"};
+    for (auto arg : test.args) {
+        for (const auto& [key, value] : placeholders)
+            if (auto pos = arg.find(key); pos != std::string::npos)
+                arg.replace(pos, key.size(), value);
+        argStrings.push_back(std::move(arg));
+    }
+
+    std::vector<char*> argv;
+    for (auto& arg : argStrings)
+        argv.push_back(arg.data());
+
+    ExecuteJob(ParseArgs(static_cast<int>(argv.size()), argv.data()));
+}
+
+// Every face (or the lookup table) of an output, all levels. Cube map arrays list the
+// faces of each cube in turn.
+std::vector<Image> LoadOutput(const TestCase& test, const fs::path& filePath) {
+    std::vector<Image> images;
+    // Lookup tables are reloaded through their mapping, which has to be read in place
+    if (test.kind == OutputKind::BrdfLut) {
+        ImageFormat fmt{PixelFormat::F32, LutSize, LutSize, 2};
+        auto mapped = MapImage(filePath, &fmt);
+
+        const auto view = mapped->view();
+        const auto& mapping = mapped->mapping();
+        if (view.data() < mapping.data() ||
+            view.data() + view.size() > mapping.data() + mapping.size())
+            FATAL("Mapped view of {} doesn't point into its mapping", filePath.string());
+
+        images.emplace_back(view.format(), view.data());
+        return images;
+    }
+
+    if (test.kind == OutputKind::Projection) {
+        images.push_back(std::move(*LoadImage(filePath)));
+        return images;
+    }
+
+    if (test.kind == OutputKind::CubeArray) {
+        CubeFile file(filePath);
+        for (int i = 0; i < file.numCubes(); ++i) {
+            auto cube = file.cubemap(i);
+            for (int face = 0; face < 6; ++face)
+                images.push_back(std::move((*cube)[face]));
+        }
+        return images;
+    }
+
+    auto cube = ImportCubeMap(filePath.string(), test.layout, nullptr);
+    for (int face = 0; face < 6; ++face)
+        images.push_back(std::move((*cube)[face]));
+    return images;
+}
+
+// RMSE of out against golden over every level, texel and channel, relative to the
+// RMS of golden
+double RelativeError(const std::vector<Image>& out, const std::vector<Image>& golden) {
+    double squared = 0.0, goldenSquared = 0.0;
+
+    if (out.size() != golden.size())
+        FATAL("Output has {} images, the golden file {}", out.size(), golden.size());
+
+    for (std::size_t i = 0; i < golden.size(); ++i) {
+        const auto fmt = golden[i].format();
+        if (out[i].numLevels() != golden[i].numLevels() ||
+            out[i].format().width != fmt.width || out[i].format().height != fmt.height ||
+            out[i].format().nChannels != fmt.nChannels)
+            FATAL("Output has another shape than the golden file");
+
+        for (int lvl = 0; lvl < golden[i].numLevels(); ++lvl) {
+            const auto lvlFmt = golden[i].format(lvl);
+            for (int y = 0; y < lvlFmt.height; ++y) {
+                for (int x = 0; x < lvlFmt.width; ++x) {
+                    for (int c = 0; c < lvlFmt.nChannels; ++c) {
+                        double g = golden[i].channel(x, y, c, lvl);
+                        double d = out[i].channel(x, y, c, lvl) - g;
+                        squared += d * d;
+                        goldenSquared += g * g;
+                    }
+                }
+            }
+        }
+    }
+
+    return goldenSquared > 0.0 ? std::sqrt(squared / goldenSquared) : std::sqrt(squared);
+}
+
+std::optional<double> ReadSeconds(const fs::path& filePath) {
+    std::ifstream file(filePath);
+    if (!file)
+        return std::nullopt;
+
+    std::string content{std::istreambuf_iterator<char>(file), {}};
+    auto pos = content.find("\"seconds\":");
+    if (pos == std::string::npos)
+        FATAL("No timing in {}", filePath.string());
+
+    return std::stod(content.substr(pos + 10));
+}
+
+void WriteSeconds(const fs::path& filePath, double seconds) {
+    fs::create_directories(filePath.parent_path());
+
+    std::ofstream file(filePath);
+    if (!file)
+        FATAL("Couldn't open file {}", filePath.string());
+
+    file << std::format("{{\"seconds\": {}}}\n", seconds);
+}
+
+bool HasOpenGL() {
+    try {
+        InitOpenGL();
+        Cleanup();
+        return true;
+    } catch (const std::runtime_error& err) {
+        Cleanup();
+        PrintError(err.what());
+        return false;
+    }
+}
+
+// Returns the exit code for CTest
+int RunTest(const TestCase& test, const RegressOptions& opts) {
+    const auto dir = opts.workDir / test.name;
+    const auto out = dir / ("out" + test.ext);
+    const auto golden = opts.goldenDir / (test.name + test.ext);
+    const auto baseline = opts.baselineDir / (test.name + ".json");
+
+    if (!opts.updateGoldens && !fs::exists(golden)) {
+        PrintError(std::format("'{}' has no golden file {}, create it with "
+                               "--update-goldens",
+                               test.name, golden.string()));
+        return 1;
+    }
+
+    if (test.gl && !HasOpenGL()) {
+        Print("Skipping '{}': no OpenGL context", test.name);
+        return SkipCode;
+    }
+
+    fs::create_directories(dir);
+    WriteInputs(dir);
+
+    // Fastest of the runs, the first one also warms up caches and the driver
+    double seconds = std::numeric_limits<double>::max();
+    for (int i = 0; i < opts.repeat; ++i) {
+        auto start = Clock::now();
+        RunJob(test, dir, out);
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        seconds = std::min(seconds, elapsed.count());
+    }
+    WriteSeconds(dir / "timing.json", seconds);
+
+    if (opts.updateGoldens) {
+        fs::create_directories(golden.parent_path());
+        fs::copy_file(out, golden, fs::copy_options::overwrite_existing);
+        Print("Updated golden file {}", golden.string());
+    }
+
+    if (opts.updateBaseline) {
+        WriteSeconds(baseline, seconds);
+        Print("Updated baseline {} to {:.3f}s", baseline.string(), seconds);
+    }
+
+    bool passed = true;
+
+    const double error = RelativeError(LoadOutput(test, out), LoadOutput(test, golden));
+    if (error > test.tolerance) {
+        PrintError(std::format("'{}' differs from {}: relative error {:.3e} above {:.1e}",
+                               test.name, golden.string(), error, test.tolerance));
+        passed = false;
+    } else {
+        Print("'{}' matches its golden file, relative error {:.3e}", test.name, error);
+    }
+
+    if (auto base = ReadSeconds(baseline)) {
+        const double ratio = seconds / *base;
+        if (seconds > *base * opts.slowdown + opts.slack) {
+            PrintError(std::format("'{}' took {:.3f}s, {:.2f}x its baseline of {:.3f}s, "
+                                   "above the {:.2f}x threshold",
+                                   test.name, seconds, ratio, *base, opts.slowdown));
+            passed = false;
+        } else {
+            Print("'{}' took {:.3f}s, {:.2f}x its baseline", test.name, seconds, ratio);
+        }
+    } else {
+        Print("'{}' took {:.3f}s, no baseline", test.name, seconds);
+    }
+
+    return passed ? 0 : 1;
+}
+
+RegressOptions ParseRegressArgs(int argc, char* argv[]) {
+    argparse::ArgumentParser program("iblenv_regress", "1.0");
+    program.add_description("Runs iblenv jobs on synthetic inputs and compares their "
+                            "outputs to golden files and their times to a baseline.");
+
+    program.add_argument("cases")
+        .help("Test cases to run, all of them by default.")
+        .nargs(argparse::nargs_pattern::any);
+    program.add_argument("--list")
+        .help("Lists the test cases and exits.")
+        .nargs(0)
+        .implicit_value(true)
+        .default_value(false);
+    program.add_argument("--golden-dir")
+        .help("Directory of the golden outputs, '<case><ext>'.")
+        .nargs(1)
+        .default_value("golden"s);
+    program.add_argument("--baseline-dir")
+        .help("Directory of the baseline timings, '<case>.json'. Tests without one only "
+              "report their time.")
+        .nargs(1)
+        .default_value("baseline"s);
+    program.add_argument("--work-dir")
+        .help("Directory for inputs, outputs and measured timings.")
+        .nargs(1)
+        .default_value((fs::temp_directory_path() / "iblenv_regress").string());
+    program.add_argument("--slowdown")
+        .help("Fails a test taking longer than its baseline times this factor.")
+        .nargs(1)
+        .default_value(1.5f)
+        .scan<'g', float>();
+    program.add_argument("--slack")
+        .help("Seconds allowed on top of the slowdown, so the fastest tests don't fail "
+              "on timer noise.")
+        .nargs(1)
+        .default_value(0.02f)
+        .scan<'g', float>();
+    program.add_argument("-r", "--repeat")
+        .help("Runs per test, the fastest is timed.")
+        .nargs(1)
+        .default_value(3)
+        .scan<'i', int>();
+    program.add_argument("--update-goldens")
+        .help("Replaces the golden outputs with the current ones.")
+        .nargs(0)
+        .implicit_value(true)
+        .default_value(false);
+    program.add_argument("--update-baseline")
+        .help("Replaces the baseline timings with the current ones.")
+        .nargs(0)
+        .implicit_value(true)
+        .default_value(false);
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        std::exit(1);
+    }
+
+    if (program.get<bool>("--list")) {
+        for (const auto& test : TestCases)
+            std::cout << test.name << "\n";
+        std::exit(0);
+    }
+
+    return {.cases = program.get<std::vector<std::string>>("cases"),
+            .goldenDir = program.get("--golden-dir"),
+            .baselineDir = program.get("--baseline-dir"),
+            .workDir = program.get("--work-dir"),
+            .slowdown = program.get<float>("--slowdown"),
+            .slack = program.get<float>("--slack"),
+            .repeat = std::max(program.get<int>("-r"), 1),
+            .updateGoldens = program.get<bool>("--update-goldens"),
+            .updateBaseline = program.get<bool>("--update-baseline")};
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        auto opts = ParseRegressArgs(argc, argv);
+
+        std::vector<const TestCase*> tests;
+        for (const auto& test : TestCases)
+            if (opts.cases.empty() ||
+                std::find(opts.cases.begin(), opts.cases.end(), test.name) !=
+                    opts.cases.end())
+                tests.push_back(&test);
+
+        if (tests.size() < std::max<std::size_t>(opts.cases.size(), 1))
+            FATAL("Unknown test case, see --list");
+
+        // A single test returns the skip code for CTest, several only fail or pass
+        if (tests.size() == 1)
+            return RunTest(*tests[0], opts);
+
+        int failed = 0, skipped = 0;
+        for (const auto* test : tests) {
+            try {
+                auto code = RunTest(*test, opts);
+                failed += code == 1;
+                skipped += code == SkipCode;
+            } catch (const std::runtime_error& err) {
+                util::PrintError(std::format("'{}' failed: {}", test->name, err.what()));
+                Cleanup();
+                ++failed;
+            }
+        }
+
+        Print("{} tests, {} failed, {} skipped", tests.size(), failed, skipped);
+        return failed > 0 ? 1 : 0;
+    } catch (const std::runtime_error& err) {
+        util::PrintError(err.what());
+        Cleanup();
+        return 1;
+    }
+}